@@ -0,0 +1,660 @@
+#include "aggregatesource.h"
+#include "samplering.h"
+#include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <lsl_cpp.h>
+
+namespace {
+const unsigned long kPollIntervalUs = 500; // Worker poll period while connected.
+const unsigned long kRetryPollMs = 50;	   // ...and while waiting to reconnect.
+const int kPacketRingCapacity = 256;	   // Per endpoint; about 0.2 s of five controllers.
+const double kRetryMinDelay = 0.25;		   // s
+const double kRetryMaxDelay = 8.0;		   // s
+
+// A new packet of one device, as its endpoint's worker saw it.
+struct EndpointPacket {
+	int id; // The endpoint's own id.
+	bool hmd;
+	double time; // local_clock() when the worker read it.
+	union {
+		PSMController controller;
+		PSMHeadMountedDisplay hmdState;
+	};
+};
+
+// The calls that differ between controllers and HMDs.
+struct ControllerAccess {
+	typedef PSMController State;
+	typedef PSMControllerType Type;
+	static const int kIndex = 0;
+	static bool list(ControllerSource &source, std::vector<int> &ids, std::vector<Type> &types) {
+		return source.getControllerList(ids, types);
+	}
+	static const State *get(ControllerSource &source, int id) { return source.getController(id); }
+	static void start(ControllerSource &source, const std::vector<int> &ids, unsigned int flags) {
+		source.startControllerStreams(ids, flags);
+	}
+	static void stop(ControllerSource &source, const std::vector<int> &ids) {
+		source.stopControllerStreams(ids);
+	}
+	static double packetTime(ControllerSource &source, int id) {
+		return source.controllerPacketTime(id);
+	}
+	static State &packetState(EndpointPacket &packet) { return packet.controller; }
+	static void setId(State &state, int id) { state.ControllerID = id; }
+};
+
+struct HmdAccess {
+	typedef PSMHeadMountedDisplay State;
+	typedef PSMHmdType Type;
+	static const int kIndex = 1;
+	static bool list(ControllerSource &source, std::vector<int> &ids, std::vector<Type> &types) {
+		return source.getHmdList(ids, types);
+	}
+	static const State *get(ControllerSource &source, int id) { return source.getHmd(id); }
+	static void start(ControllerSource &source, const std::vector<int> &ids, unsigned int flags) {
+		source.startHmdStreams(ids, flags);
+	}
+	static void stop(ControllerSource &source, const std::vector<int> &ids) {
+		source.stopHmdStreams(ids);
+	}
+	static double packetTime(ControllerSource &source, int id) { return source.hmdPacketTime(id); }
+	static State &packetState(EndpointPacket &packet) { return packet.hmdState; }
+	static void setId(State &state, int id) { state.HmdID = id; }
+};
+} // namespace
+
+// One endpoint's source and its I/O worker. The source is only ever touched
+// by the worker: control calls hand it jobs through post(), so a source whose
+// objects belong to one thread (such as RemoteSource's process) works too.
+// Starting and stopping streams does not wait for the job, and the trackers
+// come from a copy the worker keeps, so a worker stuck in a reconnect
+// attempt holds up only the synchronous list queries.
+class AggregateSource::Endpoint : public QThread {
+public:
+	Endpoint(int index, const QString &name, ControllerSource *source)
+		: m_index(index), m_name(name), m_source(source), m_packets(kPacketRingCapacity),
+		  m_flags(0), m_connected(false), m_streamsActive(false), m_listChanged(false),
+		  m_stop(false), m_retryDelay(kRetryMinDelay), m_nextRetry(0.0) {}
+	~Endpoint() override { close(); }
+
+	int index() const { return m_index; }
+	bool connected() const { return m_connected.load(std::memory_order_acquire); }
+	bool streamsActive() const { return m_streamsActive.load(std::memory_order_relaxed); }
+	bool takeListChanged() { return m_listChanged.exchange(false); }
+	// Filled by the worker, drained by the thread that runs the AggregateSource.
+	SampleRing<EndpointPacket> &packets() { return m_packets; }
+
+	// Starts the worker and waits for its first connect attempt. If that
+	// failed, the worker keeps retrying.
+	bool open() {
+		m_stop = false;
+		start();
+		m_done.acquire();
+		return connected();
+	}
+
+	// Joins the worker, which disconnects on its way out.
+	void close() {
+		m_stop = true;
+		m_wake.release();
+		wait();
+		m_wake.tryAcquire(m_wake.available());
+		{
+			// Those it did not get to; the streams are forgotten below anyway.
+			QMutexLocker locker(&m_jobLock);
+			m_jobs.clear();
+		}
+		{
+			QMutexLocker locker(&m_listLock);
+			m_trackersOk = false;
+		}
+		// An answer still due is dropped; takeLists() waits for the next request.
+		m_listBuilt = m_listWanted.load(std::memory_order_relaxed);
+		m_listAnswered = 0;
+		m_streamsActive = false;
+		for (Streams &streams : m_streams) {
+			streams.ids.clear();
+			streams.lastSeq.clear();
+		}
+	}
+
+	// The listed ids, their types and a copy of each one's view. False while disconnected.
+	template <class Access>
+	bool list(std::vector<int> &ids, std::vector<typename Access::Type> &types,
+		std::vector<typename Access::State> &states) {
+		bool ok = false;
+		if (connected()) call([&]() { ok = listNow<Access>(ids, types, states); });
+		return ok;
+	}
+
+	// Both lists at once, by Access::kIndex; ok false while disconnected.
+	struct Listing {
+		bool ok[2] = {false, false};
+		std::vector<int> ids[2];
+		std::vector<PSMControllerType> controllerTypes;
+		std::vector<PSMHmdType> hmdTypes;
+		std::vector<PSMController> controllers;
+		std::vector<PSMHeadMountedDisplay> hmds;
+	};
+	// Has the worker make a Listing between two polls, without waiting for it.
+	// Each request supersedes the ones before; their answers are dropped.
+	void requestLists() {
+		m_listWanted.fetch_add(1, std::memory_order_relaxed);
+		wake();
+	}
+	bool listsReady() {
+		QMutexLocker locker(&m_listLock);
+		return m_listAnswered != 0 && m_listAnswered == m_listWanted.load(std::memory_order_relaxed);
+	}
+	// Moves the answer to the last requestLists() into listing. False until it is there.
+	bool takeLists(Listing &listing) {
+		QMutexLocker locker(&m_listLock);
+		if (m_listAnswered == 0 || m_listAnswered != m_listWanted.load(std::memory_order_relaxed))
+			return false;
+		std::swap(listing, m_listing);
+		m_listAnswered = 0;
+		return true;
+	}
+
+	template <class Access> void startStreams(const std::vector<int> &ids, unsigned int flags) {
+		post([this, ids, flags]() {
+			Streams &streams = m_streams[Access::kIndex];
+			for (int id : ids) {
+				if (std::find(streams.ids.begin(), streams.ids.end(), id) != streams.ids.end()) continue;
+				streams.ids.push_back(id);
+				streams.lastSeq.push_back(-1);
+			}
+			m_flags = flags;
+			// Otherwise the worker starts them once the endpoint is back.
+			if (!connected()) return;
+			m_streamsActive = false;
+			Access::start(*m_source, ids, flags);
+		});
+	}
+
+	template <class Access> void stopStreams(const std::vector<int> &ids) {
+		post([this, ids]() {
+			Streams &streams = m_streams[Access::kIndex];
+			for (int id : ids) {
+				auto it = std::find(streams.ids.begin(), streams.ids.end(), id);
+				if (it == streams.ids.end()) continue;
+				streams.lastSeq.erase(streams.lastSeq.begin() + (it - streams.ids.begin()));
+				streams.ids.erase(it);
+			}
+			if (connected()) Access::stop(*m_source, ids);
+		});
+	}
+
+	// As of the worker's last (re)connect. False while disconnected.
+	bool trackers(PSMTrackerList &list) {
+		if (!connected()) return false;
+		QMutexLocker locker(&m_listLock);
+		if (m_trackersOk) list = m_trackers;
+		return m_trackersOk;
+	}
+
+protected:
+	void run() override {
+		if (!m_source->connect()) {
+			qDebug() << "Could not connect to endpoint" << m_name << "; retrying.";
+			m_source->disconnect();
+			m_retryDelay = kRetryMinDelay;
+			m_nextRetry = lsl::local_clock() + m_retryDelay;
+		} else {
+			refreshTrackers();
+			m_connected.store(true, std::memory_order_release);
+		}
+		m_listChanged = true;
+		m_done.release();
+
+		while (!m_stop) {
+			runJobs();
+			unsigned wanted = m_listWanted.load(std::memory_order_relaxed);
+			if (wanted != m_listBuilt) {
+				m_listBuilt = wanted;
+				Listing listing;
+				listing.ok[0] = listNow<ControllerAccess>(
+					listing.ids[0], listing.controllerTypes, listing.controllers);
+				listing.ok[1] = listNow<HmdAccess>(listing.ids[1], listing.hmdTypes, listing.hmds);
+				// Built outside the lock; the owner only ever sees a whole Listing.
+				// If it asked again meanwhile, this one is stale and waits unseen.
+				QMutexLocker locker(&m_listLock);
+				std::swap(m_listing, listing);
+				m_listAnswered = wanted;
+			}
+			if (connected()) {
+				poll();
+				// A source with a backlog is read again right away.
+				if (connected() && !m_source->packetsPending()) usleep(kPollIntervalUs);
+			} else {
+				if (lsl::local_clock() >= m_nextRetry) reconnect();
+				// Woken early by post(), requestLists() and close().
+				m_wake.tryAcquire(1, kRetryPollMs);
+			}
+		}
+		if (connected()) m_source->disconnect();
+		m_connected.store(false, std::memory_order_release);
+	}
+
+private:
+	// The devices streamed on this endpoint and the sequence number last forwarded of each.
+	struct Streams {
+		std::vector<int> ids;
+		std::vector<int> lastSeq;
+	};
+
+	// Queues job for the worker, which runs the queue in order between two
+	// polls, or runs it right away while there is no worker.
+	void post(std::function<void()> job) {
+		if (!isRunning()) {
+			job();
+			return;
+		}
+		{
+			QMutexLocker locker(&m_jobLock);
+			m_jobs.push_back(std::move(job));
+		}
+		wake();
+	}
+
+	// The same, but waits for job.
+	void call(const std::function<void()> &job) {
+		if (!isRunning()) {
+			job();
+			return;
+		}
+		QSemaphore done;
+		post([&]() {
+			job();
+			done.release();
+		});
+		done.acquire();
+	}
+
+	// Only a disconnected worker sleeps on m_wake; a connected one gets to its
+	// jobs within a poll period. One permit is enough to end a sleep.
+	void wake() {
+		if (!connected() && m_wake.available() == 0) m_wake.release();
+	}
+
+	template <class Access>
+	bool listNow(std::vector<int> &ids, std::vector<typename Access::Type> &types,
+		std::vector<typename Access::State> &states) {
+		std::vector<int> listed;
+		std::vector<typename Access::Type> listedTypes;
+		if (!connected() || !Access::list(*m_source, listed, listedTypes)) return false;
+		ids.clear();
+		types.clear();
+		states.clear();
+		for (size_t ix = 0; ix < listed.size(); ix++) {
+			const typename Access::State *state = Access::get(*m_source, listed[ix]);
+			if (!state) continue;
+			ids.push_back(listed[ix]);
+			types.push_back(listedTypes[ix]);
+			states.push_back(*state);
+		}
+		return true;
+	}
+
+	void runJobs() {
+		std::vector<std::function<void()>> jobs;
+		{
+			QMutexLocker locker(&m_jobLock);
+			jobs.swap(m_jobs);
+		}
+		for (auto &job : jobs) job();
+	}
+
+	void refreshTrackers() {
+		PSMTrackerList list;
+		bool ok = m_source->getTrackerList(list);
+		QMutexLocker locker(&m_listLock);
+		m_trackers = list;
+		m_trackersOk = ok;
+	}
+
+	void poll() {
+		m_source->update();
+		m_polledAt = lsl::local_clock();
+		if (!m_source->isConnected()) {
+			qDebug() << "Lost endpoint" << m_name << "; reconnecting.";
+			m_source->disconnect();
+			m_streamsActive = false;
+			m_connected.store(false, std::memory_order_release);
+			m_listChanged = true;
+			m_retryDelay = kRetryMinDelay;
+			m_nextRetry = lsl::local_clock() + m_retryDelay;
+			return;
+		}
+		if (m_source->controllerListChanged()) m_listChanged = true;
+		m_streamsActive = m_source->controllerStreamsActive();
+		forward<ControllerAccess>();
+		forward<HmdAccess>();
+	}
+
+	template <class Access> void forward() {
+		Streams &streams = m_streams[Access::kIndex];
+		for (size_t ix = 0; ix < streams.ids.size(); ix++) {
+			const typename Access::State *state = Access::get(*m_source, streams.ids[ix]);
+			if (!state || state->OutputSequenceNum == streams.lastSeq[ix]) continue;
+			EndpointPacket *packet = m_packets.beginWrite();
+			// Full: the newest packet by then goes out on a later poll.
+			if (!packet) return;
+			double received = Access::packetTime(*m_source, streams.ids[ix]);
+			packet->id = streams.ids[ix];
+			packet->hmd = Access::kIndex == HmdAccess::kIndex;
+			packet->time = received > 0.0 ? received : m_polledAt;
+			Access::packetState(*packet) = *state;
+			m_packets.commitWrite();
+			streams.lastSeq[ix] = state->OutputSequenceNum;
+		}
+	}
+
+	void reconnect() {
+		if (!m_source->connect()) {
+			m_source->disconnect();
+			m_retryDelay = std::min(2.0 * m_retryDelay, kRetryMaxDelay);
+			m_nextRetry = lsl::local_clock() + m_retryDelay;
+			return;
+		}
+		qDebug() << "Reconnected to endpoint" << m_name;
+		refreshTrackers();
+		restart<ControllerAccess>();
+		restart<HmdAccess>();
+		m_connected.store(true, std::memory_order_release);
+		m_listChanged = true;
+	}
+
+	// Starts the streams of the old connection again on the devices still there.
+	template <class Access> void restart() {
+		Streams &streams = m_streams[Access::kIndex];
+		std::fill(streams.lastSeq.begin(), streams.lastSeq.end(), -1);
+		std::vector<int> listed, ids;
+		std::vector<typename Access::Type> types;
+		if (streams.ids.empty() || !Access::list(*m_source, listed, types)) return;
+		for (int id : streams.ids)
+			if (std::find(listed.begin(), listed.end(), id) != listed.end()) ids.push_back(id);
+		if (!ids.empty()) Access::start(*m_source, ids, m_flags);
+	}
+
+	int m_index;
+	QString m_name;
+	std::unique_ptr<ControllerSource> m_source;
+	SampleRing<EndpointPacket> m_packets;
+	Streams m_streams[2]; // By Access::kIndex; worker only while it runs.
+	unsigned int m_flags;
+	std::atomic<bool> m_connected;
+	std::atomic<bool> m_streamsActive;
+	std::atomic<bool> m_listChanged;
+	std::atomic<bool> m_stop;
+	QMutex m_jobLock;
+	std::vector<std::function<void()>> m_jobs; // Posted, not yet run.
+	QSemaphore m_wake;						   // Interrupts the worker's sleep while disconnected.
+	QSemaphore m_done;						   // The first connect attempt.
+	std::atomic<unsigned> m_listWanted{0}; // Generation of the last requestLists().
+	unsigned m_listBuilt = 0;			   // Worker only: the generation it last listed for.
+	QMutex m_listLock;					   // Guards m_listing, m_listAnswered and m_trackers.
+	Listing m_listing;
+	unsigned m_listAnswered = 0; // Generation m_listing answers; 0 once taken.
+	PSMTrackerList m_trackers;	 // As of the last (re)connect, if m_trackersOk.
+	bool m_trackersOk = false;
+	double m_retryDelay;				// Worker only.
+	double m_nextRetry;
+	double m_polledAt = 0.0;
+};
+
+AggregateSource::AggregateSource() {}
+
+AggregateSource::~AggregateSource() { disconnect(); }
+
+void AggregateSource::addEndpoint(const QString &name, ControllerSource *source) {
+	m_endpoints.emplace_back(new Endpoint((int)m_endpoints.size(), name, source));
+}
+
+bool AggregateSource::connect() {
+	bool any = false;
+	for (auto &endpoint : m_endpoints)
+		if (endpoint->open()) any = true;
+	if (!any) disconnect();
+	return any;
+}
+
+void AggregateSource::disconnect() {
+	for (auto &endpoint : m_endpoints) {
+		endpoint->close();
+		SampleRing<EndpointPacket> &packets = endpoint->packets();
+		while (packets.front()) packets.pop();
+	}
+	m_controllers.clear();
+	m_hmds.clear();
+	m_bPacketsPending = false;
+	m_bListsRequested = false;
+}
+
+void AggregateSource::update() {
+	m_bPacketsPending = false;
+	m_drained.clear();
+	for (auto &endpoint : m_endpoints) {
+		SampleRing<EndpointPacket> &packets = endpoint->packets();
+		int base = endpoint->index() * kEndpointIdStride;
+		while (const EndpointPacket *packet = packets.front()) {
+			int id = base + packet->id;
+			// A second packet of a device would overwrite the first before the
+			// caller has seen it; it waits, with those behind it, for the next call.
+			int drained = packet->hmd ? ~id : id;
+			if (std::find(m_drained.begin(), m_drained.end(), drained) != m_drained.end()) {
+				m_bPacketsPending = true;
+				break;
+			}
+			m_drained.push_back(drained);
+			if (packet->hmd) {
+				View<PSMHeadMountedDisplay> &v = view(m_hmds, id);
+				v.state = packet->hmdState;
+				v.time = packet->time;
+				HmdAccess::setId(v.state, id);
+			} else {
+				View<PSMController> &v = view(m_controllers, id);
+				v.state = packet->controller;
+				v.time = packet->time;
+				ControllerAccess::setId(v.state, id);
+			}
+			packets.pop();
+		}
+	}
+}
+
+bool AggregateSource::isConnected() const {
+	for (auto &endpoint : m_endpoints)
+		if (endpoint->connected()) return true;
+	return false;
+}
+
+bool AggregateSource::controllerStreamsActive() const {
+	for (auto &endpoint : m_endpoints)
+		if (endpoint->streamsActive()) return true;
+	return false;
+}
+
+bool AggregateSource::controllerListChanged() {
+	bool changed = false;
+	for (auto &endpoint : m_endpoints)
+		if (endpoint->takeListChanged()) changed = true;
+	return changed;
+}
+
+template <class T> AggregateSource::View<T> &AggregateSource::view(ViewMap<T> &views, int id) {
+	std::unique_ptr<View<T>> &v = views[id];
+	if (!v) v.reset(new View<T>());
+	return *v;
+}
+
+template <class Access>
+bool AggregateSource::listDevices(ViewMap<typename Access::State> &views, std::vector<int> &ids,
+	std::vector<typename Access::Type> &types) {
+	ids.clear();
+	types.clear();
+	bool any = false;
+	std::vector<int> endpointIds;
+	std::vector<typename Access::Type> endpointTypes;
+	std::vector<typename Access::State> states;
+	for (auto &endpoint : m_endpoints) {
+		bool ok = endpoint->template list<Access>(endpointIds, endpointTypes, states);
+		if (mergeListing<Access>(views, endpoint->index(), ok, endpointIds, endpointTypes, states, ids, types))
+			any = true;
+	}
+	return any;
+}
+
+template <class Access>
+bool AggregateSource::mergeListing(ViewMap<typename Access::State> &views, int index, bool ok,
+	const std::vector<int> &endpointIds, const std::vector<typename Access::Type> &endpointTypes,
+	const std::vector<typename Access::State> &states, std::vector<int> &ids,
+	std::vector<typename Access::Type> &types) {
+	typedef typename Access::State State;
+	int base = index * kEndpointIdStride;
+	auto first = views.lower_bound(base), last = views.lower_bound(base + kEndpointIdStride);
+	if (!ok) {
+		// Down: its devices stay, so their outlets remain open until it is back.
+		for (auto it = first; it != last; ++it) {
+			if (!it->second->present) continue;
+			ids.push_back(it->first);
+			types.push_back((typename Access::Type)it->second->type);
+		}
+		return false;
+	}
+	for (auto it = first; it != last; ++it) it->second->present = false;
+	for (size_t ix = 0; ix < endpointIds.size(); ix++) {
+		if (endpointIds[ix] < 0 || endpointIds[ix] >= kEndpointIdStride) {
+			qDebug() << "Ignoring device" << endpointIds[ix] << "of endpoint" << index
+					 << "; ids must be below" << kEndpointIdStride;
+			continue;
+		}
+		int id = base + endpointIds[ix];
+		View<State> &v = view(views, id);
+		// A streamed view follows the packets; the listing may be older.
+		if (!v.streamed) {
+			v.state = states[ix];
+			Access::setId(v.state, id);
+		}
+		v.present = true;
+		v.type = endpointTypes[ix];
+		ids.push_back(id);
+		types.push_back(endpointTypes[ix]);
+	}
+	return true;
+}
+
+template <class Access>
+void AggregateSource::routeStreams(ViewMap<typename Access::State> &views,
+	const std::vector<int> &ids, bool start, unsigned int flags) {
+	std::vector<int> endpointIds;
+	for (auto &endpoint : m_endpoints) {
+		int base = endpoint->index() * kEndpointIdStride;
+		endpointIds.clear();
+		for (int id : ids) {
+			if (id < base || id >= base + kEndpointIdStride) continue;
+			endpointIds.push_back(id - base);
+			view(views, id).streamed = start;
+		}
+		if (endpointIds.empty()) continue;
+		if (start)
+			endpoint->template startStreams<Access>(endpointIds, flags);
+		else
+			endpoint->template stopStreams<Access>(endpointIds);
+	}
+}
+
+bool AggregateSource::getControllerList(
+	std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) {
+	return listDevices<ControllerAccess>(m_controllers, ids, types);
+}
+
+void AggregateSource::requestDeviceLists() {
+	for (auto &endpoint : m_endpoints) endpoint->requestLists();
+	m_bListsRequested = true;
+}
+
+bool AggregateSource::takeDeviceLists(DeviceLists &lists, bool &ok) {
+	if (!m_bListsRequested) return false;
+	for (auto &endpoint : m_endpoints)
+		if (!endpoint->listsReady()) return false;
+	m_bListsRequested = false;
+	lists = DeviceLists();
+	ok = false;
+	Endpoint::Listing listing;
+	for (auto &endpoint : m_endpoints) {
+		endpoint->takeLists(listing);
+		if (mergeListing<ControllerAccess>(m_controllers, endpoint->index(), listing.ok[0], listing.ids[0],
+				listing.controllerTypes, listing.controllers, lists.controllers, lists.controllerTypes))
+			ok = true;
+		mergeListing<HmdAccess>(m_hmds, endpoint->index(), listing.ok[1], listing.ids[1], listing.hmdTypes,
+			listing.hmds, lists.hmds, lists.hmdTypes);
+	}
+	return true;
+}
+
+PSMController *AggregateSource::getController(PSMControllerID id) {
+	auto it = m_controllers.find(id);
+	return it != m_controllers.end() && it->second->present ? &it->second->state : nullptr;
+}
+
+double AggregateSource::controllerPacketTime(PSMControllerID id) {
+	auto it = m_controllers.find(id);
+	return it != m_controllers.end() && it->second->streamed ? it->second->time : 0.0;
+}
+
+void AggregateSource::startControllerStreams(
+	const std::vector<PSMControllerID> &ids, unsigned int flags) {
+	routeStreams<ControllerAccess>(m_controllers, ids, true, flags);
+}
+
+void AggregateSource::stopControllerStreams(const std::vector<PSMControllerID> &ids) {
+	routeStreams<ControllerAccess>(m_controllers, ids, false, 0);
+}
+
+bool AggregateSource::getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) {
+	return listDevices<HmdAccess>(m_hmds, ids, types);
+}
+
+PSMHeadMountedDisplay *AggregateSource::getHmd(PSMHmdID id) {
+	auto it = m_hmds.find(id);
+	return it != m_hmds.end() && it->second->present ? &it->second->state : nullptr;
+}
+
+double AggregateSource::hmdPacketTime(PSMHmdID id) {
+	auto it = m_hmds.find(id);
+	return it != m_hmds.end() && it->second->streamed ? it->second->time : 0.0;
+}
+
+void AggregateSource::startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) {
+	routeStreams<HmdAccess>(m_hmds, ids, true, flags);
+}
+
+void AggregateSource::stopHmdStreams(const std::vector<PSMHmdID> &ids) {
+	routeStreams<HmdAccess>(m_hmds, ids, false, 0);
+}
+
+bool AggregateSource::getTrackerList(PSMTrackerList &list) {
+	std::memset(&list, 0, sizeof(list));
+	bool any = false;
+	PSMTrackerList endpointList;
+	for (auto &endpoint : m_endpoints) {
+		if (!endpoint->trackers(endpointList)) continue;
+		if (!any) list.global_forward_degrees = endpointList.global_forward_degrees;
+		any = true;
+		for (int t = 0; t < endpointList.count && list.count < PSMOVESERVICE_MAX_TRACKER_COUNT; t++) {
+			PSMClientTrackerInfo &tracker = list.trackers[list.count++];
+			tracker = endpointList.trackers[t];
+			tracker.tracker_id += endpoint->index() * kEndpointIdStride;
+		}
+	}
+	return any;
+}
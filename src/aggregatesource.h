@@ -0,0 +1,103 @@
+#ifndef AGGREGATESOURCE_H
+#define AGGREGATESOURCE_H
+
+#include <QString>
+#include <map>
+#include <memory>
+#include <vector>
+#include "controllersource.h"
+
+// Controller and HMD ids of endpoint k are k * kEndpointIdStride plus the id
+// the endpoint itself reports, so endpoint 0 keeps its ids and a device's
+// streams are named the same whichever endpoints run next to it.
+const int kEndpointIdStride = 100;
+
+// ControllerSource over several endpoints, so one bridge publishes the
+// devices of several tracking PCs with one LSL clock. Each endpoint's source
+// runs on its own I/O worker thread, which polls it, forwards every new
+// packet with its receive time through a lock-free ring and reconnects it
+// with backoff when it goes away; update() only drains the rings into this
+// source's views, at most one packet per device per call, so the caller sees
+// every packet and packetsPending() says when to call again. The other
+// calls are queued for the endpoint's worker, which runs them between two
+// polls; only the list queries wait for it, and only on connected endpoints.
+// Only the worker ever touches its source.
+// While an endpoint is down its devices stay listed but silent, so their
+// outlets remain open; isConnected() turns false only when all are down.
+class AggregateSource : public ControllerSource {
+public:
+	AggregateSource();
+	~AggregateSource() override;
+
+	// Adds an endpoint, before connect(); takes ownership of source, which
+	// need not be thread-safe. name appears in log messages.
+	void addEndpoint(const QString &name, ControllerSource *source);
+	size_t endpointCount() const { return m_endpoints.size(); }
+
+	// Connects every endpoint and starts the workers. True if any connected;
+	// the workers keep retrying the others.
+	bool connect() override;
+	void disconnect() override;
+	void update() override;
+	bool isConnected() const override;
+	bool getControllerList(std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) override;
+	PSMController *getController(PSMControllerID id) override;
+	void startControllerStreams(const std::vector<PSMControllerID> &ids, unsigned int flags) override;
+	bool controllerStreamsActive() const override;
+	void stopControllerStreams(const std::vector<PSMControllerID> &ids) override;
+	bool controllerListChanged() override;
+	// Each endpoint's worker lists its devices between two polls.
+	void requestDeviceLists() override;
+	bool takeDeviceLists(DeviceLists &lists, bool &ok) override;
+	bool getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) override;
+	PSMHeadMountedDisplay *getHmd(PSMHmdID id) override;
+	void startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) override;
+	void stopHmdStreams(const std::vector<PSMHmdID> &ids) override;
+	double controllerPacketTime(PSMControllerID id) override;
+	double hmdPacketTime(PSMHmdID id) override;
+	bool packetsPending() const override { return m_bPacketsPending; }
+	// The trackers of all endpoints, each in its own endpoint's frame.
+	bool getTrackerList(PSMTrackerList &list) override;
+
+private:
+	class Endpoint;
+
+	template <class T> struct View {
+		T state{};
+		bool present = false;  // Listed by its endpoint.
+		int type = 0;		   // PSMControllerType or PSMHmdType, as listed.
+		bool streamed = false; // Updated by packets rather than by listing.
+		double time = 0.0;	   // local_clock() when its endpoint received the packet.
+	};
+	template <class T> using ViewMap = std::map<int, std::unique_ptr<View<T>>>;
+
+	template <class T> View<T> &view(ViewMap<T> &views, int id);
+	// Access is ControllerAccess or HmdAccess from the .cpp.
+	// Replaces ids and types with the aggregate ids the endpoints list and
+	// their types. False if none is connected.
+	template <class Access>
+	bool listDevices(ViewMap<typename Access::State> &views, std::vector<int> &ids,
+		std::vector<typename Access::Type> &types);
+	// Takes what endpoint index listed into views and appends the aggregate
+	// ids to ids, their types to types. ok false means the endpoint is down;
+	// returns ok.
+	template <class Access>
+	bool mergeListing(ViewMap<typename Access::State> &views, int index, bool ok,
+		const std::vector<int> &endpointIds, const std::vector<typename Access::Type> &endpointTypes,
+		const std::vector<typename Access::State> &states, std::vector<int> &ids,
+		std::vector<typename Access::Type> &types);
+	// Hands ids to their endpoints to start or stop their streams.
+	template <class Access>
+	void routeStreams(ViewMap<typename Access::State> &views, const std::vector<int> &ids,
+		bool start, unsigned int flags);
+
+	std::vector<std::unique_ptr<Endpoint>> m_endpoints;
+	// By aggregate id; stable until disconnect().
+	ViewMap<PSMController> m_controllers;
+	ViewMap<PSMHeadMountedDisplay> m_hmds;
+	std::vector<int> m_drained;		// Devices update() took a packet of, HMDs as ~id.
+	bool m_bPacketsPending = false; // update() left packets in a ring.
+	bool m_bListsRequested = false; // requestDeviceLists() not yet taken.
+};
+
+#endif // AGGREGATESOURCE_H
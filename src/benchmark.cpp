@@ -0,0 +1,475 @@
+// PSMoveLSLBench: drives the PSMoveThread streaming pipeline with simulated
+// controllers, reads every outlet back through local inlets and reports
+// throughput, CPU time, allocations and capture-to-receive latency for each
+// channel configuration. Output is one JSON object per mode. With --compact
+// the outlets push int16, and a first "quantization" object reports the
+// round-trip error of that encoding per channel on simulated data. With
+// --kinematics, a "kinematics" object reports what the derived-kinematics
+// stage costs per controller-sample.
+
+#include "kinematics.h"
+#include "psmovethread.h"
+#include "quantize.h"
+#include "samplelayout.h"
+#include "simulatedsource.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+// Allocation counting. Benchmark reader threads exclude themselves so the
+// count covers the bridge: the streaming thread and liblsl's outlet threads.
+std::atomic<uint64_t> g_allocations(0);
+thread_local bool t_countAllocations = true;
+
+double processCpuSeconds() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0.0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		   1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+struct Mode {
+	const char *name;
+	bool doIMU, doIMU_raw, doPos, doPos_raw;
+};
+
+const Mode kModes[] = {
+	{"imu", true, false, false, false},
+	{"imu_raw", true, true, false, false},
+	{"pose", false, false, true, false},
+	{"pose_raw", false, false, true, true},
+	{"both", true, false, true, false},
+	{"both_raw", true, true, true, true},
+};
+
+// Pulls one stream until told to stop and records the latency of every sample.
+struct Reader {
+	std::unique_ptr<lsl::stream_inlet> inlet;
+	int channels = 0;
+	bool hasGapChannel = false;
+	std::vector<double> latencies; // Preallocated; samples beyond capacity are only counted.
+	uint64_t samples = 0;
+	uint64_t gaps = 0;
+	double cpuSeconds = 0.0;
+
+	void run(const std::atomic<bool> &measuring, const std::atomic<bool> &stop) {
+		t_countAllocations = false;
+		std::vector<double> sample(channels);
+		bool wasMeasuring = false;
+		double cpuStart = 0.0;
+		while (!stop.load()) {
+			double ts = inlet->pull_sample(sample.data(), channels, 0.1);
+			// Only count this thread's CPU time within the measurement window.
+			bool isMeasuring = measuring.load();
+			if (isMeasuring != wasMeasuring) {
+				if (isMeasuring) cpuStart = threadCpuSeconds();
+				else cpuSeconds += threadCpuSeconds() - cpuStart;
+				wasMeasuring = isMeasuring;
+			}
+			if (ts == 0.0 || !isMeasuring) continue;
+			double latency = lsl::local_clock() - ts;
+			if (latencies.size() < latencies.capacity()) latencies.push_back(latency);
+			samples++;
+			if (hasGapChannel) gaps += (uint64_t)sample[channels - 1];
+		}
+		if (wasMeasuring) cpuSeconds += threadCpuSeconds() - cpuStart;
+	}
+};
+
+bool waitFor(const std::atomic<bool> &flag, double timeout) {
+	double deadline = lsl::local_clock() + timeout;
+	while (!flag.load()) {
+		if (lsl::local_clock() > deadline) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return true;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty()) return 0.0;
+	size_t ix = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+	return sorted[ix];
+}
+
+struct Options {
+	SimulatorSettings sim;
+	double duration = 10.0;
+	double warmup = 1.0;
+	int chunkSize = 1;
+	double chunkMaxLatency = 0.01;
+	WaitMode waitMode = WaitMode::Adaptive;
+	bool compact = false;
+};
+
+bool runMode(const Mode &mode, const Options &opts, FILE *out) {
+	std::atomic<bool> devicesFound(false), outletsUp(false);
+	std::unique_ptr<PSMoveThread> thread(new PSMoveThread);
+	QObject::connect(thread.get(), &PSMoveThread::deviceListUpdated,
+		[&](QStringList) { devicesFound = true; }, Qt::DirectConnection);
+	QObject::connect(thread.get(), &PSMoveThread::outletsStarted,
+		[&](bool result) { outletsUp = result; }, Qt::DirectConnection);
+
+	thread->initPSMS(lsl::IRREGULAR_RATE, opts.waitMode, new SimulatedSource(opts.sim));
+	if (!waitFor(devicesFound, 5.0)) {
+		std::fprintf(stderr, "%s: simulated controllers did not show up\n", mode.name);
+		return false;
+	}
+	// Stamp with capture time so latency is measured from when the packet was seen.
+	thread->startStreams(QStringList(), mode.doIMU, mode.doIMU_raw, mode.doPos, mode.doPos_raw,
+		opts.chunkSize, opts.chunkMaxLatency, false, false, false, opts.compact);
+	if (!waitFor(outletsUp, 5.0)) {
+		std::fprintf(stderr, "%s: outlets were not created\n", mode.name);
+		return false;
+	}
+
+	// Only resolve this run's simulated controllers; their serials contain the seed.
+	char serialPrefix[32];
+	std::snprintf(serialPrefix, sizeof(serialPrefix), "00:06:f7:%02x:%02x",
+		(opts.sim.seed >> 8) & 0xff, opts.sim.seed & 0xff);
+	int perController = (mode.doIMU || mode.doIMU_raw ? 2 : 0) + (mode.doPos || mode.doPos_raw ? 1 : 0);
+	int expected = perController * opts.sim.controllers;
+	std::vector<lsl::stream_info> infos = lsl::resolve_stream(
+		std::string("contains(source_id,'") + serialPrefix + "')", expected, 5.0);
+	if ((int)infos.size() < expected) {
+		std::fprintf(stderr, "%s: resolved %d of %d streams\n", mode.name, (int)infos.size(), expected);
+		return false;
+	}
+
+	size_t capacity = (size_t)(opts.sim.rate * opts.duration * 1.5) + 1024;
+	std::vector<std::unique_ptr<Reader>> readers;
+	for (const lsl::stream_info &info : infos) {
+		std::unique_ptr<Reader> reader(new Reader);
+		reader->inlet.reset(new lsl::stream_inlet(info));
+		reader->inlet->open_stream(5.0);
+		reader->channels = info.channel_count();
+		// Count lost packets once per controller.
+		reader->hasGapChannel = info.name() == "PSMoveIMU" ||
+								(info.name() == "PSMovePosition" && perController == 1);
+		reader->latencies.reserve(capacity);
+		readers.push_back(std::move(reader));
+	}
+	std::atomic<bool> measuring(false), stop(false);
+	std::vector<std::thread> readerThreads;
+	for (auto &reader : readers)
+		readerThreads.emplace_back([&reader, &measuring, &stop] { reader->run(measuring, stop); });
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(opts.warmup));
+	uint64_t allocStart = g_allocations.load();
+	double cpuStart = processCpuSeconds();
+	double wallStart = lsl::local_clock();
+	measuring = true;
+	std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration));
+	measuring = false;
+	double wall = lsl::local_clock() - wallStart;
+	double cpu = processCpuSeconds() - cpuStart;
+	uint64_t allocs = g_allocations.load() - allocStart;
+
+	stop = true;
+	for (auto &t : readerThreads) t.join();
+	thread->startStreams(); // Toggles the outlets off.
+	thread.reset();
+
+	std::vector<double> latencies;
+	uint64_t samples = 0, gaps = 0;
+	double readerCpu = 0.0;
+	for (auto &reader : readers) {
+		latencies.insert(latencies.end(), reader->latencies.begin(), reader->latencies.end());
+		samples += reader->samples;
+		gaps += reader->gaps;
+		readerCpu += reader->cpuSeconds;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	// The readers' own CPU time is not the bridge's.
+	double bridgeCpu = std::max(0.0, cpu - readerCpu);
+
+	std::fprintf(out,
+		"{\"mode\":\"%s\",\"controllers\":%d,\"rate\":%g,\"chunk_size\":%d,\"wait_mode\":\"%s\","
+		"\"format\":\"%s\","
+		"\"duration_s\":%.3f,\"streams\":%d,\"samples\":%llu,\"samples_per_s\":%.1f,"
+		"\"seq_gaps\":%llu,\"cpu_s\":%.4f,\"cpu_fraction\":%.4f,\"cpu_fraction_per_controller\":%.5f,"
+		"\"allocations\":%llu,\"allocations_per_sample\":%.3f,"
+		"\"latency_ms\":{\"p50\":%.4f,\"p99\":%.4f,\"p999\":%.4f,\"max\":%.4f}}\n",
+		mode.name, opts.sim.controllers, opts.sim.rate, opts.chunkSize,
+		opts.waitMode == WaitMode::Spin ? "spin" : "adaptive", opts.compact ? "int16" : "float32",
+		wall, (int)infos.size(),
+		(unsigned long long)samples, samples / wall, (unsigned long long)gaps, bridgeCpu,
+		bridgeCpu / wall, bridgeCpu / wall / opts.sim.controllers, (unsigned long long)allocs,
+		samples ? (double)allocs / samples : 0.0, 1e3 * percentile(latencies, 0.5),
+		1e3 * percentile(latencies, 0.99), 1e3 * percentile(latencies, 0.999),
+		latencies.empty() ? 0.0 : 1e3 * latencies.back());
+	std::fflush(out);
+	return true;
+}
+
+// Encodes and decodes every channel of seconds of simulated packets and
+// reports the largest round-trip error per channel, in channel units. Fails
+// if any value comes back further than half a step off, or NaN does not
+// round-trip as NaN.
+bool measureQuantization(const Options &opts, double seconds, FILE *out) {
+	QStringList imuLabels = imuChannelLabels(true, true);
+	QStringList posLabels = posChannelLabels(true, true);
+	Quantizer imuQuantizer(imuLabels), posQuantizer(posLabels);
+	SampleFiller fillIMU = imuFiller(DeviceKind::PSMove, true, true);
+	SampleFiller fillPos = posFiller(DeviceKind::PSMove, true, true);
+	std::vector<float> imu(imuLabels.size(), 0.0f), pos(posLabels.size(), 0.0f);
+	std::vector<int16_t> imu16(imu.size()), pos16(pos.size());
+	std::vector<float> imuBack(imu.size()), posBack(pos.size());
+	std::vector<double> imuErr(imu.size(), 0.0), posErr(pos.size(), 0.0);
+
+	// The error of x after encoding; wrapped channels are compared modulo their period.
+	auto error = [](const ChannelEncoding &enc, float x, float back) {
+		if (std::isnan(x) || std::isnan(back)) return std::isnan(x) && std::isnan(back) ? 0.0 : INFINITY;
+		double err = std::fabs((double)back - x);
+		if (enc.period > 0.0f) {
+			err = std::fmod(err, (double)enc.period);
+			err = std::min(err, enc.period - err);
+		}
+		return err;
+	};
+	// Half a step, plus the float32 rounding of x and of the decoded value.
+	auto bound = [](const ChannelEncoding &enc, float x) {
+		return 0.5 * enc.scale + 2.0 * std::ldexp(std::fabs((double)x) + std::fabs((double)enc.offset), -23);
+	};
+	uint64_t violations = 0;
+	auto check = [&](const QStringList &labels, const Quantizer &quantizer, const std::vector<float> &in,
+					 const std::vector<float> &back, std::vector<double> &maxErr) {
+		for (size_t ch = 0; ch < in.size(); ch++) {
+			const ChannelEncoding &enc = quantizer.encoding(ch);
+			double err = error(enc, in[ch], back[ch]);
+			maxErr[ch] = std::max(maxErr[ch], err);
+			if (err <= bound(enc, in[ch])) continue;
+			if (violations++ < 10)
+				std::fprintf(stderr, "quantization: %s = %.9g came back as %.9g (step %g)\n",
+					labels[ch].toUtf8().constData(), in[ch], back[ch], enc.scale);
+		}
+	};
+
+	SimulatedSource source(opts.sim);
+	source.connect();
+	std::vector<PSMControllerID> ids;
+	std::vector<PSMControllerType> types;
+	source.getControllerList(ids, types);
+	source.startControllerStreams(ids, 0);
+	std::vector<int> lastSeq(ids.size(), -1);
+	uint64_t samples = 0;
+	double end = lsl::local_clock() + seconds;
+	while (lsl::local_clock() < end) {
+		source.update();
+		for (size_t ix = 0; ix < ids.size(); ix++) {
+			PSMController *ctrl = source.getController(ids[ix]);
+			if (ctrl->OutputSequenceNum == lastSeq[ix]) continue;
+			lastSeq[ix] = ctrl->OutputSequenceNum;
+			DeviceState state;
+			state.psmove = ctrl->ControllerState.PSMoveState;
+			fillIMU(state, imu.data());
+			fillPos(state, pos.data());
+			imuQuantizer.encode(imu.data(), imu16.data(), 1);
+			imuQuantizer.decode(imu16.data(), imuBack.data(), 1);
+			posQuantizer.encode(pos.data(), pos16.data(), 1);
+			posQuantizer.decode(pos16.data(), posBack.data(), 1);
+			check(imuLabels, imuQuantizer, imu, imuBack, imuErr);
+			check(posLabels, posQuantizer, pos, posBack, posErr);
+			samples++;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	source.disconnect();
+	if (samples == 0) {
+		std::fprintf(stderr, "quantization: no simulated packets\n");
+		return false;
+	}
+
+	std::fprintf(out, "{\"mode\":\"quantization\",\"samples\":%llu,\"max_error\":{",
+		(unsigned long long)samples);
+	const char *sep = "";
+	for (size_t ch = 0; ch < imu.size(); ch++, sep = ",")
+		std::fprintf(out, "%s\"%s\":%.3g", sep, imuLabels[ch].toUtf8().constData(), imuErr[ch]);
+	for (size_t ch = 0; ch < pos.size(); ch++)
+		std::fprintf(out, ",\"%s\":%.3g", posLabels[ch].toUtf8().constData(), posErr[ch]);
+	std::fprintf(out, "},\"violations\":%llu,\"bytes_per_sample\":{\"float32\":%d,\"int16\":%d}}\n",
+		(unsigned long long)violations, (int)(imu.size() + pos.size()) * 4,
+		(int)(imu.size() + pos.size()) * 2);
+	std::fflush(out);
+	if (violations) {
+		std::fprintf(stderr, "quantization: %llu values beyond half a step\n", (unsigned long long)violations);
+		return false;
+	}
+	return true;
+}
+
+// Records seconds of simulated packets, then times the derived-kinematics
+// stage alone on them: each pass queues one packet of every controller, as a
+// publisher does, computes the batch and reads every lane out.
+bool measureKinematics(const Options &opts, double seconds, FILE *out) {
+	SimulatedSource source(opts.sim);
+	source.connect();
+	std::vector<PSMControllerID> ids;
+	std::vector<PSMControllerType> types;
+	source.getControllerList(ids, types);
+	source.startControllerStreams(ids, 0);
+	KinematicsReader read = kinematicsReader(DeviceKind::PSMove);
+	std::vector<std::vector<KinematicsInput>> inputs(ids.size());
+	std::vector<std::vector<double>> times(ids.size());
+	std::vector<int> lastSeq(ids.size(), -1);
+	double end = lsl::local_clock() + seconds;
+	while (lsl::local_clock() < end) {
+		source.update();
+		double now = lsl::local_clock();
+		for (size_t ix = 0; ix < ids.size(); ix++) {
+			PSMController *ctrl = source.getController(ids[ix]);
+			if (ctrl->OutputSequenceNum == lastSeq[ix]) continue;
+			lastSeq[ix] = ctrl->OutputSequenceNum;
+			DeviceState state;
+			state.psmove = ctrl->ControllerState.PSMoveState;
+			KinematicsInput in;
+			read(state, in);
+			inputs[ix].push_back(in);
+			times[ix].push_back(now);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	source.disconnect();
+	size_t packets = std::numeric_limits<size_t>::max();
+	for (const auto &v : inputs) packets = std::min(packets, v.size());
+	if (ids.empty() || packets < 3) {
+		std::fprintf(stderr, "kinematics: no simulated packets\n");
+		return false;
+	}
+
+	// Enough passes to time at least a million samples.
+	const size_t reps = 1000000 / (packets * ids.size()) + 1;
+	const double span = times[0][packets - 1] - times[0][0] + 1.0 / opts.sim.rate;
+	std::vector<KinematicsHistory> histories(ids.size());
+	KinematicsBatch batch;
+	float sample[kKinematicsChannels];
+	double sink = 0.0;
+	uint64_t samples = 0;
+	auto drain = [&] {
+		batch.compute();
+		for (size_t lane = 0; lane < batch.size(); lane++) {
+			batch.read(lane, sample);
+			sink += sample[0];
+		}
+		samples += batch.size();
+		batch.clear();
+	};
+	double cpuStart = threadCpuSeconds();
+	auto wallStart = std::chrono::steady_clock::now();
+	for (size_t rep = 0; rep < reps; rep++) {
+		for (size_t p = 0; p < packets; p++) {
+			for (size_t ix = 0; ix < ids.size(); ix++) {
+				if (batch.full()) drain();
+				batch.add(histories[ix], times[ix][p] + rep * span, inputs[ix][p]);
+			}
+			drain();
+		}
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	double cpu = threadCpuSeconds() - cpuStart;
+
+	std::fprintf(out,
+		"{\"mode\":\"kinematics\",\"controllers\":%d,\"samples\":%llu,\"ns_per_sample\":%.1f,"
+		"\"cpu_ns_per_sample\":%.1f,\"checksum\":%g}\n",
+		(int)ids.size(), (unsigned long long)samples, 1e9 * wall / samples, 1e9 * cpu / samples, sink);
+	std::fflush(out);
+	return true;
+}
+
+} // namespace
+
+void *operator new(std::size_t size) {
+	if (t_countAllocations) g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Throughput and latency benchmark for the PSMoveLSL streaming pipeline.");
+	parser.addHelpOption();
+	QCommandLineOption controllersOption("controllers", "Number of simulated controllers.", "n", "2");
+	QCommandLineOption rateOption("rate", "Packets per second per controller.", "hz", "120");
+	QCommandLineOption durationOption("duration", "Measured seconds per mode.", "s", "10");
+	QCommandLineOption chunkOption("chunk", "Samples per push.", "n", "1");
+	QCommandLineOption chunkLatencyOption("chunk-latency", "Max. chunk latency in ms.", "ms", "10");
+	QCommandLineOption waitOption("wait", "Poll wait mode: adaptive or spin.", "mode", "adaptive");
+	QCommandLineOption dropOption("drop-rate", "Simulated packet loss probability.", "p", "0");
+	QCommandLineOption modeOption("mode", "Only run this mode (imu, imu_raw, pose, pose_raw, both, both_raw).", "mode");
+	QCommandLineOption compactOption("compact", "Push int16 samples and report the quantization error.");
+	QCommandLineOption kinematicsOption("kinematics", "Also report the derived-kinematics cost per sample.");
+	QCommandLineOption outputOption("output", "Append results to this file instead of stdout.", "file");
+	parser.addOption(controllersOption);
+	parser.addOption(rateOption);
+	parser.addOption(durationOption);
+	parser.addOption(chunkOption);
+	parser.addOption(chunkLatencyOption);
+	parser.addOption(waitOption);
+	parser.addOption(dropOption);
+	parser.addOption(modeOption);
+	parser.addOption(compactOption);
+	parser.addOption(kinematicsOption);
+	parser.addOption(outputOption);
+	parser.process(app);
+
+	Options opts;
+	opts.sim.controllers = parser.value(controllersOption).toInt();
+	opts.sim.rate = parser.value(rateOption).toDouble();
+	opts.sim.dropRate = parser.value(dropOption).toDouble();
+	opts.sim.seed = (unsigned int)QCoreApplication::applicationPid() & 0xffff;
+	opts.duration = parser.value(durationOption).toDouble();
+	opts.chunkSize = parser.value(chunkOption).toInt();
+	opts.chunkMaxLatency = parser.value(chunkLatencyOption).toDouble() / 1000.0;
+	opts.waitMode = parser.value(waitOption) == "spin" ? WaitMode::Spin : WaitMode::Adaptive;
+	opts.compact = parser.isSet(compactOption);
+
+	FILE *out = stdout;
+	if (parser.isSet(outputOption)) {
+		out = std::fopen(parser.value(outputOption).toLocal8Bit().constData(), "a");
+		if (!out) {
+			std::fprintf(stderr, "Cannot open %s\n", parser.value(outputOption).toLocal8Bit().constData());
+			return 1;
+		}
+	}
+
+	bool ok = true;
+	if (opts.compact) ok = measureQuantization(opts, 2.0, out);
+	if (parser.isSet(kinematicsOption)) ok = measureKinematics(opts, 2.0, out) && ok;
+	for (const Mode &mode : kModes) {
+		if (parser.isSet(modeOption) && parser.value(modeOption) != mode.name) continue;
+		ok = runMode(mode, opts, out) && ok;
+	}
+	if (out != stdout) std::fclose(out);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include "clockmapper.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+const double kForget = 0.9995;		   // Per-observation forgetting factor (~2000 obs. memory).
+const double kResidAlpha = 0.01;	   // EWMA weight for the residual variance and the latency.
+const unsigned kMinObservations = 32;  // Observations before the fit is trusted.
+const unsigned kEnvelopeBlock = 256;   // Observations per envelope block (~2 s at 120 Hz).
+const double kMinOutlier = 0.002;	   // Never reject residuals below 2 ms.
+const double kOutlierSigmas = 4.0;
+const unsigned kMaxRejectedInRow = 64; // More than this in a row is a clock step.
+const double kMaxDrift = 1e-3;		   // Clamp |slope - 1|.
+const double kMaxBackwards = 1.0;	   // Device time moving back further is a reset.
+} // namespace
+
+ClockMapper::ClockMapper() : m_rejectedTotal(0) { reset(); }
+
+void ClockMapper::reset() {
+	m_init = false;
+	m_x0 = m_y0 = m_lastX = 0.0;
+	m_w = m_sx = m_sy = m_sxx = m_sxy = 0.0;
+	m_slope = 1.0;
+	m_blockMin = m_prevBlockMin = m_envelope = std::numeric_limits<double>::infinity();
+	m_blockCount = 0;
+	m_residVar = 0.0;
+	m_latency = 0.0;
+	m_accepted = 0;
+	m_rejectedInRow = 0;
+}
+
+void ClockMapper::restart(double deviceTime, double localTime) {
+	double latency = m_latency;
+	reset();
+	m_latency = latency;
+	m_init = true;
+	m_x0 = deviceTime;
+	m_y0 = localTime;
+}
+
+bool ClockMapper::converged() const { return m_accepted >= kMinObservations; }
+
+double ClockMapper::output(double fitted, double localTime) const {
+	double start = localTime - m_latency;
+	double weight = std::min(1.0, (double)m_accepted / kMinObservations);
+	return start + weight * (fitted - start);
+}
+
+double ClockMapper::map(double deviceTime, double localTime) {
+	if (!m_init || deviceTime - m_x0 < m_lastX - kMaxBackwards || m_rejectedInRow > kMaxRejectedInRow)
+		restart(deviceTime, localTime);
+
+	// Work relative to the origin so the sums keep their precision.
+	double x = deviceTime - m_x0;
+	double y = localTime - m_y0;
+	m_lastX = x;
+
+	// Late packets lie above the envelope by their extra latency; only those
+	// far above it, or anything far below it, are outliers.
+	double resid = y - (m_envelope + m_slope * x);
+	if (converged()) {
+		double limit = std::max(kMinOutlier, kOutlierSigmas * std::sqrt(m_residVar));
+		if (std::fabs(resid) > limit) {
+			m_rejectedInRow++;
+			m_rejectedTotal++;
+			// A late packet still has a good device time; one from before the
+			// envelope means the device clock jumped ahead.
+			if (resid < 0.0) return localTime - m_latency;
+			return output(m_y0 + m_envelope + m_slope * x, localTime);
+		}
+	}
+	m_rejectedInRow = 0;
+
+	// The drift comes from the least-squares slope, which the mean latency does not bias.
+	m_w = kForget * m_w + 1.0;
+	m_sx = kForget * m_sx + x;
+	m_sy = kForget * m_sy + y;
+	m_sxx = kForget * m_sxx + x * x;
+	m_sxy = kForget * m_sxy + x * y;
+	m_accepted++;
+
+	double denom = m_w * m_sxx - m_sx * m_sx;
+	if (denom > 1e-12 * m_w * m_w) {
+		m_slope = (m_w * m_sxy - m_sx * m_sy) / denom;
+		m_slope = std::min(std::max(m_slope, 1.0 - kMaxDrift), 1.0 + kMaxDrift);
+	}
+
+	// The offset from the fastest packets of the last one to two blocks.
+	m_blockMin = std::min(m_blockMin, y - m_slope * x);
+	if (++m_blockCount == kEnvelopeBlock) {
+		m_prevBlockMin = m_blockMin;
+		m_blockMin = std::numeric_limits<double>::infinity();
+		m_blockCount = 0;
+	}
+	m_envelope = std::min(m_prevBlockMin, m_blockMin);
+
+	double fitted = m_y0 + m_envelope + m_slope * x;
+	double above = localTime - fitted;
+	m_residVar += kResidAlpha * (above * above - m_residVar);
+	if (converged()) m_latency += kResidAlpha * (above - m_latency);
+	return output(fitted, localTime);
+}
@@ -0,0 +1,51 @@
+#ifndef CLOCKMAPPER_H
+#define CLOCKMAPPER_H
+
+// Maps a device clock (e.g. the controller's TimeInSeconds) onto the LSL clock.
+// Each observation pairs a device time with the local_clock() at which the
+// packet was seen. An exponentially weighted least-squares line through these
+// pairs tracks the drift; the offset follows the lower envelope of the
+// observations, i.e. the packets that arrived fastest, so the transport
+// latency is not folded into the timestamps. The mapped timestamps keep the
+// device's sample spacing instead of the network and scheduler jitter of the
+// capture times. Observations far above or below the envelope are rejected; a
+// device clock reset or a persistent step restarts the fit. After a (re)start
+// the output blends from the capture time, less the latency measured so far,
+// into the fitted line, so it never jumps.
+class ClockMapper {
+public:
+	ClockMapper();
+
+	void reset();
+	// Adds an observation and returns the LSL time of deviceTime.
+	double map(double deviceTime, double localTime);
+
+	bool converged() const;
+	double slope() const { return m_slope; }
+	// Mean of localTime less the mapped time: the transport latency, >= 0.
+	double latency() const { return m_latency; }
+	unsigned rejected() const { return m_rejectedTotal; }
+
+private:
+	void restart(double deviceTime, double localTime);
+	// Blends from localTime - m_latency into fitted while the fit converges.
+	double output(double fitted, double localTime) const;
+
+	bool m_init;
+	double m_x0, m_y0;	 // Origin of the current fit.
+	double m_lastX;		 // Last device time, relative to m_x0.
+	// Exponentially weighted sums of accepted observations.
+	double m_w, m_sx, m_sy, m_sxx, m_sxy;
+	double m_slope;
+	// Lower envelope of y - slope * x: the minimum of the current and the
+	// previous block of accepted observations.
+	double m_blockMin, m_prevBlockMin, m_envelope;
+	unsigned m_blockCount;
+	double m_residVar;	 // Running mean square of accepted residuals above the envelope.
+	double m_latency;	 // Kept across restarts.
+	unsigned m_accepted;
+	unsigned m_rejectedInRow;
+	unsigned m_rejectedTotal;
+};
+
+#endif // CLOCKMAPPER_H
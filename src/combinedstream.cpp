@@ -0,0 +1,265 @@
+#include "combinedstream.h"
+#include "samplelayout.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Seconds a row waits for controllers that have not filled it yet.
+const double kAlignMaxWait = 0.1;
+
+namespace {
+
+// Per-slot channel labels followed by Valid, each prefixed with the controller id.
+QStringList combinedLabels(const std::vector<PSMControllerID> &ids, const QStringList &chanLabels) {
+	QStringList labels;
+	for (PSMControllerID id : ids) {
+		QString devStr = QString::number(id);
+		devStr += "_";
+		for (const QString &label : chanLabels) labels << devStr + label;
+		labels << devStr + "Valid";
+	}
+	return labels;
+}
+
+lsl::stream_info combinedInfo(const char *name, const char *type, const char *unit, int width,
+	double rate, const std::vector<PSMControllerID> &ids, const QStringList &names,
+	const QStringList &chanLabels, const Quantizer *quantizer) {
+	lsl::stream_info info(name, "MoCap", width, rate, quantizer ? lsl::cf_int16 : lsl::cf_float32,
+		(QString(name) + "Combined:" + names.join(",")).toStdString());
+	info.desc()
+		.append_child("acquisition")
+		.append_child_value("manufacturer", "Sony")
+		.append_child_value("model", "PlayStation Move");
+	lsl::xml_element controllers = info.desc().append_child("controllers");
+	for (int slot = 0; slot < names.size(); slot++)
+		controllers.append_child("controller")
+			.append_child_value("id", QString::number(ids[slot]).toStdString())
+			.append_child_value("name", names[slot].toStdString());
+	lsl::xml_element channels = info.desc().append_child("channels");
+	QStringList labels = combinedLabels(ids, chanLabels);
+	for (int ch = 0; ch < labels.size(); ch++) {
+		bool valid = ch % (chanLabels.size() + 1) == chanLabels.size();
+		lsl::xml_element channel = channels.append_child("channel")
+			.append_child_value("label", labels[ch].toStdString())
+			.append_child_value("type", valid ? "Valid" : type)
+			.append_child_value("unit", valid ? "bool" : unit);
+		if (quantizer) Quantizer::describe(channel, quantizer->encoding(ch));
+	}
+	return info;
+}
+
+} // namespace
+
+CombinedStream::CombinedStream(const std::vector<PSMControllerID> &ids, const QStringList &names,
+	const QStringList &imuChanLabels, const QStringList &posChanLabels, double rate,
+	size_t chunkSize, bool compact)
+	: m_imuChannels(imuChanLabels.size()), m_posChannels(posChanLabels.size()), m_rate(rate),
+	  m_filledRows(0), m_started(false), m_nextTick(0), m_attached(0), m_compact(compact),
+	  m_chunkCapacity(std::max(chunkSize, (size_t)1)), m_pending(0), m_firstPendingTime(0.0),
+	  m_log(nullptr), m_imuLog(-1), m_posLog(-1) {
+	for (PSMControllerID id : ids) {
+		m_slots.emplace_back();
+		m_slots.back().id = id;
+	}
+	size_t slotCount = m_slots.size();
+	// The imu and pos channel counts include SeqGap; an absent stream has no data channels.
+	bool doIMU = m_imuChannels > kGapChannels;
+	bool doPos = m_posChannels > kGapChannels;
+	m_imuWidth = doIMU ? (int)slotCount * (m_imuChannels + 1) : 0;
+	m_posWidth = doPos ? (int)slotCount * (m_posChannels + 1) : 0;
+	if (compact) {
+		m_imuQuantizer = Quantizer(combinedLabels(ids, imuChanLabels));
+		m_posQuantizer = Quantizer(combinedLabels(ids, posChanLabels));
+	}
+	if (doIMU)
+		m_imuOutlet.reset(new lsl::stream_outlet(combinedInfo("PSMoveIMU", "IMU", "various",
+			m_imuWidth, rate, ids, names, imuChanLabels, compact ? &m_imuQuantizer : nullptr)));
+	if (doPos)
+		m_posOutlet.reset(new lsl::stream_outlet(combinedInfo("PSMovePosition", "Position", "cm",
+			m_posWidth, rate, ids, names, posChanLabels, compact ? &m_posQuantizer : nullptr)));
+
+	m_rowCount = (size_t)std::ceil(rate * (kAlignMaxWait + 0.25)) + 2;
+	m_imuRows.assign(m_rowCount * m_imuWidth, 0.0f);
+	m_posRows.assign(m_rowCount * m_posWidth, 0.0f);
+	m_rowValid.assign(m_rowCount * slotCount, 0);
+	m_rowCapture.assign(m_rowCount * slotCount, 0.0);
+	m_rowFilled.assign(m_rowCount, 0);
+	m_imuChunk.assign(m_chunkCapacity * m_imuWidth, 0.0f);
+	m_posChunk.assign(m_chunkCapacity * m_posWidth, 0.0f);
+	m_stamps.assign(m_chunkCapacity, 0.0);
+	if (compact) {
+		m_imuChunk16.assign(m_imuChunk.size(), 0);
+		m_posChunk16.assign(m_posChunk.size(), 0);
+	}
+}
+
+int CombinedStream::slot(PSMControllerID id) const {
+	for (size_t slot = 0; slot < m_slots.size(); slot++)
+		if (m_slots[slot].id == id) return (int)slot;
+	return -1;
+}
+
+void CombinedStream::attach(int slot, std::shared_ptr<DeviceCounters> counters) {
+	Slot &s = m_slots[slot];
+	if (!s.attached) m_attached++;
+	s.attached = true;
+	s.counters = counters;
+}
+
+void CombinedStream::detach(int slot) {
+	Slot &s = m_slots[slot];
+	if (s.attached) m_attached--;
+	s.attached = false;
+}
+
+void CombinedStream::write(
+	int slot, double timestamp, const float *imu, const float *pos, int skipped, double captureTime) {
+	int64_t tick = std::llround(timestamp * m_rate);
+	if (!m_started) {
+		m_started = true;
+		m_nextTick = tick;
+	}
+	// Too late: the row was pushed without this controller.
+	if (tick < m_nextTick) return;
+	while (tick >= m_nextTick + (int64_t)m_rowCount) emitRow();
+
+	size_t row = rowIndex(tick);
+	size_t slotCount = m_slots.size();
+	uint8_t &valid = m_rowValid[row * slotCount + slot];
+	if (valid) return;
+	if (m_imuWidth) {
+		float *s = m_imuRows.data() + row * m_imuWidth + slot * (m_imuChannels + 1);
+		std::copy(imu, imu + m_imuChannels, s);
+		s[m_imuChannels - kGapChannels] = (float)skipped;
+		s[m_imuChannels] = 1.0f;
+	}
+	if (m_posWidth) {
+		float *s = m_posRows.data() + row * m_posWidth + slot * (m_posChannels + 1);
+		std::copy(pos, pos + m_posChannels, s);
+		s[m_posChannels - kGapChannels] = (float)skipped;
+		s[m_posChannels] = 1.0f;
+	}
+	valid = 1;
+	m_rowCapture[row * slotCount + slot] = captureTime;
+	if (m_rowFilled[row]++ == 0) m_filledRows++;
+
+	// Push the rows every controller has filled, in order.
+	while (m_filledRows > 0 && m_rowFilled[rowIndex(m_nextTick)] >= m_attached) emitRow();
+}
+
+double CombinedStream::poll(double now, double chunkMaxLatency) {
+	if (m_started && m_filledRows == 0) {
+		// Nothing buffered; skip the empty rows in one go.
+		m_nextTick = std::max(m_nextTick, (int64_t)std::ceil((now - kAlignMaxWait) * m_rate));
+	}
+	while (m_filledRows > 0 && m_nextTick / m_rate + kAlignMaxWait <= now) emitRow();
+	if (m_pending > 0 && now - m_firstPendingTime >= chunkMaxLatency) pushChunk();
+
+	double next = std::numeric_limits<double>::infinity();
+	if (m_filledRows > 0) next = m_nextTick / m_rate + kAlignMaxWait;
+	if (m_pending > 0) next = std::min(next, m_firstPendingTime + chunkMaxLatency);
+	return next;
+}
+
+void CombinedStream::flush() {
+	while (m_filledRows > 0) emitRow();
+	if (m_pending > 0) pushChunk();
+}
+
+void CombinedStream::emitRow() {
+	size_t row = rowIndex(m_nextTick);
+	size_t slotCount = m_slots.size();
+	int64_t tick = m_nextTick++;
+	if (m_rowFilled[row] == 0) return;
+
+	double now = lsl::local_clock();
+	if (m_pending == 0) m_firstPendingTime = now;
+	float *imuOut = m_imuChunk.data() + m_pending * m_imuWidth;
+	float *posOut = m_posChunk.data() + m_pending * m_posWidth;
+	std::copy(m_imuRows.begin() + row * m_imuWidth, m_imuRows.begin() + (row + 1) * m_imuWidth, imuOut);
+	std::copy(m_posRows.begin() + row * m_posWidth, m_posRows.begin() + (row + 1) * m_posWidth, posOut);
+	for (size_t slot = 0; slot < slotCount; slot++) {
+		uint8_t &valid = m_rowValid[row * slotCount + slot];
+		if (valid) {
+			Slot &s = m_slots[slot];
+			if (s.pending++ == 0) {
+				s.firstPendingTime = m_rowCapture[row * slotCount + slot];
+				s.pendingCaptureSum = 0.0;
+			}
+			s.pendingCaptureSum += m_rowCapture[row * slotCount + slot];
+			valid = 0;
+			continue;
+		}
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		if (m_imuWidth) {
+			float *s = imuOut + slot * (m_imuChannels + 1);
+			std::fill(s, s + m_imuChannels, nan);
+			s[m_imuChannels] = 0.0f;
+		}
+		if (m_posWidth) {
+			float *s = posOut + slot * (m_posChannels + 1);
+			std::fill(s, s + m_posChannels, nan);
+			s[m_posChannels] = 0.0f;
+		}
+	}
+	m_rowFilled[row] = 0;
+	m_filledRows--;
+	m_stamps[m_pending++] = tick / m_rate;
+	if (m_pending >= m_chunkCapacity) pushChunk();
+}
+
+void CombinedStream::setLog(SessionLog *log) {
+	m_log = log;
+	if (m_imuOutlet) m_imuLog = log->addStream(m_imuOutlet->info());
+	if (m_posOutlet) m_posLog = log->addStream(m_posOutlet->info());
+}
+
+void CombinedStream::pushChunk() {
+	double pushStart = lsl::local_clock();
+	if (m_compact) {
+		if (m_imuOutlet) {
+			m_imuQuantizer.encode(m_imuChunk.data(), m_imuChunk16.data(), m_pending);
+			m_imuOutlet->push_chunk_multiplexed(
+				m_imuChunk16.data(), m_pending * m_imuWidth, m_stamps.data());
+		}
+		if (m_posOutlet) {
+			m_posQuantizer.encode(m_posChunk.data(), m_posChunk16.data(), m_pending);
+			m_posOutlet->push_chunk_multiplexed(
+				m_posChunk16.data(), m_pending * m_posWidth, m_stamps.data());
+		}
+	} else if (m_pending == 1) {
+		if (m_imuOutlet) m_imuOutlet->push_sample(m_imuChunk.data(), m_stamps[0]);
+		if (m_posOutlet) m_posOutlet->push_sample(m_posChunk.data(), m_stamps[0]);
+	} else {
+		if (m_imuOutlet)
+			m_imuOutlet->push_chunk_multiplexed(
+				m_imuChunk.data(), m_pending * m_imuWidth, m_stamps.data());
+		if (m_posOutlet)
+			m_posOutlet->push_chunk_multiplexed(
+				m_posChunk.data(), m_pending * m_posWidth, m_stamps.data());
+	}
+	double pushEnd = lsl::local_clock();
+	if (m_log) {
+		const void *imu = m_compact ? (const void *)m_imuChunk16.data() : m_imuChunk.data();
+		const void *pos = m_compact ? (const void *)m_posChunk16.data() : m_posChunk.data();
+		m_log->write(m_imuLog, m_stamps.data(), imu, m_pending);
+		m_log->write(m_posLog, m_stamps.data(), pos, m_pending);
+	}
+
+	for (Slot &s : m_slots) {
+		if (s.pending == 0 || !s.counters) {
+			s.pending = 0;
+			continue;
+		}
+		DeviceCounters &c = *s.counters;
+		addCounter(c.packetsPushed, (uint64_t)s.pending);
+		addCounter(c.pushes, (uint64_t)1);
+		addCounter(c.latencySum, s.pending * pushEnd - s.pendingCaptureSum);
+		raiseMax(c.latencyMax, pushEnd - s.firstPendingTime);
+		c.pushLatency.record(pushEnd - s.firstPendingTime);
+		addCounter(c.pushTimeSum, pushEnd - pushStart);
+		raiseMax(c.pushTimeMax, pushEnd - pushStart);
+		s.pending = 0;
+	}
+	m_pending = 0;
+}
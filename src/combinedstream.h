@@ -0,0 +1,98 @@
+#ifndef COMBINEDSTREAM_H
+#define COMBINEDSTREAM_H
+
+#include <QStringList>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "lsl_cpp.h"
+#include "PSMoveClient_CAPI.h"
+#include "quantize.h"
+#include "sessionlog.h"
+#include "telemetry.h"
+
+// One wide PSMoveIMU and one wide PSMovePosition outlet for all controllers.
+// Each controller gets a fixed slot: its usual channels followed by a Valid
+// channel. The controllers' resampled samples are aligned on the common grid
+// of multiples of 1/rate; a row is pushed once every attached controller has
+// filled it, or once it is kAlignMaxWait old, with the missing slots NaN and
+// Valid 0. Used by a single publisher thread; nothing is allocated after
+// construction.
+class CombinedStream {
+public:
+	CombinedStream(const std::vector<PSMControllerID> &ids, const QStringList &names,
+		const QStringList &imuChanLabels, const QStringList &posChanLabels, double rate,
+		size_t chunkSize, bool compact = false);
+
+	// Slot of a controller, or -1 if it was not part of the stream at creation.
+	int slot(PSMControllerID id) const;
+	// A slot's controller is (no longer) being published; rows wait only for attached slots.
+	void attach(int slot, std::shared_ptr<DeviceCounters> counters);
+	void detach(int slot);
+
+	// Adds one resampled sample. imu and pos hold the slot's channels (SeqGap
+	// included, overwritten with skipped) and are ignored if that stream is off.
+	void write(int slot, double timestamp, const float *imu, const float *pos, int skipped,
+		double captureTime);
+	// Pushes the rows and chunks that are due. Returns when the next one is.
+	double poll(double now, double chunkMaxLatency);
+	// Pushes everything that is pending.
+	void flush();
+	// Also writes every pushed chunk to log. Call before publishing starts.
+	void setLog(SessionLog *log);
+
+private:
+	struct Slot {
+		PSMControllerID id;
+		bool attached = false;
+		std::shared_ptr<DeviceCounters> counters;
+		// Pushed rows this slot contributed to, for the latency counters.
+		size_t pending = 0;
+		double firstPendingTime = 0.0;
+		double pendingCaptureSum = 0.0;
+	};
+
+	size_t rowIndex(int64_t tick) const { return (size_t)(tick % (int64_t)m_rowCount); }
+	void emitRow();	   // Moves the row at m_nextTick into the chunk and advances.
+	void pushChunk();
+
+	std::vector<Slot> m_slots;
+	int m_imuChannels; // Per slot, without Valid.
+	int m_posChannels;
+	int m_imuWidth;	   // Channels of the wide streams.
+	int m_posWidth;
+	double m_rate;
+	std::unique_ptr<lsl::stream_outlet> m_imuOutlet;
+	std::unique_ptr<lsl::stream_outlet> m_posOutlet;
+
+	// Rows not yet pushed, a ring indexed by tick.
+	size_t m_rowCount;
+	std::vector<float> m_imuRows;
+	std::vector<float> m_posRows;
+	std::vector<uint8_t> m_rowValid;	 // Per row and slot.
+	std::vector<double> m_rowCapture;	 // Per row and slot.
+	std::vector<int> m_rowFilled;		 // Valid slots per row.
+	size_t m_filledRows;				 // Rows with any valid slot.
+	bool m_started;
+	int64_t m_nextTick;					 // Oldest row not yet pushed.
+	int m_attached;
+
+	// Rows waiting for the next push.
+	std::vector<float> m_imuChunk;
+	std::vector<float> m_posChunk;
+	std::vector<double> m_stamps;
+	// Compact mode: int16 outlets, encoded at push time.
+	bool m_compact;
+	Quantizer m_imuQuantizer;
+	Quantizer m_posQuantizer;
+	std::vector<int16_t> m_imuChunk16;
+	std::vector<int16_t> m_posChunk16;
+	size_t m_chunkCapacity;
+	size_t m_pending;
+	double m_firstPendingTime;
+	SessionLog *m_log;
+	int m_imuLog;
+	int m_posLog;
+};
+
+#endif // COMBINEDSTREAM_H
@@ -0,0 +1,86 @@
+#ifndef CONTROLLERSOURCE_H
+#define CONTROLLERSOURCE_H
+
+#include <vector>
+#include "PSMoveClient_CAPI.h"
+
+// Both device lists, each id with the type it is listed as. The type comes
+// from the list itself: a device's view only tells it once its stream has
+// delivered a frame.
+struct DeviceLists {
+	std::vector<PSMControllerID> controllers;
+	std::vector<PSMControllerType> controllerTypes;
+	std::vector<PSMHmdID> hmds;
+	std::vector<PSMHmdType> hmdTypes;
+};
+
+// Where PSMoveThread gets its controllers from. Mirrors the parts of the
+// PSMoveClient_CAPI the thread uses, so the streaming path can run against
+// PSMoveService or against an in-process simulator. Device state is exposed
+// through the CAPI's own PSMController and PSMHeadMountedDisplay structs
+// either way.
+// All methods are called from the thread that runs the source.
+class ControllerSource {
+public:
+	virtual ~ControllerSource() {}
+
+	virtual bool connect() = 0;	   // PSM_Initialize
+	virtual void disconnect() = 0; // PSM_Shutdown
+	virtual void update() = 0;	   // PSM_Update; refreshes the controller views.
+	// PSM_GetIsConnected; false once the connection was lost. The controller
+	// views may move on the next connect().
+	virtual bool isConnected() const = 0;
+
+	// Fills ids with the currently connected controllers and types with the
+	// type of each. Returns false on failure.
+	virtual bool getControllerList(
+		std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) = 0;
+	// The view of one controller. Valid until disconnect().
+	virtual PSMController *getController(PSMControllerID id) = 0;
+	// Asks for data streams with the given PSMControllerDataStreamFlags.
+	virtual void startControllerStreams(
+		const std::vector<PSMControllerID> &ids, unsigned int flags) = 0;
+	// True once a requested data stream has started.
+	virtual bool controllerStreamsActive() const = 0;
+	// Stops the data streams of controllers that are no longer used.
+	virtual void stopControllerStreams(const std::vector<PSMControllerID> &ids) = 0;
+	// True if controllers or HMDs connected or disconnected since the last
+	// call. Cheap; call getControllerList() and getHmdList() only when it
+	// returns true.
+	virtual bool controllerListChanged() = 0;
+	// The list queries without blocking, for use while streaming:
+	// requestDeviceLists() asks for both lists, update() lets the answer
+	// arrive, and takeDeviceLists() returns true once it has, with ok false if
+	// the controller list could not be had. The default answers at once
+	// through getControllerList() and getHmdList().
+	virtual void requestDeviceLists() {}
+	virtual bool takeDeviceLists(DeviceLists &lists, bool &ok) {
+		ok = getControllerList(lists.controllers, lists.controllerTypes);
+		// A service without HMD support just has none.
+		if (!getHmdList(lists.hmds, lists.hmdTypes)) {
+			lists.hmds.clear();
+			lists.hmdTypes.clear();
+		}
+		return true;
+	}
+
+	// The same for HMDs. Their streams share controllerStreamsActive().
+	virtual bool getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) = 0;
+	virtual PSMHeadMountedDisplay *getHmd(PSMHmdID id) = 0;
+	virtual void startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) = 0;
+	virtual void stopHmdStreams(const std::vector<PSMHmdID> &ids) = 0;
+
+	// local_clock() when the current packet of a device was received, for
+	// sources that queue packets and hand them out after the fact; 0 if it is
+	// as fresh as the last update().
+	virtual double controllerPacketTime(PSMControllerID id) { return 0.0; }
+	virtual double hmdPacketTime(PSMHmdID id) { return 0.0; }
+	// True while queued packets are left for the next update(), which should
+	// then follow without a sleep.
+	virtual bool packetsPending() const { return false; }
+
+	// PSM_GetTrackerList: intrinsics and extrinsics of the tracking cameras.
+	virtual bool getTrackerList(PSMTrackerList &list) = 0;
+};
+
+#endif // CONTROLLERSOURCE_H
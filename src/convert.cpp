@@ -0,0 +1,226 @@
+// PSMoveLSLConvert: turns a backup log written with backup-dir (see
+// sessionlog.h) into an XDF file, as LabRecorder would have written it, or
+// into one CSV file per stream. Reads the log record by record, so logs of
+// any length convert in constant memory.
+
+#include "sessionlog.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QXmlStreamReader>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// XDF chunk tags.
+const uint16_t kTagFileHeader = 1;
+const uint16_t kTagStreamHeader = 2;
+const uint16_t kTagSamples = 3;
+const uint16_t kTagStreamFooter = 6;
+
+template <typename T> void append(std::string &buf, T value) {
+	buf.append((const char *)&value, sizeof(value));
+}
+
+// XDF's variable-length integer: 1, 4 or 8 bytes, preceded by that count.
+void appendVarLen(std::string &buf, uint64_t value) {
+	if (value <= 0xff) {
+		append<uint8_t>(buf, 1);
+		append<uint8_t>(buf, (uint8_t)value);
+	} else if (value <= 0xffffffff) {
+		append<uint8_t>(buf, 4);
+		append<uint32_t>(buf, (uint32_t)value);
+	} else {
+		append<uint8_t>(buf, 8);
+		append<uint64_t>(buf, value);
+	}
+}
+
+void writeChunk(std::ofstream &out, uint16_t tag, const std::string &content) {
+	std::string head;
+	appendVarLen(head, content.size() + sizeof(tag));
+	append(head, tag);
+	out.write(head.data(), head.size());
+	out.write(content.data(), content.size());
+}
+
+struct StreamTotals {
+	double first = 0.0;
+	double last = 0.0;
+	uint64_t count = 0;
+};
+
+bool convertToXdf(SessionLogReader &reader, const QString &path) {
+	std::ofstream out(path.toStdString(), std::ios::binary);
+	if (!out) return false;
+	out.write("XDF:", 4);
+	writeChunk(out, kTagFileHeader,
+		"<?xml version=\"1.0\"?><info><version>1.0</version></info>");
+	const std::vector<SessionLogReader::Stream> &streams = reader.streams();
+	for (uint32_t id = 0; id < streams.size(); id++) {
+		if (streams[id].valueSize == 0) continue;
+		std::string content;
+		append(content, id);
+		content += streams[id].xml;
+		writeChunk(out, kTagStreamHeader, content);
+	}
+
+	std::vector<StreamTotals> totals(streams.size());
+	int stream;
+	std::vector<double> stamps;
+	std::vector<char> data;
+	std::string content;
+	while (reader.next(stream, stamps, data)) {
+		size_t sampleBytes = data.size() / stamps.size();
+		content.clear();
+		append(content, (uint32_t)stream);
+		appendVarLen(content, stamps.size());
+		for (size_t smp = 0; smp < stamps.size(); smp++) {
+			append<uint8_t>(content, sizeof(double));
+			append(content, stamps[smp]);
+			content.append(data.data() + smp * sampleBytes, sampleBytes);
+		}
+		writeChunk(out, kTagSamples, content);
+		StreamTotals &t = totals[stream];
+		if (t.count == 0) t.first = stamps.front();
+		t.last = stamps.back();
+		t.count += stamps.size();
+	}
+
+	for (uint32_t id = 0; id < streams.size(); id++) {
+		if (streams[id].valueSize == 0) continue;
+		std::ostringstream footer;
+		footer << std::setprecision(std::numeric_limits<double>::max_digits10)
+			   << "<?xml version=\"1.0\"?><info><first_timestamp>" << totals[id].first
+			   << "</first_timestamp><last_timestamp>" << totals[id].last
+			   << "</last_timestamp><sample_count>" << totals[id].count
+			   << "</sample_count></info>";
+		std::string content;
+		append(content, id);
+		content += footer.str();
+		writeChunk(out, kTagStreamFooter, content);
+	}
+	return (bool)out;
+}
+
+// The stream name and channel labels of a stream_info XML.
+void describeStream(const std::string &xml, QString &name, QStringList &labels) {
+	QXmlStreamReader reader(QString::fromStdString(xml));
+	while (!reader.atEnd() && !reader.hasError()) {
+		reader.readNext();
+		if (!reader.isStartElement()) continue;
+		if (reader.name() == "name" && name.isEmpty())
+			name = reader.readElementText();
+		else if (reader.name() == "label")
+			labels << reader.readElementText();
+	}
+}
+
+template <typename T> void writeValues(std::ofstream &out, const char *data, int channels) {
+	for (int ch = 0; ch < channels; ch++) {
+		T value;
+		std::memcpy(&value, data + ch * sizeof(T), sizeof(T));
+		out << ',' << +value;
+	}
+}
+
+bool convertToCsv(SessionLogReader &reader, const QString &dir, const QString &baseName) {
+	const std::vector<SessionLogReader::Stream> &streams = reader.streams();
+	std::vector<std::unique_ptr<std::ofstream>> files(streams.size());
+	for (size_t id = 0; id < streams.size(); id++) {
+		const SessionLogReader::Stream &s = streams[id];
+		if (s.valueSize == 0) continue;
+		QString name;
+		QStringList labels;
+		describeStream(s.xml, name, labels);
+		QString filename =
+			QDir(dir).filePath(QString("%1_%2_%3.csv").arg(baseName).arg((int)id).arg(name));
+		files[id].reset(new std::ofstream(filename.toStdString()));
+		std::ofstream &out = *files[id];
+		if (!out) return false;
+		out << std::setprecision(std::numeric_limits<double>::max_digits10) << "timestamp";
+		for (int ch = 0; ch < s.channels; ch++)
+			out << ',' << (ch < labels.size() ? labels[ch].toStdString() : std::to_string(ch));
+		out << '\n';
+	}
+
+	int stream;
+	std::vector<double> stamps;
+	std::vector<char> data;
+	while (reader.next(stream, stamps, data)) {
+		const SessionLogReader::Stream &s = streams[stream];
+		std::ofstream &out = *files[stream];
+		size_t sampleBytes = s.channels * s.valueSize;
+		for (size_t smp = 0; smp < stamps.size(); smp++) {
+			out << stamps[smp];
+			const char *values = data.data() + smp * sampleBytes;
+			switch (s.format) {
+			case lsl::cf_float32: writeValues<float>(out, values, s.channels); break;
+			case lsl::cf_double64: writeValues<double>(out, values, s.channels); break;
+			case lsl::cf_int32: writeValues<int32_t>(out, values, s.channels); break;
+			case lsl::cf_int16: writeValues<int16_t>(out, values, s.channels); break;
+			case lsl::cf_int8: writeValues<int8_t>(out, values, s.channels); break;
+			case lsl::cf_int64: writeValues<int64_t>(out, values, s.channels); break;
+			default: break;
+			}
+			out << '\n';
+		}
+	}
+	for (auto &file : files)
+		if (file && !*file) return false;
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Converts a PSMoveLSL backup log to XDF or CSV.");
+	parser.addHelpOption();
+	QCommandLineOption formatOption(QStringList() << "f" << "format",
+		"Output format: xdf (default) or csv, one file per stream.", "format", "xdf");
+	QCommandLineOption outputOption(QStringList() << "o" << "output",
+		"XDF file, or directory for the CSV files; default next to the log.", "path");
+	parser.addOption(formatOption);
+	parser.addOption(outputOption);
+	parser.addPositionalArgument("log", "The .psmlog file to convert.");
+	parser.process(app);
+
+	if (parser.positionalArguments().size() != 1) parser.showHelp(1);
+	QString logPath = parser.positionalArguments().value(0);
+	SessionLogReader reader(logPath.toStdString());
+	if (!reader.isOpen()) {
+		qCritical() << "Not a PSMoveLSL backup log:" << logPath;
+		return 1;
+	}
+
+	QFileInfo logInfo(logPath);
+	QString format = parser.value(formatOption).toLower();
+	bool ok;
+	if (format == "xdf") {
+		QString output = parser.isSet(outputOption)
+			? parser.value(outputOption)
+			: QDir(logInfo.absolutePath()).filePath(logInfo.completeBaseName() + ".xdf");
+		ok = convertToXdf(reader, output);
+	} else if (format == "csv") {
+		QString output = parser.isSet(outputOption) ? parser.value(outputOption) : logInfo.absolutePath();
+		ok = QDir(output).mkpath(".") && convertToCsv(reader, output, logInfo.completeBaseName());
+	} else {
+		qCritical() << "Unknown format" << format << "; expected xdf or csv.";
+		return 1;
+	}
+	if (!ok) {
+		qCritical() << "Could not write the converted" << format << "output.";
+		return 1;
+	}
+	return 0;
+}
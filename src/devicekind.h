@@ -0,0 +1,79 @@
+#ifndef DEVICEKIND_H
+#define DEVICEKIND_H
+
+#include <QString>
+#include <cstdint>
+#include "PSMoveClient_CAPI.h"
+
+// The kinds of PSMoveService devices that can be streamed. Controllers and
+// HMDs have separate id spaces in the service; a DeviceKey tells them apart.
+
+enum class DeviceKind { PSMove, Navi, DualShock4, Morpheus };
+
+// The state of one packet, whichever kind of device sent it.
+union DeviceState {
+	PSMPSMove psmove;
+	PSMPSNavi navi;
+	PSMDualShock4 ds4;
+	PSMMorpheus morpheus;
+};
+
+// A controller id as is, or an HMD id with kHmdKeyBit set.
+typedef uint32_t DeviceKey;
+const DeviceKey kHmdKeyBit = 0x10000;
+
+inline DeviceKey controllerKey(PSMControllerID id) { return (DeviceKey)id; }
+inline DeviceKey hmdKey(PSMHmdID id) { return kHmdKeyBit | (DeviceKey)id; }
+inline bool isHmdKey(DeviceKey key) { return (key & kHmdKeyBit) != 0; }
+inline int deviceId(DeviceKey key) { return (int)(key & ~kHmdKeyBit); }
+
+// "3" for controller 3, "hmd0" for HMD 0: the part of a device string before
+// the ':' and the prefix of the device's channel labels.
+inline QString deviceKeyString(DeviceKey key) {
+	QString str = isHmdKey(key) ? QString("hmd") : QString();
+	str += QString::number(deviceId(key));
+	return str;
+}
+
+// The inverse of deviceKeyString(). Returns false if str is neither form.
+inline bool parseDeviceKey(const QString &str, DeviceKey &key) {
+	bool hmd = str.startsWith("hmd");
+	bool ok = false;
+	int id = (hmd ? str.mid(3) : str).toInt(&ok);
+	if (!ok || id < 0) return false;
+	key = hmd ? hmdKey(id) : controllerKey(id);
+	return true;
+}
+
+// The kind of a controller, or false for types that cannot be streamed.
+inline bool controllerKind(PSMControllerType type, DeviceKind &kind) {
+	switch (type) {
+	case PSMController_Move: kind = DeviceKind::PSMove; return true;
+	case PSMController_Navi: kind = DeviceKind::Navi; return true;
+	case PSMController_DualShock4: kind = DeviceKind::DualShock4; return true;
+	default: return false;
+	}
+}
+
+// Leads the names of a device's streams, as in PSMoveIMU or MorpheusPosition.
+inline const char *streamPrefix(DeviceKind kind) {
+	switch (kind) {
+	case DeviceKind::PSMove: return "PSMove";
+	case DeviceKind::Navi: return "PSNavi";
+	case DeviceKind::DualShock4: return "DualShock4";
+	case DeviceKind::Morpheus: return "Morpheus";
+	}
+	return "";
+}
+
+inline const char *deviceModel(DeviceKind kind) {
+	switch (kind) {
+	case DeviceKind::PSMove: return "PlayStation Move";
+	case DeviceKind::Navi: return "PlayStation Move Navigation";
+	case DeviceKind::DualShock4: return "DualShock 4";
+	case DeviceKind::Morpheus: return "PlayStation VR";
+	}
+	return "";
+}
+
+#endif // DEVICEKIND_H
@@ -0,0 +1,121 @@
+#ifndef DEVICESTREAM_H
+#define DEVICESTREAM_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "lsl_cpp.h"
+#include "PSMoveClient_CAPI.h"
+#include "clockmapper.h"
+#include "kinematics.h"
+#include "preview.h"
+#include "quantize.h"
+#include "resampler.h"
+#include "samplelayout.h"
+#include "samplering.h"
+#include "sessionlog.h"
+#include "telemetry.h"
+
+// One controller or HMD packet as captured right after PSM_Update().
+struct ControllerSample {
+	int seq;			// OutputSequenceNum of the packet.
+	int skipped;		// Packets lost immediately before this one.
+	double captureTime; // local_clock() when the packet was first seen.
+	double timestamp;	// LSL timestamp to push the sample with.
+	double deviceTime;	// Device clock of the packet, if it has one.
+	DeviceState state;	// Only the member of the device's kind is set.
+};
+
+// Everything the pipeline needs for one streamed device. Built once in
+// createOutlets() so the steady-state loops neither allocate nor lock.
+// The acquisition thread owns the first group of members and writes the
+// ring; the publisher thread reads the ring and owns the rest. Both update
+// their own counters.
+struct DeviceStream {
+	std::shared_ptr<DeviceCounters> counters; // Shared with the stats outlet.
+	QString name;						// deviceString() of the device.
+	DeviceKey id = 0;
+	DeviceKind kind = DeviceKind::PSMove;
+	std::atomic<bool> released{false};	// Set by the publisher once it let go of a retired device.
+
+	// Acquisition side.
+	PSMController *view = nullptr;		// Set for controllers...
+	PSMHeadMountedDisplay *hmdView = nullptr; // ...or for HMDs.
+	int lastSeqNum = -1;
+	int unreportedGap = 0;				// Skipped packets not yet attached to a sample.
+	std::unique_ptr<SampleRing<ControllerSample>> ring; // Captured, not yet pushed packets.
+	DeviceTimeSource timeSource = DeviceTimeSource::None;
+	DeviceTimeReader readDeviceTime = nullptr; // nullptr if timeSource is None.
+	ClockMapper clock;					// Only used if mapDeviceClock is set.
+	bool mapDeviceClock = false;		// Stamp samples from the device clock, not capture time.
+	int shard = 0;						// Index of the publisher thread that drains the ring.
+
+	// Publisher side.
+	SampleFiller fillIMU = nullptr;		// nullptr if the device has no IMU stream.
+	SampleFiller fillPos = nullptr;		// nullptr if the device has no position stream.
+	std::unique_ptr<lsl::stream_outlet> imuOutlet;
+	std::unique_ptr<lsl::stream_outlet> posOutlet;
+	std::unique_ptr<lsl::stream_outlet> timeOutlet; // Full-precision device time; nullptr if none.
+	std::unique_ptr<lsl::stream_outlet> eventOutlet; // Button and analog changes; nullptr if off.
+	EventPacker packEvents = nullptr;
+	int eventButtons = 0;
+	int eventAxes = 0;
+	EventState lastEvent = kNoEventState; // Packed state of the last event pushed.
+	std::vector<int16_t> eventSample;
+	int imuChannels = 0;
+	int posChannels = 0;
+	// Samples waiting for the next push, chunkCapacity of each preallocated.
+	std::vector<float> imuChunk;
+	std::vector<float> posChunk;
+	std::vector<double> timeChunk;
+	std::vector<double> stamps;
+	// Compact mode only: the chunks encoded for cf_int16 outlets.
+	bool compact = false;
+	Quantizer imuQuantizer;
+	Quantizer posQuantizer;
+	std::vector<int16_t> imuChunk16;
+	std::vector<int16_t> posChunk16;
+	size_t chunkCapacity = 1;
+	size_t pending = 0;
+	double firstPendingTime = 0.0;
+	double pendingCaptureSum = 0.0;		// Sum of the pending samples' capture times.
+	// Resampling to a regular rate; resampler is nullptr if samples are pushed as captured.
+	std::unique_ptr<Resampler> resampler;
+	std::vector<float> resampleInput;	// IMU then position channels of one captured sample.
+	int resampleSkipped = 0;			// Packets lost since the last resampled sample.
+	int combinedSlot = -1;				// Slot in the combined stream; -1 if the device has its own outlets.
+	// Derived kinematics, computed in the publisher's KinematicsBatch; readKinematics is nullptr if off.
+	KinematicsReader readKinematics = nullptr;
+	KinematicsHistory kinematicsHistory;
+	std::unique_ptr<lsl::stream_outlet> kinematicsOutlet;
+	std::vector<float> kinematicsChunk;	// Batch capacity samples, pushed after each compute().
+	std::vector<double> kinematicsStamps;
+	size_t kinematicsPending = 0;
+	// GUI preview; preview is nullptr if off.
+	PreviewTrack *preview = nullptr;
+	PreviewReader readPreview = nullptr;
+	double nextPreview = 0.0;			// Capture time of the next preview point.
+	// Backup of what the outlets push; the streams are -1 for outlets the device lacks.
+	SessionLog *log = nullptr;
+	int imuLog = -1;
+	int posLog = -1;
+	int timeLog = -1;
+	int eventLog = -1;
+	int kinematicsLog = -1;
+};
+
+// The newest packet's sequence number and state, from whichever view the device has.
+inline int outputSequence(const DeviceStream &dev) {
+	return dev.hmdView ? dev.hmdView->OutputSequenceNum : dev.view->OutputSequenceNum;
+}
+
+inline void copyState(const DeviceStream &dev, DeviceState &state) {
+	switch (dev.kind) {
+	case DeviceKind::PSMove: state.psmove = dev.view->ControllerState.PSMoveState; break;
+	case DeviceKind::Navi: state.navi = dev.view->ControllerState.PSNaviState; break;
+	case DeviceKind::DualShock4: state.ds4 = dev.view->ControllerState.PSDS4State; break;
+	case DeviceKind::Morpheus: state.morpheus = dev.hmdView->HmdState.MorpheusState; break;
+	}
+}
+
+#endif // DEVICESTREAM_H
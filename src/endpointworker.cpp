@@ -0,0 +1,27 @@
+// PSMoveLSLEndpoint: serves one PSMoveService, or a simulator, to a
+// RemoteSource in the bridge process that started it (see remotesource.h).
+// Not meant to be run by hand.
+#include "psmservicesource.h"
+#include "remotesource.h"
+#include "simulatedsource.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char *argv[]) {
+	if (argc >= 2 && argc <= 5 && std::strcmp(argv[1], "simulator") == 0) {
+		SimulatorSettings settings;
+		if (argc > 2) settings.seed = (unsigned int)std::strtoul(argv[2], nullptr, 10);
+		if (argc > 3) settings.controllers = std::atoi(argv[3]);
+		if (argc > 4) settings.rate = std::atof(argv[4]);
+		SimulatedSource source(settings);
+		return serveEndpoint(source);
+	}
+	if (argc != 3) {
+		std::fprintf(stderr, "Usage: %s <address> <port>\n       %s simulator [seed [controllers [rate]]]\n",
+			argv[0], argv[0]);
+		return 2;
+	}
+	PSMServiceSource source(argv[1], argv[2]);
+	return serveEndpoint(source);
+}
@@ -0,0 +1,211 @@
+// PSMoveLSLHeadless: streams straight from psmove_config.cfg and command-line
+// overrides, without a GUI, until SIGINT or SIGTERM. Suitable for running as a
+// service on acquisition machines. With --replay it republishes a backup log
+// instead.
+
+#include "psmoveconfig.h"
+#include "psmovethread.h"
+#include "replaythread.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QTimer>
+#include <csignal>
+
+namespace {
+
+const char *kDefaultConfig = "psmove_config.cfg";
+// Seconds between stats summaries in the log.
+const double kStatsLogInterval = 60.0;
+
+volatile std::sig_atomic_t g_stopSignal = 0;
+
+void handleStopSignal(int signal) { g_stopSignal = signal; }
+
+// Entries of deviceList ("id:serial") matching the requested ids or serials,
+// or every entry if none were requested. Empty unless all requested devices
+// are present.
+QStringList selectDevices(const QStringList &deviceList, const QStringList &requested) {
+	if (requested.isEmpty()) return deviceList;
+	QStringList selected;
+	for (const QString &want : requested) {
+		QString key = want.trimmed();
+		for (const QString &entry : deviceList) {
+			if (entry.section(':', 0, 0) == key ||
+				entry.section(':', 1).compare(key, Qt::CaseInsensitive) == 0) {
+				selected << entry;
+				break;
+			}
+		}
+	}
+	return selected.size() == requested.size() ? selected : QStringList();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Streams PSMoveService controllers to LSL without a GUI.");
+	parser.addHelpOption();
+	QCommandLineOption configOption(QStringList() << "c" << "config",
+		"Load configuration from <config>.", "config", kDefaultConfig);
+	QCommandLineOption serverOption("server-ip", "PSMoveService address.", "address");
+	QCommandLineOption portOption("server-port", "PSMoveService port.", "port");
+	QCommandLineOption devicesOption("devices",
+		"Comma-separated controller ids or serials to stream; default all.", "list");
+	QCommandLineOption streamsOption("streams",
+		"Comma-separated streams: imu, imu_raw, pose, pose_raw, events, kinematics.", "list");
+	QCommandLineOption rateOption("sampling-rate", "Rate of resampled streams.", "hz");
+	QCommandLineOption resampleOption("resample", "Resample the streams to the sampling rate.");
+	QCommandLineOption combinedOption("combined", "One wide IMU and pose stream for all controllers.");
+	QCommandLineOption compactOption("compact", "Push int16 instead of float32 samples.");
+	QCommandLineOption chunkOption("chunk-size", "Samples per push.", "n");
+	QCommandLineOption chunkLatencyOption("chunk-max-latency-ms", "Max. chunk latency.", "ms");
+	QCommandLineOption simulateOption("simulate", "Use simulated controllers.");
+	QCommandLineOption endpointsOption("endpoints",
+		"Comma-separated sources to aggregate: address[:port], simulator or simulator@worker.", "list");
+	QCommandLineOption reconnectOption("reconnect", "Keep reconnecting to PSMoveService instead of exiting.");
+	QCommandLineOption realtimeOption("realtime", "Real-time scheduling, locked memory and prefaulted stacks.");
+	QCommandLineOption backupOption("backup-dir", "Also record the streams to a local backup log in <dir>.", "dir");
+	QCommandLineOption replayOption("replay", "Republish the backup log <file> instead of streaming.", "file");
+	QCommandLineOption replaySpeedOption("replay-speed", "Replay pace; 0 is as fast as possible.", "factor");
+	QCommandLineOption replayLoopOption("replay-loop", "Start the replay over at the end of the log.");
+	parser.addOption(configOption);
+	parser.addOption(serverOption);
+	parser.addOption(portOption);
+	parser.addOption(devicesOption);
+	parser.addOption(streamsOption);
+	parser.addOption(rateOption);
+	parser.addOption(resampleOption);
+	parser.addOption(combinedOption);
+	parser.addOption(compactOption);
+	parser.addOption(chunkOption);
+	parser.addOption(chunkLatencyOption);
+	parser.addOption(simulateOption);
+	parser.addOption(endpointsOption);
+	parser.addOption(reconnectOption);
+	parser.addOption(realtimeOption);
+	parser.addOption(backupOption);
+	parser.addOption(replayOption);
+	parser.addOption(replaySpeedOption);
+	parser.addOption(replayLoopOption);
+	parser.process(app);
+
+	PSMoveConfig config;
+	if (!loadConfig(parser.value(configOption), config) && parser.isSet(configOption)) return 1;
+	if (parser.isSet(serverOption)) config.serverAddress = parser.value(serverOption);
+	if (parser.isSet(portOption)) config.serverPort = parser.value(portOption);
+	if (parser.isSet(devicesOption))
+		config.devices = parser.value(devicesOption).split(",", QString::SkipEmptyParts);
+	if (parser.isSet(streamsOption) && !parseStreamList(parser.value(streamsOption), config)) return 1;
+	if (parser.isSet(rateOption)) config.samplingRate = parser.value(rateOption).toDouble();
+	if (parser.isSet(resampleOption)) config.resample = true;
+	if (parser.isSet(combinedOption)) config.combined = true;
+	if (parser.isSet(compactOption)) config.compact = true;
+	if (parser.isSet(chunkOption)) config.chunkSize = parser.value(chunkOption).toInt();
+	if (parser.isSet(chunkLatencyOption))
+		config.chunkMaxLatency = parser.value(chunkLatencyOption).toDouble() / 1000.0;
+	if (parser.isSet(simulateOption)) config.simulate = true;
+	if (parser.isSet(endpointsOption))
+		config.endpoints = parser.value(endpointsOption).split(",", QString::SkipEmptyParts);
+	if (parser.isSet(reconnectOption)) config.reconnect = true;
+	if (parser.isSet(realtimeOption)) config.realtime = true;
+	if (parser.isSet(backupOption)) config.backupDir = parser.value(backupOption);
+	if (parser.isSet(replaySpeedOption)) config.replaySpeed = parser.value(replaySpeedOption).toDouble();
+	if (parser.isSet(replayLoopOption)) config.replayLoop = true;
+	bool replay = parser.isSet(replayOption);
+	if (!replay &&
+		!(config.doIMU || config.doIMU_raw || config.doPos || config.doPos_raw || config.doEvents ||
+			config.doKinematics)) {
+		qCritical() << "No streams selected.";
+		return 1;
+	}
+
+	std::signal(SIGINT, handleStopSignal);
+	std::signal(SIGTERM, handleStopSignal);
+	QTimer signalPoll;
+	QObject::connect(&signalPoll, &QTimer::timeout, [&app] {
+		if (g_stopSignal) {
+			qInfo() << "Received signal" << (int)g_stopSignal << ", stopping.";
+			app.quit();
+		}
+	});
+	signalPoll.start(100);
+
+	if (replay) {
+		// No PSMoveService: the outlets come from the log.
+		int exitCode = 0;
+		ReplayThread replayThread;
+		QObject::connect(&replayThread, &ReplayThread::replayStarted, &app, [&](bool started) {
+			if (started) {
+				qInfo() << "Replay started.";
+			} else {
+				qCritical() << "Could not replay" << parser.value(replayOption);
+				exitCode = 1;
+			}
+		});
+		QObject::connect(&replayThread, &ReplayThread::replayFinished, &app, [&app] {
+			qInfo() << "Replay finished.";
+			app.quit();
+		});
+		replayThread.startReplay(parser.value(replayOption), config.replaySpeed, config.replayLoop);
+		int appResult = app.exec();
+		return exitCode ? exitCode : appResult;
+	}
+
+	int exitCode = 0;
+	bool streamsRequested = false;
+	QString target = config.endpoints.isEmpty() ? config.serverAddress + ":" + config.serverPort
+												: config.endpoints.join(",");
+	double lastStatsLog = -kStatsLogInterval;
+	PSMoveThread thread;
+	QObject::connect(&thread, &PSMoveThread::psmsConnected, &app, [&](bool connected) {
+		if (connected) {
+			qInfo() << "Connected; waiting for controllers.";
+		} else if (!g_stopSignal) {
+			qCritical() << "Could not connect to" << target;
+			exitCode = 1;
+			app.quit();
+		}
+	});
+	QObject::connect(&thread, &PSMoveThread::deviceListUpdated, &app, [&](QStringList deviceList) {
+		if (streamsRequested) return;
+		QStringList selected = selectDevices(deviceList, config.devices);
+		if (selected.isEmpty()) {
+			qInfo() << "Found" << deviceList << "; waiting for" << config.devices;
+			return;
+		}
+		qInfo() << "Streaming" << selected;
+		streamsRequested = true;
+		// An empty list also streams the controllers that connect later.
+		thread.startStreams(config.devices.isEmpty() ? QStringList() : selected, config.doIMU, config.doIMU_raw, config.doPos,
+			config.doPos_raw, config.chunkSize, config.chunkMaxLatency, config.deviceClock,
+			config.resample, config.combined, config.compact, config.doEvents,
+			config.doKinematics);
+	});
+	QObject::connect(&thread, &PSMoveThread::reconnecting, &app, [&](bool active) {
+		if (active)
+			qInfo() << "Lost" << target << "; reconnecting.";
+		else
+			qInfo() << "Reconnected.";
+	});
+	QObject::connect(&thread, &PSMoveThread::outletsStarted, &app,
+		[](bool started) { qInfo() << (started ? "Outlets started." : "Outlets stopped."); });
+	QObject::connect(&thread, &PSMoveThread::statsUpdated, &app, [&](QStringList summary) {
+		double now = lsl::local_clock();
+		if (now - lastStatsLog < kStatsLogInterval) return;
+		lastStatsLog = now;
+		summary << thread.latencySummary();
+		for (const QString &line : summary) qInfo().noquote() << line;
+	});
+
+	thread.setPublisherThreads(config.publisherThreads, config.publisherCpus);
+	thread.setReconnect(config.reconnect);
+	thread.setRealtime(config.realtime, config.realtimePriority, config.acquisitionCpu);
+	thread.setBackup(config.backupDir, (qint64)config.backupSizeMB << 20);
+	thread.initPSMS(config.samplingRate, config.waitMode, createControllerSource(config));
+	int appResult = app.exec();
+	// ~PSMoveThread flushes and closes the outlets and disconnects.
+	return exitCode ? exitCode : appResult;
+}
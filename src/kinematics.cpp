@@ -0,0 +1,122 @@
+#include "kinematics.h"
+#include <cmath>
+
+namespace {
+// Intervals shorter than this (s) count as a repeated packet and give no derivative.
+const double kMinInterval = 1e-4;
+} // namespace
+
+QStringList kinematicsChannelLabels() {
+	QStringList labels;
+	for (const char *block : {"Vel.", "Acc.", "AngVel.", "LinAccel."})
+		for (const char *axis : {"x", "y", "z"}) labels << QString(block) + axis;
+	labels << "SeqGap";
+	return labels;
+}
+
+void kinematicsChannelInfo(const QString &label, QString &type, QString &unit) {
+	if (label.startsWith("Vel.")) {
+		type = "Velocity";
+		unit = "cm/s";
+	} else if (label.startsWith("Acc.")) {
+		type = "Acceleration";
+		unit = "cm/s^2";
+	} else if (label.startsWith("AngVel.")) {
+		type = "AngularVelocity";
+		unit = "rad/s";
+	} else if (label.startsWith("LinAccel.")) {
+		type = "LinearAcceleration";
+		unit = "g";
+	} else {
+		type = "SeqGap";
+		unit = "packets";
+	}
+}
+
+KinematicsBatch::KinematicsBatch() : m_size(0), m_data(FieldCount * kKinematicsBatchCapacity, 0.0f) {}
+
+size_t KinematicsBatch::add(KinematicsHistory &history, double time, const KinematicsInput &in) {
+	size_t lane = m_size++;
+	double dt1 = history.count >= 1 ? time - history.time[0] : 0.0;
+	double dt2 = history.count >= 2 ? history.time[0] - history.time[1] : 0.0;
+	bool has1 = dt1 > kMinInterval;
+	bool has2 = has1 && dt2 > kMinInterval;
+	field(InvDt1)[lane] = has1 ? (float)(1.0 / dt1) : 0.0f;
+	field(InvDt2)[lane] = has2 ? (float)(1.0 / dt2) : 0.0f;
+	field(InvDt12)[lane] = has2 ? (float)(2.0 / (dt1 + dt2)) : 0.0f;
+	for (int i = 0; i < 3; i++) {
+		field(Field(P0x + i))[lane] = in.pos[i];
+		field(Field(P1x + i))[lane] = history.pos[0][i];
+		field(Field(P2x + i))[lane] = history.pos[1][i];
+		field(Field(Ax + i))[lane] = in.accel[i];
+	}
+	for (int i = 0; i < 4; i++) {
+		field(Field(Q0w + i))[lane] = in.quat[i];
+		field(Field(Q1w + i))[lane] = history.quat[i];
+	}
+
+	history.count = history.count < 2 ? history.count + 1 : 2;
+	history.time[1] = history.time[0];
+	history.time[0] = time;
+	for (int i = 0; i < 3; i++) {
+		history.pos[1][i] = history.pos[0][i];
+		history.pos[0][i] = in.pos[i];
+	}
+	for (int i = 0; i < 4; i++) history.quat[i] = in.quat[i];
+	return lane;
+}
+
+void KinematicsBatch::compute() {
+	const size_t n = m_size;
+	const float *invDt1 = field(InvDt1), *invDt2 = field(InvDt2), *invDt12 = field(InvDt12);
+	const float *p0x = field(P0x), *p0y = field(P0y), *p0z = field(P0z);
+	const float *p1x = field(P1x), *p1y = field(P1y), *p1z = field(P1z);
+	const float *p2x = field(P2x), *p2y = field(P2y), *p2z = field(P2z);
+	const float *q0w = field(Q0w), *q0x = field(Q0x), *q0y = field(Q0y), *q0z = field(Q0z);
+	const float *q1w = field(Q1w), *q1x = field(Q1x), *q1y = field(Q1y), *q1z = field(Q1z);
+	const float *ax = field(Ax), *ay = field(Ay), *az = field(Az);
+	float *vx = field(Vx), *vy = field(Vy), *vz = field(Vz);
+	float *accX = field(AccX), *accY = field(AccY), *accZ = field(AccZ);
+	float *wx = field(Wx), *wy = field(Wy), *wz = field(Wz);
+	float *lx = field(Lx), *ly = field(Ly), *lz = field(Lz);
+	// No branches: missing history shows up as a 0 factor.
+	for (size_t i = 0; i < n; i++) {
+		float v0x = (p0x[i] - p1x[i]) * invDt1[i];
+		float v0y = (p0y[i] - p1y[i]) * invDt1[i];
+		float v0z = (p0z[i] - p1z[i]) * invDt1[i];
+		float v1x = (p1x[i] - p2x[i]) * invDt2[i];
+		float v1y = (p1y[i] - p2y[i]) * invDt2[i];
+		float v1z = (p1z[i] - p2z[i]) * invDt2[i];
+		vx[i] = v0x;
+		vy[i] = v0y;
+		vz[i] = v0z;
+		accX[i] = (v0x - v1x) * invDt12[i];
+		accY[i] = (v0y - v1y) * invDt12[i];
+		accZ[i] = (v0z - v1z) * invDt12[i];
+
+		// The world-frame rotation q0 * conj(q1) over the last interval. At
+		// packet rates the angle is small, so 2 * its vector part / dt is the
+		// angular velocity; the sign picks the shorter way round.
+		float dw = q0w[i] * q1w[i] + q0x[i] * q1x[i] + q0y[i] * q1y[i] + q0z[i] * q1z[i];
+		float dx = -q0w[i] * q1x[i] + q0x[i] * q1w[i] - q0y[i] * q1z[i] + q0z[i] * q1y[i];
+		float dy = -q0w[i] * q1y[i] + q0x[i] * q1z[i] + q0y[i] * q1w[i] - q0z[i] * q1x[i];
+		float dz = -q0w[i] * q1z[i] - q0x[i] * q1y[i] + q0y[i] * q1x[i] + q0z[i] * q1w[i];
+		float s = std::copysign(2.0f, dw) * invDt1[i];
+		wx[i] = s * dx;
+		wy[i] = s * dy;
+		wz[i] = s * dz;
+
+		// Accel rotated by q0 (v + w t + q x t, t = 2 q x v), less gravity along +y.
+		float tx = 2.0f * (q0y[i] * az[i] - q0z[i] * ay[i]);
+		float ty = 2.0f * (q0z[i] * ax[i] - q0x[i] * az[i]);
+		float tz = 2.0f * (q0x[i] * ay[i] - q0y[i] * ax[i]);
+		lx[i] = ax[i] + q0w[i] * tx + (q0y[i] * tz - q0z[i] * ty);
+		ly[i] = ay[i] + q0w[i] * ty + (q0z[i] * tx - q0x[i] * tz) - 1.0f;
+		lz[i] = az[i] + q0w[i] * tz + (q0x[i] * ty - q0y[i] * tx);
+	}
+}
+
+void KinematicsBatch::read(size_t lane, float *sample) const {
+	for (int ch = 0; ch < kKinematicsChannels - kGapChannels; ch++)
+		sample[ch] = field(Field(Vx + ch))[lane];
+}
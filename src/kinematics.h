@@ -0,0 +1,108 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <QStringList>
+#include <cstddef>
+#include <vector>
+#include "samplelayout.h"
+
+// Derived kinematics, computed once in the bridge instead of in every
+// consumer. Per packet, in the world frame of the pose:
+//   Vel.xyz      linear velocity, cm/s (backward difference of Pos.*)
+//   Acc.xyz      linear acceleration, cm/s^2 (difference of the last two velocities)
+//   AngVel.xyz   angular velocity, rad/s (from the last two Pos.orient_*)
+//   LinAccel.xyz Accel.* rotated into the world frame with gravity removed, g
+// followed by SeqGap. Channels without enough history yet are 0.
+//
+// A publisher queues the packets of all its controllers into one
+// KinematicsBatch and computes them together. The batch keeps every input
+// and output quantity in its own array, indexed by lane, so compute() is a
+// single branch-free loop over the lanes. The arrays are a fixed
+// kKinematicsBatchCapacity apart, so the compiler can tell they do not
+// overlap and vectorizes the loop across controllers at -O3.
+
+const int kKinematicsChannels = 13; // Vel, Acc, AngVel, LinAccel (xyz each), SeqGap
+// Lanes of a publisher's batch, and so the most samples a device pushes at once.
+const size_t kKinematicsBatchCapacity = 64;
+
+// Pose and calibrated accelerometer of one packet.
+struct KinematicsInput {
+	float pos[3];  // cm
+	float quat[4]; // wxyz
+	float accel[3]; // g, sensor frame
+};
+
+typedef void (*KinematicsReader)(const DeviceState &state, KinematicsInput &in);
+
+template <class Traits> void readKinematics(const DeviceState &deviceState, KinematicsInput &in) {
+	const typename Traits::State &state = Traits::get(deviceState);
+	const PSMPosef &pose = state.Pose;
+	in.pos[0] = pose.Position.x;
+	in.pos[1] = pose.Position.y;
+	in.pos[2] = pose.Position.z;
+	in.quat[0] = pose.Orientation.w;
+	in.quat[1] = pose.Orientation.x;
+	in.quat[2] = pose.Orientation.y;
+	in.quat[3] = pose.Orientation.z;
+	in.accel[0] = state.CalibratedSensorData.Accelerometer.x;
+	in.accel[1] = state.CalibratedSensorData.Accelerometer.y;
+	in.accel[2] = state.CalibratedSensorData.Accelerometer.z;
+}
+
+// nullptr for kinds without pose and IMU.
+inline KinematicsReader kinematicsReader(DeviceKind kind) {
+	switch (kind) {
+	case DeviceKind::PSMove: return &readKinematics<PSMoveTraits>;
+	case DeviceKind::DualShock4: return &readKinematics<DualShock4Traits>;
+	case DeviceKind::Morpheus: return &readKinematics<MorpheusTraits>;
+	default: return nullptr;
+	}
+}
+
+// Channel labels, SeqGap included.
+QStringList kinematicsChannelLabels();
+// Channel type and unit of a label from kinematicsChannelLabels().
+void kinematicsChannelInfo(const QString &label, QString &type, QString &unit);
+
+// What one device remembers between packets.
+struct KinematicsHistory {
+	int count = 0;             // Packets seen, up to 2.
+	double time[2] = {0.0, 0.0}; // Newest first.
+	float pos[2][3] = {};
+	float quat[4] = {1.0f, 0.0f, 0.0f, 0.0f}; // Of the newest packet.
+};
+
+class KinematicsBatch {
+public:
+	KinematicsBatch();
+
+	size_t capacity() const { return kKinematicsBatchCapacity; }
+	size_t size() const { return m_size; }
+	bool full() const { return m_size == kKinematicsBatchCapacity; }
+	void clear() { m_size = 0; }
+
+	// Queues a packet stamped time and advances history. Returns its lane.
+	size_t add(KinematicsHistory &history, double time, const KinematicsInput &in);
+	// Computes every queued lane.
+	void compute();
+	// The kKinematicsChannels - kGapChannels derived values of a computed lane.
+	void read(size_t lane, float *sample) const;
+
+private:
+	// Lane arrays in m_data, each kKinematicsBatchCapacity floats.
+	enum Field {
+		InvDt1, InvDt2, InvDt12,             // 1/s of the last, previous and both intervals; 0 without history.
+		P0x, P0y, P0z, P1x, P1y, P1z, P2x, P2y, P2z, // Newest position first.
+		Q0w, Q0x, Q0y, Q0z, Q1w, Q1x, Q1y, Q1z,     // This and the previous orientation.
+		Ax, Ay, Az,
+		Vx, Vy, Vz, AccX, AccY, AccZ, Wx, Wy, Wz, Lx, Ly, Lz, // Outputs.
+		FieldCount
+	};
+	float *field(Field f) { return m_data.data() + f * kKinematicsBatchCapacity; }
+	const float *field(Field f) const { return m_data.data() + f * kKinematicsBatchCapacity; }
+
+	size_t m_size;
+	std::vector<float> m_data;
+};
+
+#endif // KINEMATICS_H
@@ -1,5 +1,4 @@
 #include <QFileDialog>
-#include <QtXml>
 #include <QDebug>
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
@@ -10,9 +9,15 @@ MainWindow::MainWindow(QWidget *parent, const QString config_file)
 {
     ui->setupUi(this);
     load_config(config_file);
-    connect(&m_thread, SIGNAL(openvrConnected(bool)), this, SLOT(update_connect_label(bool)));
+    connect(&m_thread, SIGNAL(psmsConnected(bool)), this, SLOT(update_connect_label(bool)));
     connect(&m_thread, SIGNAL(deviceListUpdated(QStringList)), this, SLOT(update_list_devices(QStringList)));
 	connect(&m_thread, SIGNAL(outletsStarted(bool)), this, SLOT(update_stream_button(bool)));
+	connect(&m_thread, SIGNAL(statsUpdated(QStringList)), this, SLOT(update_stats(QStringList)));
+	connect(&m_thread, SIGNAL(reconnecting(bool)), this, SLOT(update_reconnect_label(bool)));
+	ui->previewWidget->setThread(&m_thread);
+	connect(&m_thread, SIGNAL(previewTracksChanged(QStringList)), ui->previewWidget, SLOT(setTracks(QStringList)));
+	connect(&m_replay, SIGNAL(replayStarted(bool)), this, SLOT(update_replay_action(bool)));
+	connect(&m_replay, SIGNAL(replayFinished()), this, SLOT(replay_finished()));
 }
 
 MainWindow::~MainWindow()
@@ -22,30 +27,19 @@ MainWindow::~MainWindow()
 
 void MainWindow::load_config(const QString filename)
 {
-    QFile* xmlFile = new QFile(filename);
-    if (!xmlFile->open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qDebug() << "Could not load XML from file " << filename;
-        return;
-    }
-    QXmlStreamReader* xmlReader = new QXmlStreamReader(xmlFile);
-    while(!xmlReader->atEnd() && !xmlReader->hasError()) {
-        // Read next element
-        xmlReader->readNext();
-        if(xmlReader->isStartElement() && xmlReader->name() != "settings")
-        {
-            QStringRef elname = xmlReader->name();
-            if (elname == "sampling-rate")
-				ui->doubleSpinBox_sampling_rate->setValue(xmlReader->readElementText().toInt());
-        }
-    }
-    if(xmlReader->hasError()) {
-        qDebug() << "Config file parse error "
-                 << xmlReader->error()
-                 << ": "
-                 << xmlReader->errorString();
-    }
-    xmlReader->clear();
-    xmlFile->close();
+    loadConfig(filename, m_config);
+    ui->doubleSpinBox_sampling_rate->setValue(m_config.samplingRate);
+    ui->checkBox_resample->setChecked(m_config.resample);
+    ui->spinBox_chunk_size->setValue(m_config.chunkSize);
+    ui->doubleSpinBox_chunk_latency->setValue(m_config.chunkMaxLatency * 1000.0);
+    ui->checkBox_doIMU->setChecked(m_config.doIMU);
+    ui->checkBox_doRawIMU->setChecked(m_config.doIMU_raw);
+    ui->checkBox_doPos->setChecked(m_config.doPos);
+    ui->checkBox_doRawPos->setChecked(m_config.doPos_raw);
+    ui->checkBox_events->setChecked(m_config.doEvents);
+    ui->checkBox_kinematics->setChecked(m_config.doKinematics);
+    ui->checkBox_combined->setChecked(m_config.combined);
+    ui->checkBox_compact->setChecked(m_config.compact);
 }
 
 void MainWindow::save_config(const QString filename)
@@ -74,6 +68,31 @@ void MainWindow::on_actionSave_Configuration_triggered()
     }
 }
 
+void MainWindow::on_actionReplay_Session_triggered()
+{
+    if (m_replay.isRunning())
+    {
+        m_replay.stopReplay();
+        return;
+    }
+    QString sel = QFileDialog::getOpenFileName(this, "Replay Session", "", "Backup Logs (*.psmlog)");
+    if (!sel.isEmpty())
+    {
+        m_replay.startReplay(sel, m_config.replaySpeed, m_config.replayLoop);
+    }
+}
+
+void MainWindow::update_replay_action(bool running)
+{
+    ui->actionReplay_Session->setText(running ? "Stop Replay" : "Replay Session...");
+    ui->statusBar->showMessage(running ? "Replaying a backup log" : "");
+}
+
+void MainWindow::replay_finished()
+{
+    update_replay_action(false);
+}
+
 void MainWindow::update_connect_label(bool status)
 {
     if (status)
@@ -90,8 +109,25 @@ void MainWindow::update_connect_label(bool status)
 
 void MainWindow::update_list_devices(QStringList deviceList)
 {
+    // Keep the user's selection; devices new to the list start out selected
+    // if the config's devices names them by id or serial.
+    QStringList previous, selected;
+    for (int i = 0; i < ui->list_devices->count(); i++)
+        previous << ui->list_devices->item(i)->text();
+    for (QListWidgetItem *item : ui->list_devices->selectedItems())
+        selected << item->text();
     ui->list_devices->clear();
     ui->list_devices->addItems(deviceList);
+    for (int i = 0; i < ui->list_devices->count(); i++)
+    {
+        QListWidgetItem *item = ui->list_devices->item(i);
+        QString entry = item->text();
+        bool configured = false;
+        for (const QString &want : m_config.devices)
+            configured = configured || entry.section(':', 0, 0) == want.trimmed() ||
+                entry.section(':', 1).compare(want.trimmed(), Qt::CaseInsensitive) == 0;
+        item->setSelected(selected.contains(entry) || (!previous.contains(entry) && configured));
+    }
 }
 
 void MainWindow::update_stream_button(bool status)
@@ -106,25 +142,52 @@ void MainWindow::update_stream_button(bool status)
 	}
 }
 
+void MainWindow::update_stats(QStringList summary)
+{
+	summary << m_thread.latencySummary();
+	ui->plainTextEdit_stats->setPlainText(summary.join("\n"));
+}
+
+void MainWindow::update_reconnect_label(bool active)
+{
+	ui->label_conn_status->setText(active ? "Reconnecting to PSMoveService..." : "Connected to PSMoveService");
+}
+
 void MainWindow::on_pushButton_scan_clicked()
 {
-	m_thread.initPSMS(ui->doubleSpinBox_sampling_rate->value());
+	m_thread.setPublisherThreads(m_config.publisherThreads, m_config.publisherCpus);
+	m_thread.setReconnect(m_config.reconnect);
+	m_thread.setRealtime(m_config.realtime, m_config.realtimePriority, m_config.acquisitionCpu);
+	m_thread.setPreview(true);
+	m_thread.setBackup(m_config.backupDir, (qint64)m_config.backupSizeMB << 20);
+	m_thread.initPSMS(ui->doubleSpinBox_sampling_rate->value(), m_config.waitMode,
+		createControllerSource(m_config));
     ui->pushButton_scan->setText("Scanning...");
     ui->pushButton_scan->setDisabled(true);
+    // The rate is fixed once connected.
+    ui->doubleSpinBox_sampling_rate->setDisabled(true);
 }
 
 void MainWindow::on_pushButton_stream_clicked()
 {
-	// TODO: Spin up 2 threads for each controller.
 	bool doIMU = ui->checkBox_doIMU->isChecked();
 	bool doIMU_raw = ui->checkBox_doRawIMU->isChecked();
 	bool doPos = ui->checkBox_doPos->isChecked();
-	bool doPos_raw = ui->checkBox_doPos->isChecked();
+	bool doPos_raw = ui->checkBox_doRawPos->isChecked();
+	bool doEvents = ui->checkBox_events->isChecked();
+	bool doKinematics = ui->checkBox_kinematics->isChecked();
+	int chunkSize = ui->spinBox_chunk_size->value();
+	double chunkMaxLatency = ui->doubleSpinBox_chunk_latency->value() / 1000.0;
+	bool resample = ui->checkBox_resample->isChecked();
+	bool combined = ui->checkBox_combined->isChecked();
+	bool compact = ui->checkBox_compact->isChecked();
     QStringList devStringList;
     QList<QListWidgetItem *> lwi = ui->list_devices->selectedItems();
     for( int i=0; i<lwi.count(); ++i )
     {
         devStringList << lwi[i]->text();
     }
-    m_thread.startStreams(devStringList, doIMU, doIMU_raw, doPos, doPos_raw);
+    m_thread.startStreams(devStringList, doIMU, doIMU_raw, doPos, doPos_raw,
+                          chunkSize, chunkMaxLatency, m_config.deviceClock, resample, combined, compact, doEvents,
+                          doKinematics);
 }
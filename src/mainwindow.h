@@ -2,7 +2,9 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include "psmoveconfig.h"
 #include "psmovethread.h"
+#include "replaythread.h"
 
 const QString default_config_fname = "psmove_config.cfg";
 
@@ -23,9 +25,14 @@ private slots:
 
     void on_actionLoad_Configuration_triggered();
     void on_actionSave_Configuration_triggered();
+    void on_actionReplay_Session_triggered();
+    void update_replay_action(bool running);
+    void replay_finished();
     void update_connect_label(bool status);
     void update_list_devices(QStringList deviceList);
 	void update_stream_button(bool status);
+	void update_stats(QStringList summary);
+	void update_reconnect_label(bool active);
 
     void on_pushButton_scan_clicked();
 
@@ -37,6 +44,8 @@ private:
 
     Ui::MainWindow *ui;
     PSMoveThread m_thread;
+    ReplayThread m_replay;
+    PSMoveConfig m_config;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,107 @@
+#include "pollwaiter.h"
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace {
+const unsigned long kMinSleepUs = 100;	 // First re-poll after a packet was due.
+const unsigned long kMaxSleepUs = 1000;	 // Never back off further than this.
+const double kMinPeriod = 0.0005;		 // Clamp for the learned period (s).
+const double kMaxPeriod = 0.1;
+const double kStallInterval = 0.25;		 // Longer gaps are stalls, not the period.
+const double kPeriodAlpha = 1.0 / 16.0;	 // EWMA weight of a new interval.
+const double kGuardFraction = 0.25;		 // Wake this fraction of a period early.
+} // namespace
+
+double threadCpuSeconds() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0.0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+	timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.0;
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+PollWaiter::PollWaiter(WaitMode mode) : m_mode(mode) { reset(0.0); }
+
+void PollWaiter::reset(double now) {
+	m_period = 0.0;
+	m_seenArrival = false;
+	m_lastArrival = now;
+	m_lastPoll = now;
+	m_lastPollHadData = false;
+	m_backoffUs = kMinSleepUs;
+	m_windowStart = now;
+	m_windowCpuStart = threadCpuSeconds();
+	m_latencySum = 0.0;
+	m_latencyMax = 0.0;
+	m_polls = 0;
+	m_arrivals = 0;
+}
+
+void PollWaiter::notePoll(double now, bool gotData) {
+	m_polls++;
+	if (gotData) {
+		// The packet landed somewhere between the previous poll and this one.
+		double latency = now - m_lastPoll;
+		m_latencySum += latency;
+		m_latencyMax = std::max(m_latencyMax, latency);
+		m_arrivals++;
+
+		double interval = now - m_lastArrival;
+		if (m_seenArrival && interval < kStallInterval) {
+			interval = std::min(std::max(interval, kMinPeriod), kMaxPeriod);
+			m_period = m_period > 0.0 ? m_period + kPeriodAlpha * (interval - m_period) : interval;
+		}
+		m_seenArrival = true;
+		m_lastArrival = now;
+		m_backoffUs = kMinSleepUs;
+	} else if (m_period > 0.0 && now >= m_lastArrival + m_period * (1.0 - kGuardFraction)) {
+		// Packet is overdue; poll less eagerly each time it still isn't there.
+		unsigned long cap = std::min(kMaxSleepUs, (unsigned long)(m_period * kGuardFraction * 1e6));
+		cap = std::max(kMinSleepUs, cap);
+		m_backoffUs = std::min(m_backoffUs * 2, cap);
+	}
+	m_lastPoll = now;
+	m_lastPollHadData = gotData;
+}
+
+unsigned long PollWaiter::sleepMicros(double now) const {
+	if (m_mode == WaitMode::Spin) return m_lastPollHadData ? 0 : 1;
+	if (m_period <= 0.0) return kMinSleepUs; // Still learning the period.
+	double untilDue = m_lastArrival + m_period * (1.0 - kGuardFraction) - now;
+	if (untilDue > 0.0) return std::max(kMinSleepUs, (unsigned long)(untilDue * 1e6));
+	return m_backoffUs;
+}
+
+bool PollWaiter::takeReport(double now, double reportInterval, Report &report) {
+	double wall = now - m_windowStart;
+	if (wall < reportInterval) return false;
+	double cpu = threadCpuSeconds();
+	report.wallSeconds = wall;
+	report.cpuFraction = (cpu - m_windowCpuStart) / wall;
+	report.periodSeconds = m_period;
+	report.meanLatencySeconds = m_arrivals > 0 ? m_latencySum / m_arrivals : 0.0;
+	report.maxLatencySeconds = m_latencyMax;
+	report.polls = m_polls;
+	report.arrivals = m_arrivals;
+
+	m_windowStart = now;
+	m_windowCpuStart = cpu;
+	m_latencySum = 0.0;
+	m_latencyMax = 0.0;
+	m_polls = 0;
+	m_arrivals = 0;
+	return true;
+}
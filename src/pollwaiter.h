@@ -0,0 +1,62 @@
+#ifndef POLLWAITER_H
+#define POLLWAITER_H
+
+#include <cstdint>
+
+// How the transfer loop waits between PSM_Update() calls.
+enum class WaitMode {
+	Spin,	 // usleep(1) between polls; lowest latency, burns a core.
+	Adaptive // Learn the packet period and sleep until the next packet is due.
+};
+
+// Returns the CPU time (in seconds) consumed so far by the calling thread.
+double threadCpuSeconds();
+
+// Decides how long the transfer loop sleeps between polls and measures what
+// that costs. PSMoveClient_CAPI exposes no socket or event to block on, so the
+// adaptive mode learns the inter-packet period from the data itself, sleeps
+// until shortly before the next packet is due, then backs off exponentially
+// until it shows up.
+class PollWaiter {
+public:
+	struct Report {
+		double wallSeconds;		 // Length of the reporting window.
+		double cpuFraction;		 // Thread CPU time / wall time over the window.
+		double periodSeconds;	 // Current estimate of the inter-packet period.
+		double meanLatencySeconds; // Mean upper bound on how long new data sat unread.
+		double maxLatencySeconds;  // Worst upper bound within the window.
+		uint64_t polls;			 // PSM_Update() calls within the window.
+		uint64_t arrivals;		 // Polls that found new data.
+	};
+
+	explicit PollWaiter(WaitMode mode = WaitMode::Adaptive);
+
+	void reset(double now);
+	// Call after every poll. gotData is true if any device had a new packet.
+	void notePoll(double now, bool gotData);
+	// Microseconds to sleep before the next poll; 0 means poll again right away.
+	unsigned long sleepMicros(double now) const;
+	// Fills report and starts a new window once reportInterval seconds elapsed.
+	bool takeReport(double now, double reportInterval, Report &report);
+
+	WaitMode mode() const { return m_mode; }
+
+private:
+	WaitMode m_mode;
+	double m_period;	  // EWMA of inter-arrival time, 0 while still learning.
+	bool m_seenArrival;
+	double m_lastArrival; // Time of the last poll that found data.
+	double m_lastPoll;	  // Time of the previous poll.
+	bool m_lastPollHadData;
+	unsigned long m_backoffUs;
+
+	// Reporting window.
+	double m_windowStart;
+	double m_windowCpuStart;
+	double m_latencySum;
+	double m_latencyMax;
+	uint64_t m_polls;
+	uint64_t m_arrivals;
+};
+
+#endif // POLLWAITER_H
@@ -0,0 +1,43 @@
+#include "preview.h"
+#include <algorithm>
+
+PreviewTrack::PreviewTrack() : m_begun(0), m_written(0), m_samples(0) { reset(); }
+
+void PreviewTrack::reset() {
+	for (Slot &slot : m_slots) {
+		slot.time.store(0.0, std::memory_order_relaxed);
+		for (auto &value : slot.values) value.store(0.0f, std::memory_order_relaxed);
+	}
+	m_begun.store(0, std::memory_order_relaxed);
+	m_samples.store(0, std::memory_order_relaxed);
+	m_written.store(0, std::memory_order_release);
+}
+
+void PreviewTrack::write(double time, const float *values) {
+	uint64_t n = m_written.load(std::memory_order_relaxed);
+	// A reader that sees any of the stores below also sees m_begun past n.
+	m_begun.store(n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Slot &slot = m_slots[n % kPreviewPoints];
+	slot.time.store(time, std::memory_order_relaxed);
+	for (int v = 0; v < kPreviewValues; v++) slot.values[v].store(values[v], std::memory_order_relaxed);
+	m_written.store(n + 1, std::memory_order_release);
+}
+
+void PreviewTrack::read(std::vector<PreviewPoint> &out) const {
+	uint64_t written = m_written.load(std::memory_order_acquire);
+	uint64_t first = written > (uint64_t)kPreviewPoints ? written - kPreviewPoints : 0;
+	out.resize(written - first);
+	for (uint64_t n = first; n < written; n++) {
+		const Slot &slot = m_slots[n % kPreviewPoints];
+		PreviewPoint &p = out[n - first];
+		p.time = slot.time.load(std::memory_order_relaxed);
+		for (int v = 0; v < kPreviewValues; v++) p.values[v] = slot.values[v].load(std::memory_order_relaxed);
+	}
+	// Point n shares its slot with point n + kPreviewPoints; drop those whose
+	// slot a later write may have started on while we copied.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t begun = m_begun.load(std::memory_order_relaxed);
+	uint64_t intact = begun > (uint64_t)kPreviewPoints ? begun - kPreviewPoints : 0;
+	if (intact > first) out.erase(out.begin(), out.begin() + std::min<uint64_t>(intact - first, out.size()));
+}
@@ -0,0 +1,78 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "samplelayout.h"
+
+// Decimated copy of the streamed devices' signals for the GUI preview. The
+// publisher that owns a device writes at most kPreviewRate points per second
+// into the device's PreviewTrack, a fixed ring of relaxed atomics; the GUI
+// copies the rings at display rate and drops any point that was overwritten
+// while it copied. Writing never locks, allocates or signals, and the
+// acquisition thread is not involved at all.
+
+const int kPreviewTracks = 16;		// Devices previewed at once.
+const int kPreviewPoints = 256;		// Per track; about 4 s at kPreviewRate.
+const double kPreviewRate = 60.0;	// Points per second and device.
+const int kPreviewValues = 9;		// Accel.xyz (g), Gyro.xyz (rad/s), Pos.xyz (cm)
+
+struct PreviewPoint {
+	double time; // LSL timestamp of the sample.
+	float values[kPreviewValues];
+};
+
+typedef void (*PreviewReader)(const DeviceState &state, float *values);
+
+template <class Traits> void readPreview(const DeviceState &deviceState, float *values) {
+	const typename Traits::State &state = Traits::get(deviceState);
+	const auto &sens = state.CalibratedSensorData;
+	values[0] = sens.Accelerometer.x;
+	values[1] = sens.Accelerometer.y;
+	values[2] = sens.Accelerometer.z;
+	values[3] = sens.Gyroscope.x;
+	values[4] = sens.Gyroscope.y;
+	values[5] = sens.Gyroscope.z;
+	values[6] = state.Pose.Position.x;
+	values[7] = state.Pose.Position.y;
+	values[8] = state.Pose.Position.z;
+}
+
+// nullptr for kinds without sensors or pose.
+inline PreviewReader previewReader(DeviceKind kind) {
+	switch (kind) {
+	case DeviceKind::PSMove: return &readPreview<PSMoveTraits>;
+	case DeviceKind::DualShock4: return &readPreview<DualShock4Traits>;
+	case DeviceKind::Morpheus: return &readPreview<MorpheusTraits>;
+	default: return nullptr;
+	}
+}
+
+class PreviewTrack {
+public:
+	PreviewTrack();
+
+	// Writer: one publisher at a time.
+	void countSample() { m_samples.store(m_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+	void write(double time, const float *values);
+	// Only while no publisher writes.
+	void reset();
+
+	// Reader, any thread. Samples counted so far, decimated or not.
+	uint64_t samples() const { return m_samples.load(std::memory_order_relaxed); }
+	// Replaces out with the intact points, oldest first.
+	void read(std::vector<PreviewPoint> &out) const;
+
+private:
+	struct Slot {
+		std::atomic<double> time;
+		std::atomic<float> values[kPreviewValues];
+	};
+	Slot m_slots[kPreviewPoints];
+	std::atomic<uint64_t> m_begun;	 // Points whose write has started.
+	std::atomic<uint64_t> m_written; // Points completely written.
+	std::atomic<uint64_t> m_samples;
+};
+
+#endif // PREVIEW_H
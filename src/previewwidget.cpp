@@ -0,0 +1,123 @@
+#include "previewwidget.h"
+#include "psmovethread.h"
+#include <QPainter>
+#include <QPolygonF>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const int kPullIntervalMs = 33;		// Display rate.
+const int kRowHeight = 48;
+const int kNameWidth = 150;
+const double kRateSmoothing = 1.0;	// s
+const double kWindow = kPreviewPoints / kPreviewRate; // Seconds shown.
+const QColor kAxisColors[3] = {QColor(200, 40, 40), QColor(40, 160, 40), QColor(40, 80, 220)};
+} // namespace
+
+PreviewWidget::PreviewWidget(QWidget *parent)
+	: QWidget(parent), m_thread(nullptr), m_lastPull(0.0) {
+	connect(&m_timer, SIGNAL(timeout()), this, SLOT(pull()));
+	setToolTip("Accel (g), gyro (rad/s) and position (cm) of each streamed device over the last "
+			   "seconds; x red, y green, z blue. A flat line means the device is not moving.");
+}
+
+void PreviewWidget::setThread(const PSMoveThread *thread) { m_thread = thread; }
+
+QSize PreviewWidget::sizeHint() const {
+	return QSize(kNameWidth + 3 * 160, std::max<int>(1, (int)m_rows.size()) * kRowHeight);
+}
+
+void PreviewWidget::setTracks(QStringList names) {
+	m_rows.resize(names.size());
+	for (int ix = 0; ix < names.size(); ix++) {
+		if (m_rows[ix].name != names[ix]) m_rows[ix] = Row();
+		m_rows[ix].name = names[ix];
+	}
+	if (m_rows.empty())
+		m_timer.stop();
+	else if (!m_timer.isActive())
+		m_timer.start(kPullIntervalMs);
+	m_lastPull = lsl::local_clock();
+	updateGeometry();
+	update();
+}
+
+void PreviewWidget::pull() {
+	if (!m_thread) return;
+	double now = lsl::local_clock();
+	double elapsed = now - m_lastPull;
+	m_lastPull = now;
+	for (size_t ix = 0; ix < m_rows.size(); ix++) {
+		Row &row = m_rows[ix];
+		const PreviewTrack &track = m_thread->previewTrack((int)ix);
+		track.read(row.points);
+		uint64_t samples = track.samples();
+		// The track restarts with every stream start.
+		if (samples < row.lastSamples) row.lastSamples = 0;
+		if (elapsed > 0.0) {
+			double rate = (samples - row.lastSamples) / elapsed;
+			row.rate += (rate - row.rate) * std::min(1.0, elapsed / kRateSmoothing);
+		}
+		row.lastSamples = samples;
+	}
+	update();
+}
+
+void PreviewWidget::paintEvent(QPaintEvent *) {
+	QPainter painter(this);
+	painter.setRenderHint(QPainter::Antialiasing);
+	double now = lsl::local_clock();
+	const double plotWidth = (width() - kNameWidth) / 3.0;
+	for (size_t ix = 0; ix < m_rows.size(); ix++) {
+		const Row &row = m_rows[ix];
+		double top = ix * kRowHeight;
+		painter.setPen(palette().color(QPalette::WindowText));
+		painter.drawText(QRectF(2, top, kNameWidth - 4, kRowHeight), Qt::AlignVCenter | Qt::TextWordWrap,
+			row.name + "\n" + QString::number(row.rate, 'f', 1) + " Hz");
+		drawSparkline(painter, QRectF(kNameWidth, top + 2, plotWidth - 4, kRowHeight - 4), "Accel",
+			row.points, 0, now);
+		drawSparkline(painter, QRectF(kNameWidth + plotWidth, top + 2, plotWidth - 4, kRowHeight - 4),
+			"Gyro", row.points, 3, now);
+		drawSparkline(painter,
+			QRectF(kNameWidth + 2 * plotWidth, top + 2, plotWidth - 4, kRowHeight - 4), "Pos",
+			row.points, 6, now);
+	}
+}
+
+void PreviewWidget::drawSparkline(QPainter &painter, const QRectF &rect, const QString &label,
+	const std::vector<PreviewPoint> &points, int firstValue, double now) {
+	painter.setPen(QColor(200, 200, 200));
+	painter.drawRect(rect);
+	painter.drawText(rect.adjusted(3, 1, 0, 0), Qt::AlignLeft | Qt::AlignTop, label);
+
+	float lo = 0.0f, hi = 0.0f;
+	bool any = false;
+	for (const PreviewPoint &p : points) {
+		if (now - p.time > kWindow) continue;
+		for (int axis = 0; axis < 3; axis++) {
+			float v = p.values[firstValue + axis];
+			if (!std::isfinite(v)) continue;
+			lo = any ? std::min(lo, v) : v;
+			hi = any ? std::max(hi, v) : v;
+			any = true;
+		}
+	}
+	if (!any) return;
+	// A still signal is drawn as a flat line in the middle.
+	float span = std::max(hi - lo, 1e-3f);
+	float mid = 0.5f * (hi + lo);
+
+	for (int axis = 0; axis < 3; axis++) {
+		QPolygonF line;
+		for (const PreviewPoint &p : points) {
+			double age = now - p.time;
+			float v = p.values[firstValue + axis];
+			if (age > kWindow || !std::isfinite(v)) continue;
+			double x = rect.right() - age / kWindow * rect.width();
+			double y = rect.center().y() - (v - mid) / span * (rect.height() - 4);
+			line << QPointF(std::min(x, rect.right()), y);
+		}
+		painter.setPen(QPen(kAxisColors[axis], 1.0));
+		painter.drawPolyline(line);
+	}
+}
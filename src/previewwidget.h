@@ -0,0 +1,53 @@
+#ifndef PREVIEWWIDGET_H
+#define PREVIEWWIDGET_H
+
+#include <QTimer>
+#include <QWidget>
+#include <vector>
+#include "preview.h"
+
+class PSMoveThread;
+class QPainter;
+
+// Live sparklines of the streamed devices, one row per preview track: accel,
+// gyro and position (x red, y green, z blue), each scaled to its own range
+// over the last few seconds, next to the device's effective packet rate. The
+// widget pulls the tracks at display rate; the streaming threads never call
+// into it.
+class PreviewWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+	explicit PreviewWidget(QWidget *parent = 0);
+
+	void setThread(const PSMoveThread *thread);
+	QSize sizeHint() const override;
+
+public slots:
+	void setTracks(QStringList names);	// From PSMoveThread::previewTracksChanged().
+
+protected:
+	void paintEvent(QPaintEvent *event) override;
+
+private slots:
+	void pull();
+
+private:
+	struct Row {
+		QString name;
+		std::vector<PreviewPoint> points;
+		uint64_t lastSamples = 0;
+		double rate = 0.0;			// Packets/s, smoothed over about a second.
+	};
+	// Values firstValue..firstValue+2 of points as three lines in rect.
+	void drawSparkline(QPainter &painter, const QRectF &rect, const QString &label,
+		const std::vector<PreviewPoint> &points, int firstValue, double now);
+
+	const PSMoveThread *m_thread;
+	std::vector<Row> m_rows;			// Indexed like the tracks.
+	QTimer m_timer;
+	double m_lastPull;
+};
+
+#endif // PREVIEWWIDGET_H
@@ -0,0 +1,163 @@
+#include "psmoveconfig.h"
+#include "aggregatesource.h"
+#include "psmservicesource.h"
+#include "remotesource.h"
+#include "threadutil.h"
+#include <QDebug>
+#include <QFile>
+#include <QXmlStreamReader>
+
+bool loadConfig(const QString &filename, PSMoveConfig &config) {
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qDebug() << "Could not load XML from file " << filename;
+		return false;
+	}
+	QXmlStreamReader xml(&file);
+	while (!xml.atEnd() && !xml.hasError()) {
+		xml.readNext();
+		if (!xml.isStartElement() || xml.name() == "settings") continue;
+
+		QString elname = xml.name().toString();
+		QString text = xml.readElementText().trimmed();
+		if (elname == "server-ip")
+			config.serverAddress = text;
+		else if (elname == "server-port")
+			config.serverPort = text;
+		else if (elname == "reconnect")
+			config.reconnect = text == "true";
+		else if (elname == "sampling-rate")
+			config.samplingRate = text.toDouble();
+		else if (elname == "resample")
+			config.resample = text == "true";
+		else if (elname == "combined")
+			config.combined = text == "true";
+		else if (elname == "compact")
+			config.compact = text == "true";
+		else if (elname == "source")
+			config.simulate = text == "simulator";
+		else if (elname == "endpoints")
+			config.endpoints = text.split(",", QString::SkipEmptyParts);
+		else if (elname == "sim-controllers")
+			config.sim.controllers = text.toInt();
+		else if (elname == "sim-rate")
+			config.sim.rate = text.toDouble();
+		else if (elname == "sim-drop-rate")
+			config.sim.dropRate = text.toDouble();
+		else if (elname == "sim-burst-rate")
+			config.sim.burstRate = text.toDouble();
+		else if (elname == "sim-burst-length-ms")
+			config.sim.burstLength = text.toDouble() / 1000.0;
+		else if (elname == "sim-hotplug-period")
+			config.sim.hotplugPeriod = text.toDouble();
+		else if (elname == "sim-outage-period")
+			config.sim.outagePeriod = text.toDouble();
+		else if (elname == "sim-outage-length-ms")
+			config.sim.outageLength = text.toDouble() / 1000.0;
+		else if (elname == "wait-mode")
+			config.waitMode = text == "spin" ? WaitMode::Spin : WaitMode::Adaptive;
+		else if (elname == "publisher-threads")
+			config.publisherThreads = text.toInt();
+		else if (elname == "publisher-cpus")
+			config.publisherCpus = parseCpuList(text);
+		else if (elname == "realtime")
+			config.realtime = text == "true";
+		else if (elname == "realtime-priority")
+			config.realtimePriority = text.toInt();
+		else if (elname == "acquisition-cpu")
+			config.acquisitionCpu = text.isEmpty() ? -1 : text.toInt();
+		else if (elname == "chunk-size")
+			config.chunkSize = text.toInt();
+		else if (elname == "chunk-max-latency-ms")
+			config.chunkMaxLatency = text.toDouble() / 1000.0;
+		else if (elname == "device-clock")
+			config.deviceClock = text != "false";
+		else if (elname == "backup-dir")
+			config.backupDir = text;
+		else if (elname == "backup-size-mb")
+			config.backupSizeMB = text.toInt();
+		else if (elname == "replay-speed")
+			config.replaySpeed = text.toDouble();
+		else if (elname == "replay-loop")
+			config.replayLoop = text == "true";
+		else if (elname == "streams")
+			parseStreamList(text, config);
+		else if (elname == "devices")
+			config.devices = text.split(",", QString::SkipEmptyParts);
+	}
+	if (xml.hasError()) {
+		qDebug() << "Config file parse error " << xml.error() << ": " << xml.errorString();
+		return false;
+	}
+	return true;
+}
+
+bool parseStreamList(const QString &list, PSMoveConfig &config) {
+	bool doIMU = false, doIMU_raw = false, doPos = false, doPos_raw = false, doEvents = false,
+		 doKinematics = false;
+	for (const QString &item : list.split(",", QString::SkipEmptyParts)) {
+		QString name = item.trimmed().toLower();
+		if (name == "imu")
+			doIMU = true;
+		else if (name == "imu_raw")
+			doIMU_raw = true;
+		else if (name == "pose")
+			doPos = true;
+		else if (name == "pose_raw")
+			doPos_raw = true;
+		else if (name == "events")
+			doEvents = true;
+		else if (name == "kinematics")
+			doKinematics = true;
+		else {
+			qDebug() << "Unknown stream" << name << "; expected imu, imu_raw, pose, pose_raw, events or kinematics.";
+			return false;
+		}
+	}
+	config.doIMU = doIMU;
+	config.doIMU_raw = doIMU_raw;
+	config.doPos = doPos;
+	config.doPos_raw = doPos_raw;
+	config.doEvents = doEvents;
+	config.doKinematics = doKinematics;
+	return true;
+}
+
+static ControllerSource *createAggregateSource(const PSMoveConfig &config) {
+	AggregateSource *source = new AggregateSource();
+	bool haveService = false;
+	for (const QString &item : config.endpoints) {
+		QString endpoint = item.trimmed();
+		if (endpoint == "simulator" || endpoint == "simulator@worker") {
+			// Distinct serials for each simulated endpoint.
+			SimulatorSettings sim = config.sim;
+			sim.seed += 256 * (unsigned int)source->endpointCount();
+			if (endpoint == "simulator")
+				source->addEndpoint(endpoint, new SimulatedSource(sim));
+			else
+				source->addEndpoint(endpoint,
+					new RemoteSource(endpoint, QStringList() << "simulator" << QString::number(sim.seed)
+															 << QString::number(sim.controllers)
+															 << QString::number(sim.rate)));
+			continue;
+		}
+		QString address = endpoint.section(':', 0, 0);
+		QString port = endpoint.section(':', 1);
+		if (port.isEmpty()) port = config.serverPort;
+		// PSMoveClient_CAPI keeps a single global connection, so the other
+		// services each get a worker process.
+		if (haveService)
+			source->addEndpoint(endpoint, new RemoteSource(endpoint, QStringList() << address << port));
+		else
+			source->addEndpoint(endpoint, new PSMServiceSource(address.toStdString(), port.toStdString()));
+		haveService = true;
+	}
+	return source;
+}
+
+ControllerSource *createControllerSource(const PSMoveConfig &config) {
+	if (!config.endpoints.isEmpty()) return createAggregateSource(config);
+	if (config.simulate) return new SimulatedSource(config.sim);
+	return new PSMServiceSource(
+		config.serverAddress.toStdString(), config.serverPort.toStdString());
+}
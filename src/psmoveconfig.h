@@ -0,0 +1,59 @@
+#ifndef PSMOVECONFIG_H
+#define PSMOVECONFIG_H
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "controllersource.h"
+#include "pollwaiter.h"
+#include "simulatedsource.h"
+
+// Everything psmove_config.cfg can set. Shared by the GUI and headless mode;
+// members keep their defaults for elements missing from the file.
+struct PSMoveConfig {
+	QString serverAddress = PSMOVESERVICE_DEFAULT_ADDRESS;
+	QString serverPort = PSMOVESERVICE_DEFAULT_PORT;
+	bool reconnect = false;				// Retry with backoff instead of giving up on the service.
+	double samplingRate = 75.0;
+	bool resample = false;				// Push at samplingRate instead of as captured.
+	bool combined = false;				// One wide IMU and pose stream for all controllers (implies resample).
+	bool compact = false;				// int16 outlets with per-channel scale and offset.
+	bool simulate = false;				// Use SimulatedSource instead of PSMoveService.
+	SimulatorSettings sim;
+	// Several sources in one process, each "address[:port]" or "simulator";
+	// empty uses the single source above.
+	QStringList endpoints;
+	WaitMode waitMode = WaitMode::Adaptive;
+	int publisherThreads = 1;
+	std::vector<int> publisherCpus;
+	bool realtime = false;				// SCHED_FIFO, locked memory and prefaulted stacks.
+	int realtimePriority = 80;			// Of the acquisition thread; publishers get one less.
+	int acquisitionCpu = -1;			// CPU to pin the acquisition thread to; -1 leaves it free.
+	int chunkSize = 1;
+	double chunkMaxLatency = 0.01;		// Seconds.
+	bool deviceClock = true;
+	QString backupDir;					// Empty: no local backup log.
+	int backupSizeMB = 1024;			// Preallocated size of each backup log.
+	double replaySpeed = 1.0;			// Replay pace; 0 is as fast as possible.
+	bool replayLoop = false;			// Start a replay over at the end of its log.
+	// Stream selection. The GUI takes these from its widgets instead.
+	bool doIMU = true;
+	bool doIMU_raw = true;
+	bool doPos = true;
+	bool doPos_raw = true;
+	bool doEvents = false;				// PSMoveEvents: button, trigger and battery changes.
+	bool doKinematics = false;			// PSMoveKinematics: velocities and gravity-free acceleration.
+	QStringList devices;				// Controller ids or serials; empty streams every controller.
+};
+
+// Reads filename into config. Returns false if the file cannot be opened or
+// is not well-formed; elements read before an error are kept.
+bool loadConfig(const QString &filename, PSMoveConfig &config);
+
+// Parses a stream list such as "imu,pose_raw,events,kinematics" into the do* flags.
+bool parseStreamList(const QString &list, PSMoveConfig &config);
+
+// The controller source config asks for; the caller takes ownership.
+ControllerSource *createControllerSource(const PSMoveConfig &config);
+
+#endif // PSMOVECONFIG_H
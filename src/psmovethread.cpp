@@ -1,387 +1,1117 @@
 #include "psmovethread.h"
+#include "psmservicesource.h"
+#include "threadutil.h"
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 
+// Seconds between samples of the PSMoveStats stream.
+const double kStatsInterval = 1.0;
+// Packets each device can buffer between capture and push.
+const size_t kSampleRingCapacity = 256;
+// Control commands queued for run(); it takes one per loop pass.
+const size_t kCommandQueueCapacity = 16;
+// Upper bound on publisher threads (captureSamples() keeps one bit each).
+const int kMaxPublisherThreads = 64;
+// Reconnect backoff: first retry after kReconnectMinDelay s, doubling up to kReconnectMaxDelay s.
+const double kReconnectMinDelay = 0.25;
+const double kReconnectMaxDelay = 8.0;
+// Stack the real-time threads fault in before their first deadline.
+const size_t kPrefaultStackBytes = 512 * 1024;
+// Seconds a hot-plugged controller may take to send its first packet before
+// its outlets are created anyway.
+const double kStreamStartTimeout = 2.0;
+// Seconds to wait for requestDeviceLists() to be answered before asking again.
+const double kListQueryTimeout = 3.0;
+// m_previewKeys entry of a track no device holds.
+const DeviceKey kNoPreviewKey = ~DeviceKey(0);
+
 enum runPhase {
 	phase_startLink,
 	phase_scanForDevices,
 	phase_waitForControllers,
 	phase_createOutlets,
 	phase_transferData,
+	phase_reconnect,
 	phase_shutdown
 };
 
-QString GetControllerString(PSMController *pctrl) {
-	QString devString = QString::number(pctrl->ControllerID);
-	devString.append(":");
-	devString.append(pctrl->ControllerState.PSMoveState.DeviceSerial);
-	return devString;
-}
-
 void PrintData() {
 	double clk = lsl::local_clock();
 	qDebug() << std::fmod(1000.0 * clk, 1000) << ", ";
 }
 
-void handle_acquire_controller(const PSMResponseMessage *response, void *userdata) {
-	PSMoveThread *thisPtr = reinterpret_cast<PSMoveThread *>(userdata);
-
-	if (response->result_code == PSMResult_Success) {
-		thisPtr->m_bControllerStreamActive = true;
-		// thisPtr->m_lastControllerSeqNum = -1;
-		// Wait for the first controller packet to show up...
-	}
-}
-
 PSMoveThread::PSMoveThread(QObject *parent)
-	: QThread(parent), abort(false), m_srate(lsl::IRREGULAR_RATE), m_bGoOutlets(false),
+	: QThread(parent), m_commands(kCommandQueueCapacity), m_abort(false), m_bGoOutlets(false),
 	  m_pushCounter(0) {
 	// Any other initializations
 }
 
 PSMoveThread::~PSMoveThread() {
-	mutex.lock();
-	abort = true;		 // Tell run() loop to stop.
-	condition.wakeOne(); // In case thread is sleeping
-	mutex.unlock();
+	m_abort = true; // Tell run() loop to stop.
 	wait();
 }
 
-void PSMoveThread::initPSMS(double srate) {
-	QMutexLocker locker(&mutex);
-	// Set member variables passed in as arguments.
-	this->m_srate = srate;
+void PSMoveThread::initPSMS(double srate, WaitMode waitMode, ControllerSource *source) {
+	this->m_request.srate = srate;
 
 	if (!isRunning()) {
+		// Nothing consumes the queue now; drop what a previous run left.
+		while (m_commands.front()) m_commands.pop();
+		this->m_settings = std::make_shared<const ControlSettings>(m_request);
+		this->m_bGoOutlets = false;
+		this->m_bStreamsRequested = false;
+		this->m_abort = false;
+		this->m_pollWaiter = PollWaiter(waitMode);
+		this->m_source.reset(source ? source : new PSMServiceSource());
 		start(HighPriority);
 	} else {
+		delete source;
 		qDebug() << "PSMThread is already running. Disconnecting...";
-		this->abort = true;
+		this->m_abort = true;
+	}
+}
+
+bool PSMoveThread::postCommand(CommandType type) {
+	Command *cmd;
+	while (!(cmd = m_commands.beginWrite())) {
+		// run() takes one command per iteration; a full queue drains quickly.
+		if (!isRunning()) return false;
+		QThread::yieldCurrentThread();
+	}
+	cmd->type = type;
+	if (type == CommandType::StopStreams)
+		cmd->settings.reset();
+	else
+		cmd->settings = std::make_shared<const ControlSettings>(m_request);
+	m_commands.commitWrite();
+	return true;
+}
+
+void PSMoveThread::processCommand() {
+	const Command *cmd = m_commands.front();
+	if (!cmd) return;
+	switch (cmd->type) {
+	case CommandType::Configure:
+		m_settings = cmd->settings;
+		break;
+	case CommandType::StartStreams:
+		m_settings = cmd->settings;
+		m_bStreamAll = m_settings->streamDevices.empty();
+		m_streamDeviceIndices = m_bStreamAll ? m_deviceIndices : m_settings->streamDevices;
+		m_bGoOutlets = true;
+		break;
+	case CommandType::StopStreams:
+		m_bGoOutlets = false;
+		break;
 	}
+	m_commands.pop();
 }
 
-void PSMoveThread::startStreams(
-	QStringList streamDeviceList, bool doIMU, bool doIMU_raw, bool doPos, bool doPos_raw) {
+void PSMoveThread::startStreams(QStringList streamDeviceList, bool doIMU, bool doIMU_raw,
+	bool doPos, bool doPos_raw, int chunkSize, double chunkMaxLatency, bool useDeviceClock,
+	bool resample, bool combined, bool compact, bool events, bool kinematics) {
 	// Responds to event on main thread.
-	std::vector<uint32_t> newStreamDeviceIndices;
-	if (!this->m_bGoOutlets) {
-		if (streamDeviceList.length() == 0) {
-			// No devices were selected. Stream all devices.
-			newStreamDeviceIndices = m_deviceIndices;
-		} else {
-			for (QStringList::iterator it = streamDeviceList.begin(); it != streamDeviceList.end();
-				 ++it) {
-				QStringList pieces = it->split(":");
-				QString strIx = pieces.value(0);
-				newStreamDeviceIndices.push_back(strIx.toInt());
-			}
+	if (!isRunning()) {
+		qDebug() << "PSMThread is not running; connect first.";
+		return;
+	}
+	if (m_bStreamsRequested) {
+		if (postCommand(CommandType::StopStreams)) m_bStreamsRequested = false;
+		return;
+	}
+	std::vector<DeviceKey> newStreamDeviceIndices;
+	for (QStringList::iterator it = streamDeviceList.begin(); it != streamDeviceList.end(); ++it) {
+		QStringList pieces = it->split(":");
+		DeviceKey key;
+		if (parseDeviceKey(pieces.value(0), key)) newStreamDeviceIndices.push_back(key);
+	}
+	m_request.doIMU = doIMU;
+	m_request.doIMU_raw = doIMU_raw;
+	m_request.doPos = doPos;
+	m_request.doPos_raw = doPos_raw;
+	m_request.chunkSize = std::max(chunkSize, 1);
+	m_request.chunkMaxLatency = chunkMaxLatency;
+	m_request.deviceClock = useDeviceClock;
+	m_request.resample = resample;
+	m_request.combined = combined;
+	m_request.compact = compact;
+	m_request.events = events;
+	m_request.kinematics = kinematics;
+	// No devices were selected: the thread streams all it has found.
+	m_request.streamDevices = newStreamDeviceIndices;
+	// Let the running thread know that it's time to start the outlets.
+	if (postCommand(CommandType::StartStreams)) m_bStreamsRequested = true;
+}
+
+void PSMoveThread::setPublisherThreads(int publisherThreads, const std::vector<int> &cpus) {
+	m_request.publisherThreads = std::max(publisherThreads, 0);
+	m_request.publisherCpus = cpus;
+	if (isRunning()) postCommand(CommandType::Configure);
+}
+
+void PSMoveThread::setReconnect(bool reconnect) {
+	m_request.reconnect = reconnect;
+	if (isRunning()) postCommand(CommandType::Configure);
+}
+
+void PSMoveThread::setBackup(const QString &dir, qint64 bytes) {
+	m_request.backupDir = dir;
+	m_request.backupBytes = std::max(bytes, (qint64)0);
+	if (isRunning()) postCommand(CommandType::Configure);
+}
+
+void PSMoveThread::setRealtime(bool enabled, int priority, int cpu) {
+	m_request.realtime = enabled;
+	m_request.rtPriority = priority;
+	m_request.acquisitionCpu = cpu;
+	if (isRunning()) postCommand(CommandType::Configure);
+}
+
+void PSMoveThread::setPreview(bool enabled) {
+	m_request.preview = enabled;
+	if (isRunning()) postCommand(CommandType::Configure);
+}
+
+void PSMoveThread::enterRealtime() {
+	bool enabled = m_settings->realtime;
+	int priority = m_settings->rtPriority;
+	int cpu = m_settings->acquisitionCpu;
+	m_activeRtPriority = 0;
+	if (!enabled) return;
+
+	if (cpu >= 0 && !pinCurrentThread(cpu)) qDebug() << "Could not pin acquisition to CPU" << cpu;
+	if (setRealtimePriority(priority))
+		m_activeRtPriority = priority;
+	else
+		qDebug() << "Could not get real-time priority" << priority << "; check rtprio limits.";
+	if (!lockProcessMemory()) qDebug() << "Could not lock memory; check memlock limits.";
+	prefaultStack(kPrefaultStackBytes);
+	qDebug() << "Real-time mode: priority" << m_activeRtPriority << ", CPU" << cpu;
+}
+
+QStringList PSMoveThread::latencySummary() const {
+	std::vector<uint64_t> wake, push;
+	double wakeMax = 0.0, pushMax = 0.0;
+	m_wakeLatency.addTo(wake, wakeMax);
+	m_pushLatency.addTo(push, pushMax);
+	return QStringList() << "Wake latency: " + LatencyHistogram::summary(wake, wakeMax)
+						 << "Push latency: " + LatencyHistogram::summary(push, pushMax);
+}
+
+void PSMoveThread::mergePushLatency() {
+	// Sized once, so addTo() does not allocate.
+	m_pushCounts.resize(LatencyHistogram::kBuckets);
+	std::fill(m_pushCounts.begin(), m_pushCounts.end(), 0);
+	double pushMax = 0.0;
+	for (auto &counters : m_deviceCounters) counters->pushLatency.addTo(m_pushCounts, pushMax);
+	m_pushLatency.assign(m_pushCounts, pushMax);
+}
+
+bool PSMoveThread::connectToPSMS() { return m_source->connect(); }
+
+void PSMoveThread::beginReconnect() {
+	qDebug() << "Lost PSMoveService; reconnecting.";
+	emit reconnecting(true);
+	m_reconnectDelay = kReconnectMinDelay;
+	m_nextReconnect = lsl::local_clock() + m_reconnectDelay;
+}
+
+void PSMoveThread::resumeStreams() {
+	// The device views of the old connection are gone.
+	if (m_pendingBatch.valid()) adoptDeviceBatch();
+	std::vector<DeviceKey> ids;
+	for (size_t dev_ix = m_devices.size(); dev_ix-- > 0;) {
+		DeviceStream &dev = *m_devices[dev_ix];
+		if (!bindView(dev)) {
+			retireDevice(dev_ix);
+			continue;
 		}
+		// Whatever the view holds now predates the restart.
+		dev.lastSeqNum = outputSequence(dev);
+		ids.push_back(dev.id);
 	}
-	// let the running thread know that it's time to toggle the outlets.
-	this->mutex.lock();
-	this->m_bIMU = doIMU;
-	this->m_bIMU_raw = doIMU_raw;
-	this->m_bPos = doPos;
-	this->m_bPos_raw = doPos_raw;
-	this->m_bGoOutlets = !this->m_bGoOutlets;
-	this->m_streamDeviceIndices = newStreamDeviceIndices;
-	this->mutex.unlock();
-}
-
-bool PSMoveThread::connectToPSMS() {
-	PSMResult res = PSM_Initialize(
-		PSMOVESERVICE_DEFAULT_ADDRESS, PSMOVESERVICE_DEFAULT_PORT, PSM_DEFAULT_TIMEOUT);
-	if (res != PSMResult_Success) {
-		qDebug() << "Unable to init PSMove Client";
-		return false;
+	double now = lsl::local_clock();
+	for (auto &ctrl : m_starting) {
+		if (!deviceSequence(ctrl.id, ctrl.seqAtStart)) ctrl.seqAtStart = -1;
+		ctrl.since = now;
+		ids.push_back(ctrl.id);
 	}
+	startDeviceStreams(ids);
+	// The trackers may have been recalibrated while the service was down.
+	if (m_trackerOutlet) publishTrackers();
+	// Pick up controllers that came or went during the outage. A query still
+	// in flight went down with the old connection.
+	m_bListRequested = false;
+	m_bDeviceSetDirty = true;
+}
 
-	return true;
+bool PSMoveThread::refreshControllerList() {
+	DeviceLists lists;
+	if (!m_source->getControllerList(lists.controllers, lists.controllerTypes)) return false;
+	// A service without HMD support just has none.
+	if (!m_source->getHmdList(lists.hmds, lists.hmdTypes)) {
+		lists.hmds.clear();
+		lists.hmdTypes.clear();
+	}
+	return applyDeviceLists(lists);
 }
 
-void PSMoveThread::refreshControllerList() {
-	auto list = new PSMControllerList;
-	PSMResult res = PSM_GetControllerList(list, PSM_DEFAULT_TIMEOUT);
-	if (res == PSMResult_Success) {
+bool PSMoveThread::applyDeviceLists(const DeviceLists &lists) {
+	// The kind comes from the list: the views of devices not yet streamed
+	// have no valid type.
+	std::vector<DeviceKey> newControllerIndices;
+	std::map<DeviceKey, DeviceKind> kinds;
+	for (size_t ix = 0; ix < lists.controllers.size(); ix++) {
+		DeviceKind kind;
+		if (!controllerKind(lists.controllerTypes[ix], kind)) continue;
+		DeviceKey key = controllerKey(lists.controllers[ix]);
+		newControllerIndices.push_back(key);
+		kinds[key] = kind;
+	}
+	for (size_t ix = 0; ix < lists.hmds.size(); ix++) {
+		if (lists.hmdTypes[ix] != PSMHmd_Morpheus) continue;
+		DeviceKey key = hmdKey(lists.hmds[ix]);
+		newControllerIndices.push_back(key);
+		kinds[key] = DeviceKind::Morpheus;
+	}
+
+	if (newControllerIndices != m_deviceIndices || kinds != m_deviceKinds) {
+		m_deviceIndices = newControllerIndices;
+		m_deviceKinds = kinds;
 		QStringList controllerList;
-		std::vector<uint32_t> newControllerIndices;
-		for (size_t i = 0; i < list->count; i++) {
-			PSMController *p_controller = PSM_GetController(list->controller_id[i]);
-			newControllerIndices.push_back(p_controller->ControllerID);
-			controllerList << GetControllerString(p_controller);
+		for (DeviceKey key : m_deviceIndices) controllerList << deviceString(key);
+		emit deviceListUpdated(controllerList);
+		return true;
+	}
+	return false;
+}
+
+void PSMoveThread::acquireControllers() {
+	m_active = streamSettings();
+	startDeviceStreams(m_streamDeviceIndices);
+}
+
+QString PSMoveThread::deviceString(DeviceKey key) {
+	QString devString = deviceKeyString(key);
+	devString.append(":");
+	if (isHmdKey(key)) {
+		devString.append("Morpheus");
+		return devString;
+	}
+	DeviceKind kind = DeviceKind::PSMove;
+	deviceKind(key, kind);
+	PSMController *pctrl = m_source->getController(deviceId(key));
+	if (!pctrl) return devString;
+	if (kind == DeviceKind::DualShock4)
+		devString.append(pctrl->ControllerState.PSDS4State.DeviceSerial);
+	else if (kind == DeviceKind::Navi)
+		devString.append("Navi"); // Pairs through its PSMove controller; no serial of its own.
+	else
+		devString.append(pctrl->ControllerState.PSMoveState.DeviceSerial);
+	return devString;
+}
+
+bool PSMoveThread::deviceKind(DeviceKey key, DeviceKind &kind) {
+	auto it = m_deviceKinds.find(key);
+	if (it == m_deviceKinds.end()) return false;
+	kind = it->second;
+	return true;
+}
+
+bool PSMoveThread::deviceSequence(DeviceKey key, int &seq) {
+	if (isHmdKey(key)) {
+		PSMHeadMountedDisplay *hmd = m_source->getHmd(deviceId(key));
+		if (hmd) seq = hmd->OutputSequenceNum;
+		return hmd != nullptr;
+	}
+	PSMController *pctrl = m_source->getController(deviceId(key));
+	if (pctrl) seq = pctrl->OutputSequenceNum;
+	return pctrl != nullptr;
+}
+
+bool PSMoveThread::bindView(DeviceStream &dev) {
+	// The id may have been reused by another kind of device since.
+	DeviceKind kind;
+	if (!deviceKind(dev.id, kind) || kind != dev.kind) return false;
+	bool hmd = isHmdKey(dev.id);
+	dev.view = hmd ? nullptr : m_source->getController(deviceId(dev.id));
+	dev.hmdView = hmd ? m_source->getHmd(deviceId(dev.id)) : nullptr;
+	return true;
+}
+
+void PSMoveThread::startDeviceStreams(const std::vector<DeviceKey> &keys) {
+	std::vector<PSMControllerID> controllers;
+	std::vector<PSMHmdID> hmds;
+	for (DeviceKey key : keys) {
+		DeviceKind kind;
+		if (!deviceKind(key, kind) || !hasStreams(kind, m_active)) continue;
+		if (isHmdKey(key))
+			hmds.push_back(deviceId(key));
+		else
+			controllers.push_back(deviceId(key));
+	}
+	m_source->startControllerStreams(controllers, m_active.flags);
+	if (!hmds.empty()) m_source->startHmdStreams(hmds, m_active.flags);
+}
+
+void PSMoveThread::stopDeviceStream(DeviceKey key) {
+	if (isHmdKey(key))
+		m_source->stopHmdStreams(std::vector<PSMHmdID>(1, deviceId(key)));
+	else
+		m_source->stopControllerStreams(std::vector<PSMControllerID>(1, deviceId(key)));
+}
+
+bool PSMoveThread::hasStreams(DeviceKind kind, const StreamSettings &settings) {
+	return ((settings.doIMU || settings.doIMU_raw) && hasIMU(kind)) ||
+		((settings.doPos || settings.doPos_raw) && hasPose(kind)) ||
+		(settings.events && eventPacker(kind)) || (settings.kinematics && kinematicsReader(kind));
+}
+
+PSMoveThread::StreamSettings PSMoveThread::streamSettings() {
+	const ControlSettings &request = *m_settings;
+	StreamSettings settings;
+	settings.doIMU = request.doIMU;
+	settings.doIMU_raw = request.doIMU_raw;
+	settings.doPos = request.doPos;
+	settings.doPos_raw = request.doPos_raw;
+	// Combined streams align the controllers on the resampling grid.
+	settings.combined = request.combined && request.srate > 0.0;
+	settings.resample = (request.resample || settings.combined) && request.srate > 0.0;
+	settings.srate = settings.resample ? request.srate : lsl::IRREGULAR_RATE;
+	settings.compact = request.compact;
+	settings.events = request.events;
+	settings.kinematics = request.kinematics;
+	settings.preview = request.preview;
+	settings.chunkSize = request.chunkSize;
+	settings.deviceClock = request.deviceClock;
+	settings.chunkMaxLatency = request.chunkMaxLatency;
+
+	// Controller flags
+	settings.flags = 0;
+	if (settings.doIMU) settings.flags |= PSMStreamFlags_includeCalibratedSensorData;
+	if (settings.doIMU_raw) settings.flags |= PSMStreamFlags_includeRawSensorData;
+	if (settings.doPos) settings.flags |= PSMStreamFlags_includePositionData;
+	if (settings.doPos_raw) settings.flags |= PSMStreamFlags_includeRawTrackerData;
+	// Derived from the pose and the calibrated accelerometer.
+	if (settings.kinematics)
+		settings.flags |= PSMStreamFlags_includePositionData | PSMStreamFlags_includeCalibratedSensorData;
+
+	// Each device has up to 2 streams: IMU and Position.
+	settings.imuChanLabels = imuChannelLabels(settings.doIMU, settings.doIMU_raw);
+	settings.posChanLabels = posChannelLabels(settings.doPos, settings.doPos_raw);
+	return settings;
+}
+
+std::unique_ptr<DeviceStream> PSMoveThread::buildDevice(DeviceKey id, DeviceKind kind,
+	const QString &name, const StreamSettings &settings) {
+	// The per-kind IMU layout; the combined stream only holds PSMove controllers.
+	QStringList imuChanLabels = imuChannelLabels(settings.doIMU, settings.doIMU_raw, hasMag(kind));
+	const QStringList &posChanLabels = settings.posChanLabels;
+	std::unique_ptr<DeviceStream> devPtr(new DeviceStream);
+	DeviceStream &dev = *devPtr;
+	dev.counters.reset(new DeviceCounters);
+	dev.name = name;
+	dev.id = id;
+	dev.kind = kind;
+	dev.ring.reset(new SampleRing<ControllerSample>(kSampleRingCapacity));
+	dev.timeSource = deviceTimeSource(kind, settings.doIMU, settings.doIMU_raw);
+	dev.readDeviceTime = deviceTimeReader(kind, dev.timeSource);
+	dev.mapDeviceClock = settings.deviceClock && dev.timeSource != DeviceTimeSource::None;
+	dev.fillIMU = imuFiller(kind, settings.doIMU, settings.doIMU_raw);
+	dev.fillPos = posFiller(kind, settings.doPos, settings.doPos_raw);
+	dev.imuChannels = imuChanLabels.size();
+	dev.posChannels = posChanLabels.size();
+	dev.chunkCapacity = settings.chunkSize;
+	dev.imuChunk.assign(settings.chunkSize * imuChanLabels.size(), 0.0f);
+	dev.posChunk.assign(settings.chunkSize * posChanLabels.size(), 0.0f);
+	dev.timeChunk.assign(settings.chunkSize, 0.0);
+	dev.stamps.assign(settings.chunkSize, 0.0);
+	dev.log = settings.log.get();
+	if (settings.compact) {
+		dev.compact = true;
+		dev.imuQuantizer = Quantizer(imuChanLabels);
+		dev.posQuantizer = Quantizer(posChanLabels);
+		dev.imuChunk16.assign(dev.imuChunk.size(), 0);
+		dev.posChunk16.assign(dev.posChunk.size(), 0);
+	}
+	lsl::channel_format_t format = settings.compact ? lsl::cf_int16 : lsl::cf_float32;
+	if (settings.resample && (dev.fillIMU || dev.fillPos)) {
+		int imuChannels = dev.fillIMU ? imuChanLabels.size() : 0;
+		int posChannels = dev.fillPos ? posChanLabels.size() : 0;
+		// The pose quaternion leads the position block.
+		int quatOffset = dev.fillPos && settings.doPos ? imuChannels : -1;
+		dev.resampler.reset(new Resampler(imuChannels + posChannels, quatOffset, settings.srate));
+		dev.resampleInput.assign(imuChannels + posChannels, 0.0f);
+	}
+
+	QString prefix = streamPrefix(kind);
+	const char *model = deviceModel(kind);
+	QString devStr = deviceKeyString(id);
+	devStr += "_";
+	if (settings.events && eventPacker(kind)) {
+		// Irregular: a sample only when a button or analog value changes.
+		QStringList buttonLabels = eventButtonLabels(kind);
+		QStringList axisLabels = eventAxisLabels(kind);
+		dev.packEvents = eventPacker(kind);
+		dev.eventButtons = buttonLabels.size();
+		dev.eventAxes = axisLabels.size();
+		dev.eventSample.assign(dev.eventButtons + dev.eventAxes, 0);
+		QString event_stream_id = prefix + "Events" + name;
+		lsl::stream_info eventInfo((prefix + "Events").toStdString(), "Markers",
+			dev.eventButtons + dev.eventAxes, lsl::IRREGULAR_RATE, lsl::cf_int16,
+			event_stream_id.toStdString());
+		eventInfo.desc()
+			.append_child("acquisition")
+			.append_child_value("manufacturer", "Sony")
+			.append_child_value("model", model);
+		lsl::xml_element eventInfoChannels = eventInfo.desc().append_child("channels");
+		for (const QString &label : buttonLabels)
+			eventInfoChannels.append_child("channel")
+				.append_child_value("label", (devStr + label).toStdString())
+				.append_child_value("type", "Button")
+				.append_child_value("unit", "bool");
+		for (const QString &label : axisLabels)
+			eventInfoChannels.append_child("channel")
+				.append_child_value("label", (devStr + label).toStdString())
+				.append_child_value("type", label.toStdString())
+				.append_child_value("unit", "raw");
+		dev.eventOutlet.reset(new lsl::stream_outlet(eventInfo));
+		if (dev.log) dev.eventLog = dev.log->addStream(eventInfo);
+	}
+
+	if (settings.kinematics && kinematicsReader(kind)) {
+		// Irregular: one sample per packet, even when the other streams are resampled.
+		QStringList labels = kinematicsChannelLabels();
+		dev.readKinematics = kinematicsReader(kind);
+		dev.kinematicsChunk.assign(kKinematicsBatchCapacity * kKinematicsChannels, 0.0f);
+		dev.kinematicsStamps.assign(kKinematicsBatchCapacity, 0.0);
+		QString kinematics_stream_id = prefix + "Kinematics" + name;
+		lsl::stream_info kinematicsInfo((prefix + "Kinematics").toStdString(), "MoCap",
+			kKinematicsChannels, lsl::IRREGULAR_RATE, lsl::cf_float32,
+			kinematics_stream_id.toStdString());
+		kinematicsInfo.desc()
+			.append_child("acquisition")
+			.append_child_value("manufacturer", "Sony")
+			.append_child_value("model", model);
+		kinematicsInfo.desc()
+			.append_child("derivation")
+			.append_child_value("frame", "world")
+			.append_child_value("velocity", "backward difference of Pos")
+			.append_child_value("acceleration", "difference of the last two velocities")
+			.append_child_value("angular_velocity", "from the last two Pos.orient")
+			.append_child_value("linear_acceleration", "Accel rotated by Pos.orient, less 1 g along +y");
+		lsl::xml_element kinematicsChannels = kinematicsInfo.desc().append_child("channels");
+		for (const QString &label : labels) {
+			QString type, unit;
+			kinematicsChannelInfo(label, type, unit);
+			kinematicsChannels.append_child("channel")
+				.append_child_value("label", (devStr + label).toStdString())
+				.append_child_value("type", type.toStdString())
+				.append_child_value("unit", unit.toStdString());
+		}
+		dev.kinematicsOutlet.reset(new lsl::stream_outlet(kinematicsInfo));
+		if (dev.log) dev.kinematicsLog = dev.log->addStream(kinematicsInfo);
+	}
+
+	// The CombinedStream has the outlets.
+	if (settings.combined && kind == DeviceKind::PSMove) return devPtr;
+
+	if (dev.fillIMU) {
+		lsl::stream_info imuInfo((prefix + "IMU").toStdString(), "MoCap", imuChanLabels.size(),
+			settings.srate, format, name.toStdString());
+		// Append device meta-data
+		imuInfo.desc()
+			.append_child("acquisition")
+			.append_child_value("manufacturer", "Sony")
+			.append_child_value("model", model);
+		// Append channel info
+		lsl::xml_element imuInfoChannels = imuInfo.desc().append_child("channels");
+		for (int imu_ix = 0; imu_ix < imuChanLabels.size(); imu_ix++) {
+			QString chLabel = devStr;
+			chLabel.append(imuChanLabels[imu_ix]);
+			lsl::xml_element channel = imuInfoChannels.append_child("channel")
+				.append_child_value("label", chLabel.toStdString())
+				.append_child_value("type", "IMU")
+				.append_child_value("unit", "various");
+			if (settings.compact) Quantizer::describe(channel, dev.imuQuantizer.encoding(imu_ix));
 		}
+		dev.imuOutlet.reset(new lsl::stream_outlet(imuInfo));
+		if (dev.log) dev.imuLog = dev.log->addStream(imuInfo);
+	}
+	if (dev.fillPos) {
+		QString pos_stream_id = prefix + "Position" + name;
+		lsl::stream_info posInfo((prefix + "Position").toStdString(), "MoCap", posChanLabels.size(),
+			settings.srate, format, pos_stream_id.toStdString());
+		// Append device meta-data
+		posInfo.desc()
+			.append_child("acquisition")
+			.append_child_value("manufacturer", "Sony")
+			.append_child_value("model", model);
+		// Append channel info
+		lsl::xml_element posInfoChannels = posInfo.desc().append_child("channels");
+		for (int pos_ix = 0; pos_ix < posChanLabels.size(); pos_ix++) {
+			QString chLabel = devStr;
+			chLabel.append(posChanLabels[pos_ix]);
+			lsl::xml_element channel = posInfoChannels.append_child("channel")
+				.append_child_value("label", chLabel.toStdString())
+				.append_child_value("type", "Position")
+				.append_child_value("unit", "cm");
+			if (settings.compact) Quantizer::describe(channel, dev.posQuantizer.encoding(pos_ix));
+		}
+		dev.posOutlet.reset(new lsl::stream_outlet(posInfo));
+		if (dev.log) dev.posLog = dev.log->addStream(posInfo);
+	}
+	if (dev.timeSource != DeviceTimeSource::None) {
+		// The float32 timestamp channels lose sub-ms precision after a few hours
+		// of controller uptime; this companion stream carries the same clock in full.
+		QString time_stream_id = prefix + "DeviceTime" + name;
+		lsl::stream_info timeInfo((prefix + "DeviceTime").toStdString(), "MoCap", 1, settings.srate,
+			lsl::cf_double64, time_stream_id.toStdString());
+		timeInfo.desc()
+			.append_child("acquisition")
+			.append_child_value("manufacturer", "Sony")
+			.append_child_value("model", model);
+		QString chLabel = deviceKeyString(id);
+		chLabel.append(dev.timeSource == DeviceTimeSource::Calibrated ? "_timestamp"
+																		: "_raw_timestamp");
+		timeInfo.desc()
+			.append_child("channels")
+			.append_child("channel")
+			.append_child_value("label", chLabel.toStdString())
+			.append_child_value("type", "Time")
+			.append_child_value("unit", "seconds");
+		dev.timeOutlet.reset(new lsl::stream_outlet(timeInfo));
+		if (dev.log) dev.timeLog = dev.log->addStream(timeInfo);
+	}
+	return devPtr;
+}
 
-		if (newControllerIndices.size() != m_deviceIndices.size() ||
-			newControllerIndices != m_deviceIndices) {
-			m_deviceIndices = newControllerIndices;
-			emit deviceListUpdated(controllerList);
+void PSMoveThread::publishTrackers() {
+	PSMTrackerList list;
+	if (!m_source->getTrackerList(list) || list.count <= 0) return;
+	const QStringList poseLabels = posChannelLabels(true, false);
+	const int poseChannels = kPoseBlockChannels;
+	if (!m_trackerOutlet || list.count != m_trackerCount) {
+		auto num = [](double value) { return QString::number(value).toStdString(); };
+		// Irregular: a sample when streaming starts, after each reconnect and
+		// every kStatsInterval, so late recorders get the poses too.
+		lsl::stream_info trackerInfo("PSMoveTrackers", "MoCap", list.count * poseChannels,
+			lsl::IRREGULAR_RATE, lsl::cf_float32, "PSMoveTrackers");
+		trackerInfo.desc()
+			.append_child("acquisition")
+			.append_child_value("manufacturer", "Sony")
+			.append_child_value("model", "PlayStation Eye");
+		lsl::xml_element trackers = trackerInfo.desc().append_child("trackers");
+		lsl::xml_element channels = trackerInfo.desc().append_child("channels");
+		for (int t = 0; t < list.count; t++) {
+			const PSMClientTrackerInfo &info = list.trackers[t];
+			const PSMPosef &pose = info.tracker_pose;
+			QString trackerStr = QString("tracker") + QString::number(info.tracker_id);
+			trackers.append_child("tracker")
+				.append_child_value("id", num(info.tracker_id))
+				.append_child_value("device_path", info.device_path)
+				.append_child_value("focal_length_x", num(info.tracker_focal_lengths.x))
+				.append_child_value("focal_length_y", num(info.tracker_focal_lengths.y))
+				.append_child_value("principal_point_x", num(info.tracker_principal_point.x))
+				.append_child_value("principal_point_y", num(info.tracker_principal_point.y))
+				.append_child_value("width", num(info.tracker_screen_dimensions.x))
+				.append_child_value("height", num(info.tracker_screen_dimensions.y))
+				.append_child_value("hfov", num(info.tracker_hfov))
+				.append_child_value("vfov", num(info.tracker_vfov))
+				.append_child_value("znear", num(info.tracker_znear))
+				.append_child_value("zfar", num(info.tracker_zfar))
+				// The pose when the stream was created; the samples follow recalibrations.
+				.append_child_value("orientation_w", num(pose.Orientation.w))
+				.append_child_value("orientation_x", num(pose.Orientation.x))
+				.append_child_value("orientation_y", num(pose.Orientation.y))
+				.append_child_value("orientation_z", num(pose.Orientation.z))
+				.append_child_value("position_x", num(pose.Position.x))
+				.append_child_value("position_y", num(pose.Position.y))
+				.append_child_value("position_z", num(pose.Position.z));
+			for (int ch = 0; ch < poseChannels; ch++)
+				channels.append_child("channel")
+					.append_child_value("label", (trackerStr + "_" + poseLabels[ch]).toStdString())
+					.append_child_value("type", "Position")
+					.append_child_value("unit", "cm");
 		}
+		m_trackerOutlet.reset(new lsl::stream_outlet(trackerInfo));
+		m_trackerCount = list.count;
+		m_trackerLog = m_active.log ? m_active.log->addStream(trackerInfo) : -1;
+		m_trackerSample.assign(list.count * poseChannels, 0.0f);
+	}
+	for (int t = 0; t < list.count; t++) {
+		const PSMPosef &pose = list.trackers[t].tracker_pose;
+		float *s = m_trackerSample.data() + t * poseChannels;
+		s[0] = pose.Orientation.w;
+		s[1] = pose.Orientation.x;
+		s[2] = pose.Orientation.y;
+		s[3] = pose.Orientation.z;
+		s[4] = pose.Position.x;
+		s[5] = pose.Position.y;
+		s[6] = pose.Position.z;
 	}
+	pushTrackers(lsl::local_clock());
 }
 
-void PSMoveThread::acquireControllers() {
-	this->mutex.lock();
-	std::vector<uint32_t> devInds = this->m_streamDeviceIndices;
-	bool doIMU = this->m_bIMU;
-	bool doIMU_raw = this->m_bIMU_raw;
-	bool doPos = this->m_bPos;
-	bool doPos_raw = this->m_bPos_raw;
-	this->mutex.unlock();
+void PSMoveThread::pushTrackers(double now) {
+	m_trackerOutlet->push_sample(m_trackerSample, now);
+	if (m_active.log) m_active.log->write(m_trackerLog, now, m_trackerSample.data());
+}
 
-	// Controller flags
-	int ctrl_flags = 0;
-	if (doIMU) ctrl_flags |= PSMStreamFlags_includeCalibratedSensorData;
-	if (doIMU_raw) ctrl_flags |= PSMStreamFlags_includeRawSensorData;
-	if (doPos) ctrl_flags |= PSMStreamFlags_includePositionData;
-	if (doPos_raw) ctrl_flags |= PSMStreamFlags_includeRawTrackerData;
+void PSMoveThread::attachPreview(DeviceStream &dev) {
+	if (!m_active.preview || !previewReader(dev.kind)) return;
+	// A track has one publisher at a time, and a retired stream writes to its
+	// track until its publisher releases it.
+	auto written = [this](size_t track) {
+		for (auto &old : m_retiring)
+			if (old->preview == &m_previewTracks[track] &&
+				!old->released.load(std::memory_order_acquire))
+				return true;
+		return false;
+	};
+	bool changed = false;
+	// A device that comes back keeps its track once its old stream let go of it.
+	size_t track = std::find(m_previewKeys.begin(), m_previewKeys.end(), dev.id) - m_previewKeys.begin();
+	if (track < m_previewKeys.size() && written(track)) {
+		m_previewKeys[track] = kNoPreviewKey;
+		track = m_previewKeys.size();
+		changed = true;
+	}
+	if (track == m_previewKeys.size()) {
+		track = 0;
+		while (track < m_previewKeys.size() &&
+			(m_previewKeys[track] != kNoPreviewKey || written(track)))
+			track++;
+		if (track < m_previewKeys.size()) {
+			m_previewTracks[track].reset();
+			m_previewKeys[track] = dev.id;
+			changed = true;
+		} else if (track < (size_t)kPreviewTracks) {
+			m_previewKeys.push_back(dev.id);
+			changed = true;
+		}
+	}
+	if (changed) {
+		QStringList names;
+		for (DeviceKey key : m_previewKeys) names << (key == kNoPreviewKey ? QString() : deviceString(key));
+		emit previewTracksChanged(names);
+	}
+	if (track == m_previewKeys.size()) return;
+	dev.readPreview = previewReader(dev.kind);
+	dev.preview = &m_previewTracks[track];
+}
 
-	for (auto it = devInds.begin(); it < devInds.end(); it++) {
-		PSMControllerID ctrl_id(*it);
-		PSMRequestID request_id;
-		PSM_AllocateControllerListener(ctrl_id);
-		m_controllerViews.push_back(PSM_GetController(ctrl_id));
-		m_lastSeqNums.push_back(-1);
-		PSM_StartControllerDataStreamAsync(ctrl_id, ctrl_flags, &request_id);
-		PSM_RegisterCallback(request_id, handle_acquire_controller, this);
+std::shared_ptr<SessionLog> PSMoveThread::openBackup() {
+	QString dir = m_settings->backupDir;
+	qint64 bytes = m_settings->backupBytes;
+	if (dir.isEmpty()) return nullptr;
+
+	QDir backupDir(dir);
+	if (!backupDir.mkpath(".")) {
+		qDebug() << "Could not create backup directory" << dir;
+		return nullptr;
 	}
+	QString filename = backupDir.filePath(
+		"psmovelsl-" + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss") + ".psmlog");
+	std::shared_ptr<SessionLog> log(new SessionLog(filename.toStdString(), (uint64_t)bytes));
+	if (!log->isOpen()) return nullptr;
+	qDebug() << "Backing up the streams to" << filename;
+	return log;
 }
 
 bool PSMoveThread::createOutlets() {
-	// Safely copy member variables to local variables.
-	this->mutex.lock();
-	// double desiredSRate = this->m_srate;
-	double desiredSRate = lsl::IRREGULAR_RATE;
-	std::vector<uint32_t> devInds = this->m_streamDeviceIndices;
-	bool doIMU = this->m_bIMU;
-	bool doIMU_raw = this->m_bIMU_raw;
-	bool doPos = this->m_bPos;
-	bool doPos_raw = this->m_bPos_raw;
-	this->mutex.unlock();
-
-	// Each device has up to 2 streams: IMU and Position, with the following channels.
-	QStringList imuChanLabels;
-	if (doIMU) {
-		imuChanLabels << "timestamp"
-					  << "Accel.x"
-					  << "Accel.y"
-					  << "Accel.z"
-					  << "Gyro.x"
-					  << "Gyro.y"
-					  << "Gyro.z"
-					  << "Mag.x"
-					  << "Mag.y"
-					  << "Mag.z";
-	}
-	if (doIMU_raw) {
-		imuChanLabels << "raw_timestamp"
-					  << "raw_Accel.x"
-					  << "raw_Accel.y"
-					  << "raw_Accel.z"
-					  << "raw_Gyro.x"
-					  << "raw_Gyro.y"
-					  << "raw_Gyro.z"
-					  << "raw_Mag.x"
-					  << "raw_Mag.y"
-					  << "raw_Mag.z";
-	}
-	m_channelCount_IMU = imuChanLabels.size();
-
-	QStringList posChanLabels;
-	if (doPos) {
-		posChanLabels << "Pos.orient_w"
-					  << "Pos.orient_x"
-					  << "Pos.orient_y"
-					  << "Pos.orient_z"
-					  << "Pos.x"
-					  << "Pos.y"
-					  << "Pos.z";
-	}
-
-	if (doPos_raw) {
-		posChanLabels << "RelativePosition.x"
-					  << "RelativePosition.y"
-					  << "RelativePosition.z";
-	}
-	m_channelCount_Pos = posChanLabels.size();
+	const std::vector<DeviceKey> &devInds = m_streamDeviceIndices;
+	m_activeChunkMaxLatency = m_active.chunkMaxLatency;
+	m_active.log = openBackup();
 
+	m_devices.clear();
+	m_devices.reserve(devInds.size());
+	// No publisher runs now, so the tracks can start over.
+	m_previewKeys.clear();
+	for (PreviewTrack &track : m_previewTracks) track.reset();
 	for (auto it = devInds.begin(); it < devInds.end(); it++) {
-		PSMControllerID ctrl_id(*it);
-		PSMController *p_controller = PSM_GetController(ctrl_id);
-		QString ctrl_name = GetControllerString(p_controller);
-		
-		if (doIMU || doIMU_raw) {
-			QString imu_stream_id = QString("PSMoveIMU") + ctrl_name;
-			lsl::stream_info imuInfo("PSMoveIMU", "MoCap", imuChanLabels.size(), desiredSRate,
-				lsl::cf_float32, ctrl_name.toStdString());
-			// Append device meta-data
-			imuInfo.desc()
-				.append_child("acquisition")
-				.append_child_value("manufacturer", "Sony")
-				.append_child_value("model", "PlayStation Move");
-			// Append channel info
-			lsl::xml_element imuInfoChannels = imuInfo.desc().append_child("channels");
-			QString devStr = QString::number(*it);
-			devStr += "_";
-			for (int imu_ix = 0; imu_ix < m_channelCount_IMU; imu_ix++) {
-				QString chLabel = devStr;
-				chLabel.append(imuChanLabels[imu_ix]);
-				imuInfoChannels.append_child("channel")
-					.append_child_value("label", chLabel.toStdString())
-					.append_child_value("type", "IMU")
-					.append_child_value("unit", "various");
-			}
-			this->mutex.lock();
-			this->m_IMUOutlets.push_back(lsl::stream_outlet(imuInfo));
-			this->mutex.unlock();
-		}
-		if (doPos || doPos_raw) {
-			QString pos_stream_id = QString("PSMovePosition") + ctrl_name;
-			lsl::stream_info posInfo("PSMovePosition", "MoCap", posChanLabels.size(), desiredSRate,
-				lsl::cf_float32, pos_stream_id.toStdString());
-			// Append device meta-data
-			posInfo.desc()
-				.append_child("acquisition")
-				.append_child_value("manufacturer", "Sony")
-				.append_child_value("model", "PlayStation Move");
-			// Append channel info
-			lsl::xml_element posInfoChannels = posInfo.desc().append_child("channels");
-			QString devStr = QString::number(*it);
-			devStr += "_";
-			for (int pos_ix = 0; pos_ix < m_channelCount_Pos; pos_ix++) {
-				QString chLabel = devStr;
-				chLabel.append(posChanLabels[pos_ix]);
-				posInfoChannels.append_child("channel")
-					.append_child_value("label", chLabel.toStdString())
-					.append_child_value("type", "Position")
-					.append_child_value("unit", "cm");
-			}
-			this->mutex.lock();
-			this->m_PosOutlets.push_back(lsl::stream_outlet(posInfo));
-			this->mutex.unlock();
+		DeviceKind kind;
+		if (!deviceKind(*it, kind) || !hasStreams(kind, m_active)) continue;
+		std::unique_ptr<DeviceStream> dev = buildDevice(*it, kind, deviceString(*it), m_active);
+		if (!bindView(*dev)) continue;
+		attachPreview(*dev);
+		m_devices.push_back(std::move(dev));
+	}
+
+	QStringList deviceNames;
+	m_deviceCounters.clear();
+	for (auto &dev : m_devices) {
+		deviceNames << dev->name;
+		m_deviceCounters.push_back(dev->counters);
+	}
+	if (m_active.combined) {
+		// Only the PSMove controllers share a layout; the other devices keep their own outlets.
+		QStringList combinedNames;
+		std::vector<PSMControllerID> combinedIds;
+		for (auto &dev : m_devices) {
+			if (dev->kind != DeviceKind::PSMove) continue;
+			combinedNames << dev->name;
+			combinedIds.push_back(deviceId(dev->id));
 		}
+		m_combined.reset(new CombinedStream(combinedIds, combinedNames, m_active.imuChanLabels,
+			m_active.posChanLabels, m_active.srate, m_active.chunkSize, m_active.compact));
+		for (auto &dev : m_devices)
+			if (dev->kind == DeviceKind::PSMove) dev->combinedSlot = m_combined->slot(deviceId(dev->id));
+		if (m_active.log) m_combined->setLog(m_active.log.get());
 	}
+	m_statsOutlet.reset(new StatsOutlet(deviceNames, kStatsInterval, m_active.log.get()));
+	if (m_active.doPos || m_active.doPos_raw) publishTrackers();
+	m_starting.clear();
+	m_bDeviceSetDirty = false;
+	m_bStatsStale = false;
 
 	return true;
 }
 
-bool PSMoveThread::pollAndPush() {
-	bool b_pushedAny = false;
+bool PSMoveThread::captureSamples() {
+	bool b_capturedAny = false;
+	uint64_t shardsToWake = 0;
+	double now = lsl::local_clock();
+	for (auto &devPtr : m_devices) {
+		DeviceStream &dev = *devPtr;
+		int seq = outputSequence(dev);
+		if (seq == dev.lastSeqNum) continue;
+		DeviceCounters &counters = *dev.counters;
+		// PSM_Update() keeps only the newest packet of each controller, so any
+		// sequence numbers in between are gone for good.
+		if (dev.lastSeqNum >= 0 && seq > dev.lastSeqNum + 1) {
+			dev.unreportedGap += seq - dev.lastSeqNum - 1;
+			addCounter(counters.seqSkipped, (uint64_t)(seq - dev.lastSeqNum - 1));
+		}
+		dev.lastSeqNum = seq;
+		addCounter(counters.packetsSeen, (uint64_t)1);
+		b_capturedAny = true;
+
+		ControllerSample *slot = dev.ring->beginWrite();
+		if (!slot) {
+			// The publisher is not keeping up and the ring is full; drop the
+			// packet rather than stall polling, and report it as lost.
+			dev.unreportedGap++;
+			addCounter(counters.seqSkipped, (uint64_t)1);
+			addCounter(counters.ringOverflows, (uint64_t)1);
+			continue;
+		}
+		// A source that queued the packet knows when it really arrived.
+		double received = isHmdKey(dev.id) ? m_source->hmdPacketTime(deviceId(dev.id))
+										   : m_source->controllerPacketTime(deviceId(dev.id));
+		if (received <= 0.0) received = now;
+		slot->seq = seq;
+		slot->skipped = dev.unreportedGap;
+		slot->captureTime = received;
+		copyState(dev, slot->state);
+		slot->deviceTime = dev.readDeviceTime ? dev.readDeviceTime(slot->state) : 0.0;
+		slot->timestamp =
+			dev.mapDeviceClock ? dev.clock.map(slot->deviceTime, received) : received;
+		dev.ring->commitWrite();
+		uint64_t queued = dev.ring->size();
+		if (queued > counters.ringHighWater.load(std::memory_order_relaxed))
+			counters.ringHighWater.store(queued, std::memory_order_relaxed);
+		dev.unreportedGap = 0;
+		shardsToWake |= uint64_t(1) << dev.shard;
+	}
+	for (size_t shard = 0; shardsToWake != 0; shard++, shardsToWake >>= 1)
+		if (shardsToWake & 1) m_publishers[shard]->notifyData();
+	return b_capturedAny;
+}
+
+void PSMoveThread::startPublishing() {
+	int nThreads = m_settings->publisherThreads;
+	const std::vector<int> &cpus = m_settings->publisherCpus;
 
-	this->mutex.lock();
-	double desiredSRate = this->m_srate;
-	std::vector<uint32_t> devInds = this->m_streamDeviceIndices;
-	this->mutex.unlock();
+	if (nThreads == 0) nThreads = std::max(1, QThread::idealThreadCount() - 1);
+	// At least one publisher, so hot-plugged controllers have somewhere to go.
+	nThreads = std::min(std::min(nThreads, std::max((int)m_devices.size(), 1)), kMaxPublisherThreads);
+	// The combined rows are assembled by one thread.
+	if (m_combined) nThreads = 1;
 
-	// See if devices have new data.
-	for (size_t dev_ix = 0; dev_ix < m_controllerViews.size(); dev_ix++) {
-		if (m_controllerViews[dev_ix]->OutputSequenceNum != m_lastSeqNums[dev_ix]) {
-			qDebug() << "Found new data.";
-			int n_seqs = m_controllerViews[dev_ix]->OutputSequenceNum - m_lastSeqNums[dev_ix];
-			if (n_seqs > 1) {
-				qDebug() << "I didn't expect so many! - " << n_seqs;
-			}
+	// Deal the controllers out round-robin.
+	std::vector<std::vector<DeviceStream *>> shards(nThreads);
+	m_shardLoad.assign(nThreads, 0);
+	for (size_t dev_ix = 0; dev_ix < m_devices.size(); dev_ix++) {
+		m_devices[dev_ix]->shard = dev_ix % nThreads;
+		shards[dev_ix % nThreads].push_back(m_devices[dev_ix].get());
+		m_shardLoad[dev_ix % nThreads]++;
+	}
+	for (int shard = 0; shard < nThreads; shard++) {
+		int cpu = cpus.empty() ? -1 : cpus[shard % cpus.size()];
+		m_publishers.emplace_back(new PublisherThread);
+		m_publishers.back()->startPublishing(shards[shard], m_activeChunkMaxLatency, cpu,
+			m_combined.get(), std::max(m_activeRtPriority - 1, 0));
+	}
+	m_wakeLatency.reset();
+	m_pushLatency.reset();
+	qDebug() << "Publishing" << m_devices.size() << "controllers on" << nThreads << "threads.";
+}
 
-			// Build IMU data sample/chunk.
-			
-			if (m_bIMU || m_bIMU_raw) {
-				std::vector<float> imu_sample(m_channelCount_IMU);
-				int imu_c_off = 0;
-				if (m_bIMU) {
-					const PSMPSMoveCalibratedSensorData &calibSens =
-						m_controllerViews[dev_ix]->ControllerState.PSMoveState.CalibratedSensorData;
-					// Copy data to IMU data sample.
-					imu_sample[imu_c_off + 0] = (float)calibSens.TimeInSeconds;
-					imu_sample[imu_c_off + 1] = calibSens.Accelerometer.x;
-					imu_sample[imu_c_off + 2] = calibSens.Accelerometer.y;
-					imu_sample[imu_c_off + 3] = calibSens.Accelerometer.z;
-					imu_sample[imu_c_off + 4] = calibSens.Gyroscope.x;
-					imu_sample[imu_c_off + 5] = calibSens.Gyroscope.y;
-					imu_sample[imu_c_off + 6] = calibSens.Gyroscope.z;
-					imu_sample[imu_c_off + 7] = calibSens.Magnetometer.x;
-					imu_sample[imu_c_off + 8] = calibSens.Magnetometer.y;
-					imu_sample[imu_c_off + 9] = calibSens.Magnetometer.z;
-					imu_c_off += 10;
-				}
-				if (m_bIMU_raw) {
-					const PSMPSMoveRawSensorData &rawSens =
-						m_controllerViews[dev_ix]->ControllerState.PSMoveState.RawSensorData;
-					// Copy raw data to IMU data chunk
-					imu_sample[imu_c_off + 0] = rawSens.TimeInSeconds;
-					imu_sample[imu_c_off + 1] = rawSens.Accelerometer.x;
-					imu_sample[imu_c_off + 2] = rawSens.Accelerometer.y;
-					imu_sample[imu_c_off + 3] = rawSens.Accelerometer.z;
-					imu_sample[imu_c_off + 4] = rawSens.Gyroscope.x;
-					imu_sample[imu_c_off + 5] = rawSens.Gyroscope.y;
-					imu_sample[imu_c_off + 6] = rawSens.Gyroscope.z;
-					imu_sample[imu_c_off + 7] = rawSens.Magnetometer.x;
-					imu_sample[imu_c_off + 8] = rawSens.Magnetometer.y;
-					imu_sample[imu_c_off + 9] = rawSens.Magnetometer.z;
-					imu_c_off += 10;
-				}
-				// Push IMU data chunk.
-				m_IMUOutlets[dev_ix].push_sample(imu_sample.data());
-			}
-			
-
-			// Build Pos data sample / chunk.
-			if (m_bPos || m_bPos_raw)
-			{
-				std::vector<float> pos_sample(m_channelCount_Pos);
-				int pos_c_off = 0;
-				if (m_bPos) {
-					const PSMPosef &poseData =
-						m_controllerViews[dev_ix]->ControllerState.PSMoveState.Pose;
-					pos_sample[pos_c_off + 0] = poseData.Orientation.w;
-					pos_sample[pos_c_off + 1] = poseData.Orientation.x;
-					pos_sample[pos_c_off + 2] = poseData.Orientation.y;
-					pos_sample[pos_c_off + 3] = poseData.Orientation.z;
-					pos_sample[pos_c_off + 4] = poseData.Position.x;
-					pos_sample[pos_c_off + 5] = poseData.Position.y;
-					pos_sample[pos_c_off + 6] = poseData.Position.z;
-					pos_c_off += 7;
-				}
-				if (m_bPos_raw) {
-					const PSMRawTrackerData &rawTrackerData =
-						m_controllerViews[dev_ix]->ControllerState.PSMoveState.RawTrackerData;
-					pos_sample[pos_c_off + 0] = rawTrackerData.RelativePositionCm.x;
-					pos_sample[pos_c_off + 1] = rawTrackerData.RelativePositionCm.y;
-					pos_sample[pos_c_off + 2] = rawTrackerData.RelativePositionCm.z;
-					pos_c_off += 3;
-				}
-				// Push Pos data sample/chunk.
-				m_PosOutlets[dev_ix].push_sample(pos_sample.data());
-			}
-			m_lastSeqNums[dev_ix] = m_controllerViews[dev_ix]->OutputSequenceNum;
-			b_pushedAny = true;
+void PSMoveThread::stopPublishing() {
+	m_publishers.clear(); // Each one flushes and joins on destruction.
+	if (!m_deviceCounters.empty()) {
+		// The whole session's histograms, to check the latency bound.
+		mergePushLatency();
+		std::vector<uint64_t> wake, push;
+		double wakeMax = 0.0, pushMax = 0.0;
+		m_wakeLatency.addTo(wake, wakeMax);
+		m_pushLatency.addTo(push, pushMax);
+		qDebug().noquote() << latencySummary().join("\n");
+		qDebug().noquote() << "Wake latency histogram:\n" + LatencyHistogram::table(wake).join("\n");
+		qDebug().noquote() << "Push latency histogram:\n" + LatencyHistogram::table(push).join("\n");
+	}
+	m_combined.reset();
+	m_retiring.clear();
+	if (m_pendingBatch.valid()) m_pendingBatch.get();
+	if (m_disposal.valid()) m_disposal.get();
+	m_disposeDevices.clear();
+	m_disposeStats.clear();
+	m_bListRequested = false;
+	m_building.clear();
+	m_starting.clear();
+	m_shardLoad.clear();
+	m_statsOutlet.reset();
+	m_trackerOutlet.reset();
+	m_deviceCounters.clear();
+	m_devices.clear();
+	// Nothing writes to it any more; trims and closes the file.
+	m_active.log.reset();
+}
+
+void PSMoveThread::updateDeviceSet() {
+	if (m_source->controllerListChanged()) m_bDeviceSetDirty = true;
+
+	// Hand the devices their publisher has let go of to m_disposal.
+	for (size_t dev_ix = m_retiring.size(); dev_ix-- > 0;) {
+		if (!m_retiring[dev_ix]->released.load(std::memory_order_acquire)) continue;
+		m_disposeDevices.push_back(std::move(m_retiring[dev_ix]));
+		m_retiring.erase(m_retiring.begin() + dev_ix);
+	}
+
+	if (m_pendingBatch.valid() &&
+		m_pendingBatch.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		adoptDeviceBatch();
+	launchDisposal();
+
+	double now = lsl::local_clock();
+	if (m_bDeviceSetDirty && !m_bListRequested) {
+		m_bDeviceSetDirty = false;
+		// Answered through update(), so the polling goes on meanwhile.
+		m_source->requestDeviceLists();
+		m_bListRequested = true;
+		m_listRequestedAt = now;
+	}
+	if (m_bListRequested) {
+		DeviceLists lists;
+		bool ok;
+		if (m_source->takeDeviceLists(lists, ok)) {
+			m_bListRequested = false;
+			if (ok) applyDeviceLists(lists);
+			followDeviceSet();
+		} else if (now - m_listRequestedAt > kListQueryTimeout) {
+			// The answer was lost, with a dropped connection say; ask again.
+			m_bListRequested = false;
+			m_bDeviceSetDirty = true;
 		}
 	}
-	return b_pushedAny;
+
+	if (m_pendingBatch.valid() || (m_starting.empty() && !m_bStatsStale)) return;
+	// Build once every new device is delivering, so its clock mapping and
+	// first chunk start from live data.
+	bool ready = true;
+	for (auto &ctrl : m_starting) {
+		int seq;
+		bool delivering = deviceSequence(ctrl.id, seq) && seq != ctrl.seqAtStart;
+		if (!delivering && now - ctrl.since < kStreamStartTimeout) ready = false;
+	}
+	if (ready) launchDeviceBatch();
+}
+
+void PSMoveThread::followDeviceSet() {
+	const std::vector<DeviceKey> &selected = m_streamDeviceIndices;
+	auto present = [this](DeviceKey id) {
+		return std::find(m_deviceIndices.begin(), m_deviceIndices.end(), id) !=
+			m_deviceIndices.end();
+	};
+	auto wanted = [&](DeviceKey id) {
+		DeviceKind kind;
+		if (!present(id) || !deviceKind(id, kind) || !hasStreams(kind, m_active)) return false;
+		// The combined layout is fixed; only its own controllers can come back.
+		if (m_combined && kind == DeviceKind::PSMove && m_combined->slot(deviceId(id)) < 0)
+			return false;
+		return m_bStreamAll || std::find(selected.begin(), selected.end(), id) != selected.end();
+	};
+
+	for (size_t dev_ix = m_devices.size(); dev_ix-- > 0;)
+		if (!present(m_devices[dev_ix]->id)) retireDevice(dev_ix);
+	m_starting.erase(std::remove_if(m_starting.begin(), m_starting.end(),
+						 [&](const StartingController &ctrl) { return !present(ctrl.id); }),
+		m_starting.end());
+
+	double now = lsl::local_clock();
+	for (DeviceKey id : m_deviceIndices) {
+		if (!wanted(id)) continue;
+		bool known = std::find(m_building.begin(), m_building.end(), id) != m_building.end();
+		for (auto &dev : m_devices) known = known || dev->id == id;
+		for (auto &ctrl : m_starting) known = known || ctrl.id == id;
+		if (known) continue;
+		int seq;
+		if (!deviceSequence(id, seq)) continue;
+		qDebug() << "Device" << deviceString(id) << "connected.";
+		startDeviceStreams(std::vector<DeviceKey>(1, id));
+		m_starting.push_back({id, seq, now});
+	}
+}
+
+void PSMoveThread::retireDevice(size_t dev_ix) {
+	std::unique_ptr<DeviceStream> dev = std::move(m_devices[dev_ix]);
+	m_devices.erase(m_devices.begin() + dev_ix);
+	qDebug() << "Device" << dev->name << "disconnected.";
+	// captureSamples() no longer sees it; the publisher drains and releases it.
+	m_shardLoad[dev->shard]--;
+	m_publishers[dev->shard]->retireDevice(dev.get());
+	stopDeviceStream(dev->id);
+	m_retiring.push_back(std::move(dev));
+	m_bStatsStale = true;
+}
+
+void PSMoveThread::launchDeviceBatch() {
+	struct Job {
+		DeviceKey id;
+		DeviceKind kind;
+		QString name;
+	};
+	std::vector<Job> jobs;
+	QStringList statsNames;
+	for (auto &dev : m_devices) statsNames << dev->name;
+	for (auto &ctrl : m_starting) {
+		DeviceKind kind;
+		if (!deviceKind(ctrl.id, kind)) continue;
+		jobs.push_back({ctrl.id, kind, deviceString(ctrl.id)});
+		statsNames << jobs.back().name;
+		m_building.push_back(ctrl.id);
+	}
+	m_starting.clear();
+	m_bStatsStale = false;
+
+	// Creating outlets takes long enough to show up as polling jitter.
+	StreamSettings settings = m_active;
+	m_pendingBatch = std::async(std::launch::async, [jobs, statsNames, settings]() {
+		DeviceBatch batch;
+		for (const Job &job : jobs)
+			batch.devices.push_back(buildDevice(job.id, job.kind, job.name, settings));
+		batch.statsNames = statsNames;
+		batch.statsOutlet.reset(new StatsOutlet(statsNames, kStatsInterval, settings.log.get()));
+		return batch;
+	});
+}
+
+void PSMoveThread::adoptDeviceBatch() {
+	DeviceBatch batch = m_pendingBatch.get();
+	m_building.clear();
+	for (auto &dev : batch.devices) {
+		// Unplugged again while its outlets were being made.
+		if (std::find(m_deviceIndices.begin(), m_deviceIndices.end(), dev->id) ==
+				m_deviceIndices.end() ||
+			!bindView(*dev))
+			continue;
+		size_t shard =
+			std::min_element(m_shardLoad.begin(), m_shardLoad.end()) - m_shardLoad.begin();
+		dev->shard = shard;
+		dev->combinedSlot = m_combined && dev->kind == DeviceKind::PSMove
+			? m_combined->slot(deviceId(dev->id))
+			: -1;
+		m_shardLoad[shard]++;
+		attachPreview(*dev);
+		m_devices.push_back(std::move(dev));
+		m_publishers[shard]->addDevice(m_devices.back().get());
+	}
+
+	QStringList deviceNames;
+	for (auto &dev : m_devices) deviceNames << dev->name;
+	// Those left over were unplugged again while their outlets were being made.
+	for (auto &dev : batch.devices)
+		if (dev) m_disposeDevices.push_back(std::move(dev));
+	if (deviceNames != batch.statsNames) {
+		// The set changed again in the meantime; the next batch remakes the stats.
+		m_bStatsStale = true;
+		m_disposeStats.push_back(std::move(batch.statsOutlet));
+		return;
+	}
+	if (m_statsOutlet) m_disposeStats.push_back(std::move(m_statsOutlet));
+	m_statsOutlet = std::move(batch.statsOutlet);
+	m_deviceCounters.clear();
+	for (auto &dev : m_devices) m_deviceCounters.push_back(dev->counters);
+}
+
+void PSMoveThread::launchDisposal() {
+	if (m_disposeDevices.empty() && m_disposeStats.empty()) return;
+	if (m_disposal.valid() &&
+		m_disposal.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+	// Closing outlets takes as long as creating them. The lambda empties its
+	// captures itself, since the future may be dropped on this thread.
+	m_disposal = std::async(std::launch::async,
+		[devices = std::move(m_disposeDevices), stats = std::move(m_disposeStats)]() mutable {
+			devices.clear();
+			stats.clear();
+		});
+	m_disposeDevices.clear();
+	m_disposeStats.clear();
+}
+
+void PSMoveThread::waitForData() {
+	PollWaiter::Report report;
+	double now = lsl::local_clock();
+	if (m_pollWaiter.takeReport(now, kStatsInterval, report) && m_statsOutlet) {
+		QStringList summary = m_statsOutlet->publish(report, m_deviceCounters);
+		mergePushLatency();
+		emit statsUpdated(summary);
+		// From the last query; asking the service again would stall the polling.
+		if (m_trackerOutlet) pushTrackers(now);
+	}
+	// Queued packets are already late; fetch them right away.
+	unsigned long sleepUs = m_source->packetsPending() ? 0 : m_pollWaiter.sleepMicros(now);
+	if (sleepUs > 0) {
+		this->usleep(sleepUs);
+		m_wakeLatency.record(std::max(0.0, lsl::local_clock() - now - 1e-6 * sleepUs));
+	}
 }
 
 void PSMoveThread::run() {
 	runPhase phase = phase_startLink;
 
-	// Thread-safe copy member variables to local variables.
-	this->mutex.lock();
-	this->mutex.unlock();
+	enterRealtime();
 
 	forever {
-		this->mutex.lock();
-		if (this->abort) phase = phase_shutdown;
-		this->mutex.unlock();
+		// One command per pass, so every phase sees each start and stop.
+		processCommand();
+		if (m_abort.load(std::memory_order_relaxed)) phase = phase_shutdown;
+		bool reconnect = m_settings->reconnect;
 
 		switch (phase) {
 		case phase_startLink:
 			if (connectToPSMS()) {
 				emit psmsConnected(true);
 				phase = phase_scanForDevices;
+			} else if (reconnect) {
+				beginReconnect();
+				phase = phase_reconnect;
 			} else {
 				phase = phase_shutdown;
 			}
 			break;
 		case phase_scanForDevices:
-			if (this->m_bGoOutlets) {
+			if (reconnect && !m_source->isConnected()) {
+				beginReconnect();
+				phase = phase_reconnect;
+			} else if (this->m_bGoOutlets) {
 				acquireControllers();
 				phase = phase_waitForControllers;
 			} else {
@@ -391,41 +1121,78 @@ void PSMoveThread::run() {
 			}
 			break;
 		case phase_waitForControllers:
-			PSM_Update();
-			if (this->m_bControllerStreamActive) phase = phase_createOutlets;
+			m_source->update();
+			if (reconnect && !m_source->isConnected()) {
+				beginReconnect();
+				phase = phase_reconnect;
+			} else if (m_source->controllerStreamsActive()) {
+				phase = phase_createOutlets;
+			}
 			break;
 		case phase_createOutlets:
 			if (createOutlets()) {
 				emit outletsStarted(true);
 				m_startTime = lsl::local_clock();
+				m_pollWaiter.reset(m_startTime);
+				startPublishing();
 				phase = phase_transferData;
 			} else {
 				phase = phase_shutdown;
 			}
 			break;
 		case phase_transferData:
-			PSM_Update();
+			m_source->update();
 			// If we are no longer running the outlets, we need to destroy them.
 			if (!this->m_bGoOutlets) {
 				qDebug() << "Instructed to stop streaming.";
-				this->mutex.lock();
-				this->m_IMUOutlets.clear();
-				this->m_PosOutlets.clear();
+				stopPublishing();
 				phase = phase_scanForDevices;
-				this->mutex.unlock();
 				emit outletsStarted(false);
 				break;
-			} else if (!pollAndPush()) {
-				this->usleep(1);
+			} else if (reconnect && !m_source->isConnected()) {
+				// Keep the outlets; recorders just see a gap.
+				beginReconnect();
+				phase = phase_reconnect;
+			} else {
+				updateDeviceSet();
+				m_pollWaiter.notePoll(lsl::local_clock(), captureSamples());
+				waitForData();
+			}
+			break;
+		case phase_reconnect:
+			if (!this->m_bGoOutlets && !m_publishers.empty()) {
+				qDebug() << "Instructed to stop streaming.";
+				stopPublishing();
+				emit outletsStarted(false);
+			}
+			if (lsl::local_clock() < m_nextReconnect) {
+				this->msleep(50);
+				break;
+			}
+			m_source->disconnect();
+			if (!connectToPSMS()) {
+				m_reconnectDelay = std::min(2.0 * m_reconnectDelay, kReconnectMaxDelay);
+				m_nextReconnect = lsl::local_clock() + m_reconnectDelay;
+				qDebug() << "Reconnect failed; next attempt in" << m_reconnectDelay << "s.";
+				break;
+			}
+			qDebug() << "Reconnected to PSMoveService.";
+			emit reconnecting(false);
+			if (!m_publishers.empty()) {
+				resumeStreams();
+				m_pollWaiter.reset(lsl::local_clock());
+				phase = phase_transferData;
+			} else {
+				// Streams requested but not yet started begin again from acquireControllers().
+				m_deviceIndices.clear();
+				m_deviceKinds.clear();
+				phase = phase_scanForDevices;
 			}
 			break;
 		case phase_shutdown:
-			this->mutex.lock();
-			this->m_IMUOutlets.clear();
-			this->m_PosOutlets.clear();
-			this->mutex.unlock();
+			stopPublishing();
 			emit outletsStarted(false);
-			PSM_Shutdown();
+			m_source->disconnect();
 			emit psmsConnected(false);
 			return;
 			break;
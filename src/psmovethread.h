@@ -1,11 +1,22 @@
 #ifndef CERELINKTHREAD_H
 #define CERELINKTHREAD_H
 
-#include <QMutex>
 #include <QThread>
-#include <QWaitCondition>
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
 #include "lsl_cpp.h"
 #include "PSMoveClient_CAPI.h"
+#include "combinedstream.h"
+#include "controllersource.h"
+#include "devicestream.h"
+#include "pollwaiter.h"
+#include "preview.h"
+#include "publisherthread.h"
+#include "samplering.h"
+#include "sessionlog.h"
+#include "telemetry.h"
 
 class PSMoveThread : public QThread
 {
@@ -15,48 +26,219 @@ public:
 	PSMoveThread(QObject *parent = 0);
     ~PSMoveThread();
 
-    void initPSMS(double srate);                         // Starts the thread. Passes parameters from GUI to OpenVRThread member variables.
+    void initPSMS(double srate,
+		WaitMode waitMode = WaitMode::Adaptive,
+		ControllerSource *source = nullptr);     // Starts the thread. Takes ownership of source; nullptr connects to PSMoveService.
     void startStreams(
 		QStringList streamDeviceList = QStringList(),
 		bool doIMU = true, bool doIMU_raw = true,
-		bool doPos = true, bool doPos_raw = true);  // Starts IMU and/or position streams for all devices.
-
-	bool m_bControllerStreamActive = false;
+		bool doPos = true, bool doPos_raw = true,
+		int chunkSize = 1, double chunkMaxLatency = 0.0,
+		bool useDeviceClock = true,
+		bool resample = false,
+		bool combined = false,
+		bool compact = false,
+		bool events = false,
+		bool kinematics = false);     // Starts IMU and/or position streams for all devices. With resample, at the initPSMS() rate;
+		                              // combined puts all PSMove controllers into one resampled IMU and one position stream;
+		                              // compact pushes int16 instead of float32 (see quantize.h);
+		                              // events adds a PSMoveEvents stream of button, trigger and battery changes;
+		                              // kinematics a PSMoveKinematics stream of derived velocities (see kinematics.h).
+		                              // Calling it again stops the streams.
+	// The setters below take effect for what the thread sets up next; they
+	// never change streams that are already running.
+	// Spread the controllers over publisherThreads publisher threads (0: one per
+	// controller, up to the number of cores), optionally pinned round-robin to cpus.
+	void setPublisherThreads(int publisherThreads, const std::vector<int> &cpus = std::vector<int>());
+	// Keep retrying, with backoff, when PSMoveService cannot be reached or goes
+	// away, instead of shutting down. Outlets stay open meanwhile.
+	void setReconnect(bool reconnect);
+	// Also record every outlet into a SessionLog of up to bytes in dir, one
+	// file per startStreams(). An empty dir turns the backup off.
+	void setBackup(const QString &dir, qint64 bytes);
+	// Real-time mode, applied when initPSMS() starts the thread: the acquisition
+	// thread runs SCHED_FIFO at priority (pinned to cpu if >= 0) and the
+	// publishers one below it, with memory locked and stacks prefaulted.
+	void setRealtime(bool enabled, int priority = 80, int cpu = -1);
+	// Feed a decimated preview of each streamed device's signals (see preview.h).
+	void setPreview(bool enabled);
+	const PreviewTrack &previewTrack(int track) const { return m_previewTracks[track]; }
+	// Wake latency quantiles so far and push latency ones as of the last
+	// statsUpdated(), a line each. Callable from any thread, so the text is
+	// built by whoever shows it rather than by the acquisition thread.
+	QStringList latencySummary() const;
 
 signals:
     void psmsConnected(bool result);              // Emitted after successful PSMS initialization.
     void deviceListUpdated(QStringList deviceList); // Emitted after a new device is detected.
     void outletsStarted(bool result);				// Emitted after LSL outlets are created.
+	void statsUpdated(QStringList summary);			// Emitted with each PSMoveStats sample while streaming.
+	void reconnecting(bool active);					// With setReconnect(): connection lost (true) or back (false).
+	void previewTracksChanged(QStringList names);	// With setPreview(): the device of each previewTrack(), "" if unused.
 
 protected:
     void run() override;
 
 private:
-    bool connectToPSMS();     // Initialize PSMS. If successful, device scanning will begin.
-    void refreshControllerList();   // Scan for devices.
+	// Everything the owning thread configures. The thread only ever sees
+	// immutable snapshots of it, handed over through m_commands.
+	struct ControlSettings {
+		double srate = lsl::IRREGULAR_RATE;             // From initPSMS().
+		bool doIMU = true;
+		bool doIMU_raw = true;
+		bool doPos = true;
+		bool doPos_raw = true;
+		int chunkSize = 1;                              // Samples per push; 1 pushes every packet immediately.
+		double chunkMaxLatency = 0.0;                   // Max. seconds a sample may wait for its chunk.
+		bool deviceClock = true;                        // Map controller time onto the LSL clock.
+		bool resample = false;                          // Resample the streams to srate.
+		bool combined = false;                          // Stream all devices through m_combined.
+		bool compact = false;                           // Quantize the IMU and position streams to int16.
+		bool events = false;                            // Button and analog change streams.
+		bool kinematics = false;                        // Derived kinematics streams.
+		std::vector<DeviceKey> streamDevices;           // Empty: stream whatever connects.
+		int publisherThreads = 1;
+		std::vector<int> publisherCpus;
+		bool reconnect = false;
+		QString backupDir;                              // Empty: no backup log.
+		qint64 backupBytes = 0;
+		bool realtime = false;
+		int rtPriority = 80;                            // SCHED_FIFO priority of the acquisition thread.
+		int acquisitionCpu = -1;
+		bool preview = false;
+	};
+	enum class CommandType { Configure, StartStreams, StopStreams };
+	struct Command {
+		CommandType type = CommandType::Configure;
+		std::shared_ptr<const ControlSettings> settings; // Configure and StartStreams.
+	};
+	// What startStreams() asked for, fixed while streaming.
+	struct StreamSettings {
+		bool doIMU = true;
+		bool doIMU_raw = true;
+		bool doPos = true;
+		bool doPos_raw = true;
+		bool resample = false;
+		bool combined = false;                          // One CombinedStream instead of outlets per device.
+		bool compact = false;                           // cf_int16 outlets.
+		bool events = false;                            // PSMoveEvents outlet per device.
+		bool kinematics = false;                        // PSMoveKinematics outlet per device with a pose.
+		bool preview = false;                           // Feed m_previewTracks.
+		double srate = lsl::IRREGULAR_RATE;             // Nominal rate of the outlets.
+		int chunkSize = 1;
+		double chunkMaxLatency = 0.0;
+		bool deviceClock = true;
+		unsigned int flags = 0;                         // PSMControllerDataStreamFlags.
+		QStringList imuChanLabels;
+		QStringList posChanLabels;
+		std::shared_ptr<SessionLog> log;                // Backup of all outlets; nullptr if off.
+	};
+	// Devices and the matching PSMoveStats outlet, built off the acquisition thread.
+	struct DeviceBatch {
+		std::vector<std::unique_ptr<DeviceStream>> devices;
+		QStringList statsNames;                         // Device set the stats outlet was made for.
+		std::unique_ptr<StatsOutlet> statsOutlet;
+	};
+	// A hot-plugged device whose data stream was requested.
+	struct StartingController {
+		DeviceKey id;
+		int seqAtStart;
+		double since;
+	};
+
+	// Owning thread: queue a command, with a snapshot of m_request, for run().
+	// False if the thread is not running.
+	bool postCommand(CommandType type);
+	void processCommand();    // Apply the oldest queued command, if any. Acquisition thread.
+    bool connectToPSMS();     // Connect the controller source. If successful, device scanning will begin.
+    bool refreshControllerList();   // Scan for controllers and HMDs. Returns true if the list changed.
+	// Take the device list the source reported. Returns true if it changed.
+	bool applyDeviceLists(const DeviceLists &lists);
 	void acquireControllers();
+	StreamSettings streamSettings();
+	// Device access across the controller and HMD APIs of the source.
+	QString deviceString(DeviceKey key);          // "<id>:<serial>", or e.g. "hmd0:Morpheus".
+	bool deviceKind(DeviceKey key, DeviceKind &kind); // As listed; false if gone or cannot be streamed.
+	bool deviceSequence(DeviceKey key, int &seq); // OutputSequenceNum; false if the device is gone.
+	bool bindView(DeviceStream &dev);             // Points dev at the source's current view of it.
+	void startDeviceStreams(const std::vector<DeviceKey> &keys); // Those hasStreams() under m_active.
+	void stopDeviceStream(DeviceKey key);
+	// Whether settings give a device of this kind any outlet.
+	static bool hasStreams(DeviceKind kind, const StreamSettings &settings);
+	// Creates the ring, outlets and counters of one device; the caller binds
+	// its view. Touches no members, so it can run on any thread.
+	static std::unique_ptr<DeviceStream> buildDevice(DeviceKey id, DeviceKind kind,
+		const QString &name, const StreamSettings &settings);
+	void attachPreview(DeviceStream &dev);   // Give dev a preview track, its old one if no stream writes there.
+	std::shared_ptr<SessionLog> openBackup(); // nullptr if off or the file cannot be made.
+	void publishTrackers();     // Query and push the tracker poses, creating m_trackerOutlet if needed.
+	void pushTrackers(double now); // Push m_trackerSample again.
     bool createOutlets();       // Create the outlets.
-	bool pollAndPush();
+	void updateDeviceSet();     // Follow controllers connecting and disconnecting while streaming.
+	void followDeviceSet();     // Retire the devices gone from m_deviceIndices and start the new ones.
+	void launchDeviceBatch();
+	void adoptDeviceBatch();
+	void retireDevice(size_t dev_ix);
+	void launchDisposal();      // Destroy m_disposeDevices and m_disposeStats on m_disposal.
+	void beginReconnect();      // Connection lost; schedule the first attempt.
+	void resumeStreams();       // Reconnected while streaming: point the devices at the new views and restart their streams.
+	bool captureSamples();      // Copy every new controller packet into its device's ring.
+	void startPublishing();     // Hand the devices to the publisher threads.
+	void stopPublishing();      // Flush and stop the publishers, then drop the devices.
+	void waitForData();       // Sleep until the next packet is expected, and log what polling costs.
+	void enterRealtime();     // Apply setRealtime() to the calling (acquisition) thread.
+	void mergePushLatency();  // Sum the devices' push latencies into m_pushLatency, without allocating.
 
-    QMutex mutex;
-    QWaitCondition condition;
-    bool abort;
-    double m_srate;                                    // Desired pose sampling rate.
+    std::unique_ptr<ControllerSource> m_source;
+	// Owning thread only.
+	ControlSettings m_request;                      // Copied into each snapshot.
+	bool m_bStreamsRequested = false;               // startStreams() toggles between start and stop.
+	// Owning thread to acquisition thread; the only shared control state.
+	SampleRing<Command> m_commands;
+	std::atomic<bool> m_abort;                      // Disconnect and leave run().
+	// Acquisition thread only.
+	std::shared_ptr<const ControlSettings> m_settings; // Latest snapshot.
     bool m_bGoOutlets;								// Request to start streams has been made.
-	bool m_bIMU = true;
-	bool m_bIMU_raw = true;
-	bool m_bPos = true;
-	bool m_bPos_raw = true;
-    std::vector<uint32_t> m_deviceIndices;          // List of found devices indices.
-    std::vector<uint32_t> m_streamDeviceIndices;    // List of device indices for streams.
-    std::vector<lsl::stream_outlet> m_IMUOutlets;
-	int m_channelCount_IMU;
-    std::vector<lsl::stream_outlet> m_PosOutlets;
-	int m_channelCount_Pos;
+	bool m_bStreamAll = false;                      // No devices were selected; stream whatever connects.
+	double m_reconnectDelay = 0.0;                  // Current backoff, s.
+	double m_nextReconnect = 0.0;                   // local_clock() of the next connect attempt.
+	int m_activeRtPriority = 0;                     // As applied by enterRealtime(); 0 if not real-time.
+	LatencyHistogram m_wakeLatency;                 // How late the acquisition thread wakes from its sleeps.
+	LatencyHistogram m_pushLatency;                 // Of all devices, as of the last mergePushLatency().
+	std::vector<uint64_t> m_pushCounts;             // mergePushLatency()'s buffer, kBuckets long.
+	PreviewTrack m_previewTracks[kPreviewTracks];   // Written by the publishers, read by the GUI.
+	std::vector<DeviceKey> m_previewKeys;           // Device of each track in use; kNoPreviewKey if free.
+    std::vector<DeviceKey> m_deviceIndices;         // List of found devices indices.
+	std::map<DeviceKey, DeviceKind> m_deviceKinds;  // Of m_deviceIndices, from the types they were listed with.
+    std::vector<DeviceKey> m_streamDeviceIndices;   // List of device indices for streams.
+	std::vector<std::unique_ptr<DeviceStream>> m_devices; // Shared with m_publishers while streaming.
+	StreamSettings m_active;                        // Settings of the running streams.
+	std::unique_ptr<CombinedStream> m_combined;     // Outlets of all devices in combined mode.
 	uint64_t m_pushCounter;
 	double m_startTime;
-	std::vector<PSMController *> m_controllerViews;
-	std::vector<int> m_lastSeqNums;
+	double m_activeChunkMaxLatency = 0.0;           // m_chunkMaxLatency as of createOutlets().
+	std::vector<std::shared_ptr<DeviceCounters>> m_deviceCounters; // Counters of m_statsOutlet's devices, in order.
+	std::unique_ptr<StatsOutlet> m_statsOutlet;     // PSMoveStats; exists while streaming.
+	std::unique_ptr<lsl::stream_outlet> m_trackerOutlet; // PSMoveTrackers; while streaming poses.
+	int m_trackerCount = 0;                         // Trackers m_trackerOutlet was made for.
+	int m_trackerLog = -1;                          // m_trackerOutlet's stream in m_active.log.
+	std::vector<float> m_trackerSample;             // The poses last queried.
+	PollWaiter m_pollWaiter;
+	std::vector<std::unique_ptr<PublisherThread>> m_publishers; // Drain the device rings into the outlets.
+	std::vector<int> m_shardLoad;                   // Devices per publisher.
+	// Hot-plug state, see updateDeviceSet().
+	bool m_bDeviceSetDirty = false;                 // The source reported a device list change.
+	bool m_bListRequested = false;                  // requestDeviceLists() not yet answered.
+	double m_listRequestedAt = 0.0;
+	bool m_bStatsStale = false;                     // m_statsOutlet does not match m_devices.
+	std::vector<StartingController> m_starting;
+	std::vector<DeviceKey> m_building;              // Devices in m_pendingBatch.
+	std::future<DeviceBatch> m_pendingBatch;
+	std::vector<std::unique_ptr<DeviceStream>> m_retiring; // Until their publisher releases them.
+	// Released devices and replaced stats outlets, waiting for m_disposal.
+	std::vector<std::unique_ptr<DeviceStream>> m_disposeDevices;
+	std::vector<std::unique_ptr<StatsOutlet>> m_disposeStats;
+	std::future<void> m_disposal;                   // Destroys them off the acquisition thread.
 };
 
 #endif // CERELINKTHREAD_H
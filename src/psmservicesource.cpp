@@ -0,0 +1,146 @@
+#include "psmservicesource.h"
+#include <QDebug>
+
+PSMServiceSource::PSMServiceSource(const std::string &address, const std::string &port)
+	: m_address(address), m_port(port), m_bStreamActive(false) {}
+
+void PSMServiceSource::handleStartStream(const PSMResponseMessage *response, void *userdata) {
+	PSMServiceSource *thisPtr = reinterpret_cast<PSMServiceSource *>(userdata);
+
+	if (response->result_code == PSMResult_Success) {
+		thisPtr->m_bStreamActive = true;
+		// Wait for the first controller packet to show up...
+	}
+}
+
+bool PSMServiceSource::connect() {
+	PSMResult res = PSM_Initialize(m_address.c_str(), m_port.c_str(), PSM_DEFAULT_TIMEOUT);
+	if (res != PSMResult_Success) {
+		qDebug() << "Unable to init PSMove Client";
+		return false;
+	}
+	return true;
+}
+
+void PSMServiceSource::disconnect() {
+	PSM_Shutdown();
+	m_bStreamActive = false;
+	// Their answers died with the connection.
+	m_bListsRequested = false;
+	m_controllerListRequest = m_hmdListRequest = -1;
+}
+
+void PSMServiceSource::update() { PSM_Update(); }
+
+bool PSMServiceSource::getControllerList(
+	std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) {
+	PSMControllerList list;
+	if (PSM_GetControllerList(&list, PSM_DEFAULT_TIMEOUT) != PSMResult_Success) return false;
+	ids.assign(list.controller_id, list.controller_id + list.count);
+	types.assign(list.controller_type, list.controller_type + list.count);
+	return true;
+}
+
+PSMController *PSMServiceSource::getController(PSMControllerID id) { return PSM_GetController(id); }
+
+void PSMServiceSource::startControllerStreams(
+	const std::vector<PSMControllerID> &ids, unsigned int flags) {
+	m_bStreamActive = false;
+	for (auto it = ids.begin(); it < ids.end(); it++) {
+		PSMRequestID request_id;
+		PSM_AllocateControllerListener(*it);
+		PSM_StartControllerDataStreamAsync(*it, flags, &request_id);
+		PSM_RegisterCallback(request_id, handleStartStream, this);
+	}
+}
+
+void PSMServiceSource::stopControllerStreams(const std::vector<PSMControllerID> &ids) {
+	for (auto it = ids.begin(); it < ids.end(); it++) {
+		PSMRequestID request_id;
+		PSM_StopControllerDataStreamAsync(*it, &request_id);
+		PSM_EatResponse(request_id);
+		PSM_FreeControllerListener(*it);
+	}
+}
+
+void PSMServiceSource::handleControllerList(const PSMResponseMessage *response, void *userdata) {
+	PSMServiceSource *thisPtr = reinterpret_cast<PSMServiceSource *>(userdata);
+	if (response->request_id != thisPtr->m_controllerListRequest) return;
+	thisPtr->m_controllerListRequest = -1;
+	thisPtr->m_bListOk = response->result_code == PSMResult_Success;
+	if (thisPtr->m_bListOk) {
+		const PSMControllerList &list = response->payload.controller_list;
+		thisPtr->m_lists.controllers.assign(list.controller_id, list.controller_id + list.count);
+		thisPtr->m_lists.controllerTypes.assign(list.controller_type, list.controller_type + list.count);
+	}
+}
+
+void PSMServiceSource::handleHmdList(const PSMResponseMessage *response, void *userdata) {
+	PSMServiceSource *thisPtr = reinterpret_cast<PSMServiceSource *>(userdata);
+	if (response->request_id != thisPtr->m_hmdListRequest) return;
+	thisPtr->m_hmdListRequest = -1;
+	// A service without HMD support just has none.
+	if (response->result_code == PSMResult_Success) {
+		const PSMHmdList &list = response->payload.hmd_list;
+		thisPtr->m_lists.hmds.assign(list.hmd_id, list.hmd_id + list.count);
+		thisPtr->m_lists.hmdTypes.assign(list.hmd_type, list.hmd_type + list.count);
+	}
+}
+
+void PSMServiceSource::requestDeviceLists() {
+	m_bListsRequested = true;
+	m_bListOk = false;
+	m_lists = DeviceLists();
+	m_controllerListRequest = m_hmdListRequest = -1;
+	PSMRequestID request_id;
+	if (PSM_GetControllerListAsync(&request_id) == PSMResult_Success) {
+		m_controllerListRequest = request_id;
+		PSM_RegisterCallback(request_id, handleControllerList, this);
+	}
+	if (PSM_GetHmdListAsync(&request_id) == PSMResult_Success) {
+		m_hmdListRequest = request_id;
+		PSM_RegisterCallback(request_id, handleHmdList, this);
+	}
+}
+
+bool PSMServiceSource::takeDeviceLists(DeviceLists &lists, bool &ok) {
+	// The callbacks run from PSM_Update() on this thread.
+	if (!m_bListsRequested || m_controllerListRequest != -1 || m_hmdListRequest != -1)
+		return false;
+	m_bListsRequested = false;
+	ok = m_bListOk;
+	lists = m_lists;
+	return true;
+}
+
+bool PSMServiceSource::getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) {
+	PSMHmdList list;
+	if (PSM_GetHmdList(&list, PSM_DEFAULT_TIMEOUT) != PSMResult_Success) return false;
+	ids.assign(list.hmd_id, list.hmd_id + list.count);
+	types.assign(list.hmd_type, list.hmd_type + list.count);
+	return true;
+}
+
+void PSMServiceSource::startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) {
+	m_bStreamActive = false;
+	for (auto it = ids.begin(); it < ids.end(); it++) {
+		PSMRequestID request_id;
+		PSM_AllocateHmdListener(*it);
+		// PSMHmdDataStreamFlags share the values of the controller flags.
+		PSM_StartHmdDataStreamAsync(*it, flags, &request_id);
+		PSM_RegisterCallback(request_id, handleStartStream, this);
+	}
+}
+
+void PSMServiceSource::stopHmdStreams(const std::vector<PSMHmdID> &ids) {
+	for (auto it = ids.begin(); it < ids.end(); it++) {
+		PSMRequestID request_id;
+		PSM_StopHmdDataStreamAsync(*it, &request_id);
+		PSM_EatResponse(request_id);
+		PSM_FreeHmdListener(*it);
+	}
+}
+
+bool PSMServiceSource::getTrackerList(PSMTrackerList &list) {
+	return PSM_GetTrackerList(&list, PSM_DEFAULT_TIMEOUT) == PSMResult_Success;
+}
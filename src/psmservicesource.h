@@ -0,0 +1,53 @@
+#ifndef PSMSERVICESOURCE_H
+#define PSMSERVICESOURCE_H
+
+#include <string>
+#include "controllersource.h"
+
+// ControllerSource backed by a PSMoveService connection via PSMoveClient_CAPI.
+class PSMServiceSource : public ControllerSource {
+public:
+	PSMServiceSource(const std::string &address = PSMOVESERVICE_DEFAULT_ADDRESS,
+		const std::string &port = PSMOVESERVICE_DEFAULT_PORT);
+
+	bool connect() override;
+	void disconnect() override;
+	void update() override;
+	bool isConnected() const override { return PSM_GetIsConnected(); }
+	bool getControllerList(std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) override;
+	PSMController *getController(PSMControllerID id) override;
+	void startControllerStreams(const std::vector<PSMControllerID> &ids, unsigned int flags) override;
+	bool controllerStreamsActive() const override { return m_bStreamActive; }
+	void stopControllerStreams(const std::vector<PSMControllerID> &ids) override;
+	bool controllerListChanged() override {
+		// Both flags are cleared by reading them.
+		bool controllers = PSM_HasControllerListChanged();
+		bool hmds = PSM_HasHMDListChanged();
+		return controllers || hmds;
+	}
+	void requestDeviceLists() override;
+	bool takeDeviceLists(DeviceLists &lists, bool &ok) override;
+	bool getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) override;
+	PSMHeadMountedDisplay *getHmd(PSMHmdID id) override { return PSM_GetHmd(id); }
+	void startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) override;
+	void stopHmdStreams(const std::vector<PSMHmdID> &ids) override;
+	bool getTrackerList(PSMTrackerList &list) override;
+
+private:
+	static void handleStartStream(const PSMResponseMessage *response, void *userdata);
+	static void handleControllerList(const PSMResponseMessage *response, void *userdata);
+	static void handleHmdList(const PSMResponseMessage *response, void *userdata);
+
+	std::string m_address;
+	std::string m_port;
+	bool m_bStreamActive;
+	// requestDeviceLists() in flight; -1 once answered. Late answers to an
+	// earlier request are ignored.
+	PSMRequestID m_controllerListRequest = -1;
+	PSMRequestID m_hmdListRequest = -1;
+	bool m_bListsRequested = false;
+	bool m_bListOk = false;
+	DeviceLists m_lists;
+};
+
+#endif // PSMSERVICESOURCE_H
@@ -0,0 +1,333 @@
+#include "publisherthread.h"
+#include "threadutil.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Longest idle wait; bounds the cost of a missed wake-up.
+const int kMaxIdleWaitMs = 50;
+// Stack faulted in before the first push in real-time mode.
+const size_t kPrefaultStackBytes = 256 * 1024;
+
+PublisherThread::PublisherThread(QObject *parent)
+	: QThread(parent), m_combined(nullptr), m_chunkMaxLatency(0.0), m_cpu(-1), m_rtPriority(0), m_nextFlush(0.0), m_stop(false),
+	  m_idle(false), m_kinematicsLanes(kKinematicsBatchCapacity),
+	  m_changed(false) {}
+
+PublisherThread::~PublisherThread() { stopPublishing(); }
+
+void PublisherThread::startPublishing(const std::vector<DeviceStream *> &devices,
+	double chunkMaxLatency, int cpu, CombinedStream *combined, int rtPriority) {
+	stopPublishing();
+	m_devices = devices;
+	m_combined = combined;
+	for (DeviceStream *dev : m_devices)
+		if (dev->combinedSlot >= 0) m_combined->attach(dev->combinedSlot, dev->counters);
+	m_chunkMaxLatency = chunkMaxLatency;
+	m_cpu = cpu;
+	m_rtPriority = rtPriority;
+	m_nextFlush = std::numeric_limits<double>::infinity();
+	m_stop = false;
+	m_idle = false;
+	start(NormalPriority);
+}
+
+void PublisherThread::stopPublishing() {
+	if (isRunning()) {
+		m_stop = true;
+		m_wake.release();
+		wait();
+	}
+	applyDeviceChanges();
+	m_devices.clear();
+	m_combined = nullptr;
+}
+
+void PublisherThread::notifyData() {
+	// Pairs with the fence in run(): either the publisher sees the new ring
+	// contents, or we see that it went idle and wake it.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_idle.exchange(false)) m_wake.release();
+}
+
+void PublisherThread::addDevice(DeviceStream *dev) {
+	{
+		QMutexLocker locker(&m_changeLock);
+		m_added.push_back(dev);
+		m_changed.store(true);
+	}
+	notifyData();
+}
+
+void PublisherThread::retireDevice(DeviceStream *dev) {
+	{
+		QMutexLocker locker(&m_changeLock);
+		m_retired.push_back(dev);
+		m_changed.store(true);
+	}
+	notifyData();
+}
+
+void PublisherThread::applyDeviceChanges() {
+	QMutexLocker locker(&m_changeLock);
+	for (DeviceStream *dev : m_added) {
+		m_devices.push_back(dev);
+		if (dev->combinedSlot >= 0) m_combined->attach(dev->combinedSlot, dev->counters);
+	}
+	m_added.clear();
+	for (DeviceStream *dev : m_retired) {
+		auto it = std::find(m_devices.begin(), m_devices.end(), dev);
+		if (it != m_devices.end()) {
+			// Push whatever the ring still holds, then the pending chunk.
+			while (const ControllerSample *smp = dev->ring->front()) {
+				consume(*dev, *smp);
+				dev->ring->pop();
+			}
+			pushKinematics();
+			if (dev->pending > 0) flushDevice(*dev);
+			if (dev->combinedSlot >= 0) m_combined->detach(dev->combinedSlot);
+			m_devices.erase(it);
+		}
+		dev->released.store(true, std::memory_order_release);
+	}
+	m_retired.clear();
+	m_changed.store(false);
+}
+
+bool PublisherThread::anyQueued() const {
+	for (const DeviceStream *dev : m_devices)
+		if (dev->ring->front()) return true;
+	return false;
+}
+
+void PublisherThread::run() {
+	if (m_cpu >= 0 && !pinCurrentThread(m_cpu)) qDebug() << "Could not pin publisher to CPU" << m_cpu;
+	if (m_rtPriority > 0) {
+		if (!setRealtimePriority(m_rtPriority))
+			qDebug() << "Could not give publisher real-time priority" << m_rtPriority;
+		prefaultStack(kPrefaultStackBytes);
+	}
+
+	while (!m_stop.load()) {
+		if (m_changed.load()) applyDeviceChanges();
+		if (publish()) continue;
+
+		// Nothing to push: sleep until new data or the next chunk deadline.
+		m_idle.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!anyQueued() && !m_stop.load() && !m_changed.load()) {
+			int timeoutMs = kMaxIdleWaitMs;
+			if (m_nextFlush < std::numeric_limits<double>::infinity()) {
+				double untilFlush = m_nextFlush - lsl::local_clock();
+				timeoutMs = std::min(timeoutMs, std::max(0, (int)std::ceil(untilFlush * 1000.0)));
+			}
+			m_wake.tryAcquire(1, timeoutMs);
+		}
+		m_idle.store(false);
+	}
+
+	// Push what the acquisition thread left behind.
+	applyDeviceChanges();
+	publish();
+	for (DeviceStream *dev : m_devices)
+		if (dev->pending > 0) flushDevice(*dev);
+	if (m_combined) m_combined->flush();
+}
+
+bool PublisherThread::publish() {
+	bool b_pushedAny = false;
+	double now = lsl::local_clock();
+	m_nextFlush = std::numeric_limits<double>::infinity();
+
+	for (DeviceStream *devPtr : m_devices) {
+		DeviceStream &dev = *devPtr;
+		// Append every captured packet to the device's pending chunk.
+		while (const ControllerSample *smp = dev.ring->front()) {
+			consume(dev, *smp);
+			dev.ring->pop();
+			b_pushedAny = true;
+		}
+		if (dev.pending > 0) {
+			if (now - dev.firstPendingTime >= m_chunkMaxLatency) {
+				flushDevice(dev);
+			} else {
+				m_nextFlush = std::min(m_nextFlush, dev.firstPendingTime + m_chunkMaxLatency);
+			}
+		}
+	}
+	// One batch for what every device captured since the last pass.
+	pushKinematics();
+	if (m_combined) m_nextFlush = std::min(m_nextFlush, m_combined->poll(now, m_chunkMaxLatency));
+	return b_pushedAny;
+}
+
+void PublisherThread::consume(DeviceStream &dev, const ControllerSample &smp) {
+	if (dev.eventOutlet) {
+		// Pushed right away, only when something changed.
+		EventState packed = dev.packEvents(smp.state);
+		if (packed != dev.lastEvent) {
+			unpackEventState(packed, dev.eventButtons, dev.eventAxes, dev.eventSample.data());
+			dev.eventOutlet->push_sample(dev.eventSample.data(), smp.timestamp);
+			if (dev.log) dev.log->write(dev.eventLog, smp.timestamp, dev.eventSample.data());
+			dev.lastEvent = packed;
+		}
+	}
+	if (dev.readKinematics) queueKinematics(dev, smp);
+	if (dev.preview) {
+		dev.preview->countSample();
+		if (smp.captureTime >= dev.nextPreview) {
+			float values[kPreviewValues];
+			dev.readPreview(smp.state, values);
+			dev.preview->write(smp.timestamp, values);
+			dev.nextPreview = smp.captureTime + 1.0 / kPreviewRate;
+		}
+	}
+	if (dev.resampler)
+		appendResampled(dev, smp);
+	else
+		appendSample(dev, smp);
+}
+
+void PublisherThread::appendSample(DeviceStream &dev, const ControllerSample &smp) {
+	if (dev.fillIMU) {
+		float *s = dev.imuChunk.data() + dev.pending * dev.imuChannels;
+		dev.fillIMU(smp.state, s);
+		s[dev.imuChannels - kGapChannels] = (float)smp.skipped;
+	}
+	if (dev.fillPos) {
+		float *s = dev.posChunk.data() + dev.pending * dev.posChannels;
+		dev.fillPos(smp.state, s);
+		s[dev.posChannels - kGapChannels] = (float)smp.skipped;
+	}
+	commitPending(dev, smp.captureTime, smp.deviceTime, smp.timestamp);
+}
+
+void PublisherThread::appendResampled(DeviceStream &dev, const ControllerSample &smp) {
+	int imuChannels = dev.fillIMU ? dev.imuChannels : 0;
+	float *in = dev.resampleInput.data();
+	if (dev.fillIMU) dev.fillIMU(smp.state, in);
+	if (dev.fillPos) dev.fillPos(smp.state, in + imuChannels);
+	dev.resampleSkipped += smp.skipped;
+	dev.resampler->push(in, smp.deviceTime, smp.timestamp);
+
+	double deviceTime, timestamp;
+	while (const float *out = dev.resampler->next(deviceTime, timestamp)) {
+		if (dev.combinedSlot >= 0) {
+			m_combined->write(dev.combinedSlot, timestamp, out, out + imuChannels,
+				dev.resampleSkipped, smp.captureTime);
+			dev.resampleSkipped = 0;
+			continue;
+		}
+		if (dev.fillIMU) {
+			float *s = dev.imuChunk.data() + dev.pending * dev.imuChannels;
+			std::copy(out, out + dev.imuChannels, s);
+			s[dev.imuChannels - kGapChannels] = (float)dev.resampleSkipped;
+		}
+		if (dev.fillPos) {
+			float *s = dev.posChunk.data() + dev.pending * dev.posChannels;
+			std::copy(out + imuChannels, out + imuChannels + dev.posChannels, s);
+			s[dev.posChannels - kGapChannels] = (float)dev.resampleSkipped;
+		}
+		dev.resampleSkipped = 0;
+		commitPending(dev, smp.captureTime, deviceTime, timestamp);
+	}
+}
+
+void PublisherThread::commitPending(
+	DeviceStream &dev, double captureTime, double deviceTime, double timestamp) {
+	if (dev.pending == 0) {
+		dev.firstPendingTime = captureTime;
+		dev.pendingCaptureSum = 0.0;
+	}
+	dev.pendingCaptureSum += captureTime;
+	dev.timeChunk[dev.pending] = deviceTime;
+	dev.stamps[dev.pending++] = timestamp;
+	if (dev.pending >= dev.chunkCapacity) flushDevice(dev);
+}
+
+void PublisherThread::flushDevice(DeviceStream &dev) {
+	double pushStart = lsl::local_clock();
+	if (dev.compact) {
+		if (dev.fillIMU) {
+			dev.imuQuantizer.encode(dev.imuChunk.data(), dev.imuChunk16.data(), dev.pending);
+			dev.imuOutlet->push_chunk_multiplexed(
+				dev.imuChunk16.data(), dev.pending * dev.imuChannels, dev.stamps.data());
+		}
+		if (dev.fillPos) {
+			dev.posQuantizer.encode(dev.posChunk.data(), dev.posChunk16.data(), dev.pending);
+			dev.posOutlet->push_chunk_multiplexed(
+				dev.posChunk16.data(), dev.pending * dev.posChannels, dev.stamps.data());
+		}
+		if (dev.timeOutlet)
+			dev.timeOutlet->push_chunk_multiplexed(
+				dev.timeChunk.data(), dev.pending, dev.stamps.data());
+	} else if (dev.pending == 1) {
+		if (dev.fillIMU) dev.imuOutlet->push_sample(dev.imuChunk.data(), dev.stamps[0]);
+		if (dev.fillPos) dev.posOutlet->push_sample(dev.posChunk.data(), dev.stamps[0]);
+		if (dev.timeOutlet) dev.timeOutlet->push_sample(dev.timeChunk.data(), dev.stamps[0]);
+	} else {
+		if (dev.fillIMU)
+			dev.imuOutlet->push_chunk_multiplexed(
+				dev.imuChunk.data(), dev.pending * dev.imuChannels, dev.stamps.data());
+		if (dev.fillPos)
+			dev.posOutlet->push_chunk_multiplexed(
+				dev.posChunk.data(), dev.pending * dev.posChannels, dev.stamps.data());
+		if (dev.timeOutlet)
+			dev.timeOutlet->push_chunk_multiplexed(
+				dev.timeChunk.data(), dev.pending, dev.stamps.data());
+	}
+	double pushEnd = lsl::local_clock();
+	if (dev.log) {
+		// The same values the outlets got, so compact streams are logged as int16.
+		const void *imu = dev.compact ? (const void *)dev.imuChunk16.data() : dev.imuChunk.data();
+		const void *pos = dev.compact ? (const void *)dev.posChunk16.data() : dev.posChunk.data();
+		if (dev.fillIMU) dev.log->write(dev.imuLog, dev.stamps.data(), imu, dev.pending);
+		if (dev.fillPos) dev.log->write(dev.posLog, dev.stamps.data(), pos, dev.pending);
+		dev.log->write(dev.timeLog, dev.stamps.data(), dev.timeChunk.data(), dev.pending);
+	}
+
+	DeviceCounters &c = *dev.counters;
+	addCounter(c.packetsPushed, (uint64_t)dev.pending);
+	addCounter(c.pushes, (uint64_t)1);
+	addCounter(c.latencySum, dev.pending * pushEnd - dev.pendingCaptureSum);
+	raiseMax(c.latencyMax, pushEnd - dev.firstPendingTime);
+	c.pushLatency.record(pushEnd - dev.firstPendingTime);
+	addCounter(c.pushTimeSum, pushEnd - pushStart);
+	raiseMax(c.pushTimeMax, pushEnd - pushStart);
+	dev.pending = 0;
+}
+
+void PublisherThread::queueKinematics(DeviceStream &dev, const ControllerSample &smp) {
+	if (m_kinematics.full()) pushKinematics();
+	KinematicsInput in;
+	dev.readKinematics(smp.state, in);
+	size_t lane = m_kinematics.add(dev.kinematicsHistory, smp.timestamp, in);
+	m_kinematicsLanes[lane] = {&dev, smp.timestamp, smp.skipped};
+}
+
+void PublisherThread::pushKinematics() {
+	const size_t lanes = m_kinematics.size();
+	if (lanes == 0) return;
+	m_kinematics.compute();
+	for (size_t lane = 0; lane < lanes; lane++) {
+		const KinematicsLane &l = m_kinematicsLanes[lane];
+		DeviceStream &dev = *l.dev;
+		float *s = dev.kinematicsChunk.data() + dev.kinematicsPending * kKinematicsChannels;
+		m_kinematics.read(lane, s);
+		s[kKinematicsChannels - kGapChannels] = (float)l.skipped;
+		dev.kinematicsStamps[dev.kinematicsPending++] = l.timestamp;
+	}
+	// Lanes are in packet order per device; push each device's run once.
+	for (size_t lane = 0; lane < lanes; lane++) {
+		DeviceStream &dev = *m_kinematicsLanes[lane].dev;
+		if (dev.kinematicsPending == 0) continue;
+		dev.kinematicsOutlet->push_chunk_multiplexed(dev.kinematicsChunk.data(),
+			dev.kinematicsPending * kKinematicsChannels, dev.kinematicsStamps.data());
+		if (dev.log)
+			dev.log->write(dev.kinematicsLog, dev.kinematicsStamps.data(), dev.kinematicsChunk.data(),
+				dev.kinematicsPending);
+		dev.kinematicsPending = 0;
+	}
+	m_kinematics.clear();
+}
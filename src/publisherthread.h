@@ -0,0 +1,84 @@
+#ifndef PUBLISHERTHREAD_H
+#define PUBLISHERTHREAD_H
+
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+#include <atomic>
+#include <vector>
+#include "combinedstream.h"
+#include "devicestream.h"
+
+// Second stage of the streaming pipeline: drains the rings that the
+// acquisition thread fills and pushes the samples into the LSL outlets, so a
+// slow consumer or a blocking push never delays PSM_Update() polling. When
+// there is nothing to push it sleeps until the acquisition thread signals new
+// data or a pending chunk's deadline comes up.
+class PublisherThread : public QThread
+{
+    Q_OBJECT
+
+public:
+	PublisherThread(QObject *parent = 0);
+    ~PublisherThread();
+
+	// Starts publishing the given devices; the caller keeps them alive until stopPublishing().
+	// If cpu >= 0 the thread pins itself to that CPU; with rtPriority > 0 it
+	// runs real-time at that priority. Devices with a combinedSlot go into
+	// combined instead of their own outlets.
+	void startPublishing(const std::vector<DeviceStream *> &devices, double chunkMaxLatency,
+		int cpu = -1, CombinedStream *combined = nullptr, int rtPriority = 0);
+	// Pushes whatever is still queued, flushes all chunks and joins the thread.
+	void stopPublishing();
+	// Called by the acquisition thread after it captured new samples. Lock-free
+	// unless the publisher is idle.
+	void notifyData();
+	// Hot-plug: starts publishing one more device while running.
+	void addDevice(DeviceStream *dev);
+	// Hot-plug: the caller has stopped writing dev's ring. The publisher pushes
+	// what is left, flushes and drops it, then sets dev->released; the caller
+	// frees dev only after that.
+	void retireDevice(DeviceStream *dev);
+
+protected:
+    void run() override;
+
+private:
+	bool publish();			  // Drain all rings once. Returns true if anything was pushed.
+	bool anyQueued() const;
+	void applyDeviceChanges();
+	void consume(DeviceStream &dev, const ControllerSample &smp); // Events, then the channels.
+	void appendSample(DeviceStream &dev, const ControllerSample &smp);
+	void appendResampled(DeviceStream &dev, const ControllerSample &smp);
+	// Completes the chunk slot whose channels were just written; flushes a full chunk.
+	void commitPending(DeviceStream &dev, double captureTime, double deviceTime, double timestamp);
+	void flushDevice(DeviceStream &dev);
+	void queueKinematics(DeviceStream &dev, const ControllerSample &smp);
+	void pushKinematics();	  // Compute m_kinematics and push each device's lanes.
+
+	std::vector<DeviceStream *> m_devices;
+	CombinedStream *m_combined;
+	double m_chunkMaxLatency;
+	int m_cpu;
+	int m_rtPriority;
+	double m_nextFlush;		  // Earliest pending chunk deadline.
+	std::atomic<bool> m_stop;
+	std::atomic<bool> m_idle; // Publisher is (about to be) waiting on m_wake.
+	QSemaphore m_wake;
+	// Packets of all devices awaiting derived kinematics, and whose they are.
+	struct KinematicsLane {
+		DeviceStream *dev;
+		double timestamp;
+		int skipped;
+	};
+	KinematicsBatch m_kinematics;
+	std::vector<KinematicsLane> m_kinematicsLanes;
+
+	// Hot-plug requests, applied by the publisher between publish() passes.
+	QMutex m_changeLock;
+	std::vector<DeviceStream *> m_added;
+	std::vector<DeviceStream *> m_retired;
+	std::atomic<bool> m_changed;
+};
+
+#endif // PUBLISHERTHREAD_H
@@ -0,0 +1,120 @@
+#include "quantize.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+// Encodable range, kept symmetric; -32768 is reserved for NaN.
+const float kMaxCode = 32767.0f;
+// 1.5 * 2^23: adding it leaves no fraction bits, so encode() can round to an
+// integer without a call. Exact for values within 2^22 periods.
+const float kRoundBias = 12582912.0f;
+
+uint32_t toBits(float x) {
+	uint32_t bits;
+	std::memcpy(&bits, &x, sizeof bits);
+	return bits;
+}
+
+float fromBits(uint32_t bits) {
+	float x;
+	std::memcpy(&x, &bits, sizeof x);
+	return x;
+}
+
+// All bits set if condition holds, else none.
+uint32_t mask(bool condition) { return 0u - (uint32_t)condition; }
+} // namespace
+
+ChannelEncoding channelEncoding(const QString &label) {
+	// Drop the "<id>_" prefix of combined streams.
+	QString name = label;
+	int sep = name.indexOf('_');
+	bool isId = false;
+	if (sep > 0) name.left(sep).toInt(&isId);
+	if (isId) name = name.mid(sep + 1);
+
+	ChannelEncoding enc;
+	bool raw = name.startsWith("raw_");
+	if (raw) name = name.mid(4);
+	if (name == "timestamp") {
+		// 1 ms steps within the minute.
+		enc.scale = 0.001f;
+		enc.offset = 30.0f;
+		enc.period = 60.0f;
+	} else if (raw || name == "SeqGap" || name == "Valid") {
+		// Integer counts.
+	} else if (name.startsWith("Accel.")) {
+		enc.scale = 1.0f / 4096.0f; // g; the PSMove accelerometer's own resolution, +-8 g.
+	} else if (name.startsWith("Gyro.")) {
+		enc.scale = 0.00106f; // rad/s, +-34.7 rad/s.
+	} else if (name.startsWith("Mag.")) {
+		enc.scale = 1.0f / 16384.0f; // Normalized field, +-2.
+	} else if (name.startsWith("Pos.orient_")) {
+		enc.scale = 1.0f / kMaxCode;
+	} else if (name.startsWith("Pos.") || name.startsWith("RelativePosition.")) {
+		enc.scale = 0.02f; // cm, +-655 cm.
+	}
+	return enc;
+}
+
+Quantizer::Quantizer(const QStringList &labels) {
+	for (const QString &label : labels) {
+		ChannelEncoding enc = channelEncoding(label);
+		m_encodings.push_back(enc);
+		m_invScale.push_back(1.0f / enc.scale);
+		m_offset.push_back(enc.offset);
+		m_period.push_back(enc.period);
+		m_invPeriod.push_back(enc.period > 0.0f ? 1.0f / enc.period : 0.0f);
+	}
+}
+
+void Quantizer::encode(const float *in, int16_t *out, size_t samples) const {
+	const int n = channels();
+	const float *__restrict invScale = m_invScale.data();
+	const float *__restrict offset = m_offset.data();
+	const float *__restrict period = m_period.data();
+	const float *__restrict invPeriod = m_invPeriod.data();
+	for (size_t smp = 0; smp < samples; smp++, in += n, out += n) {
+		const float *__restrict src = in;
+		int16_t *__restrict dst = out;
+		for (int ch = 0; ch < n; ch++) {
+			// Masks and plain arithmetic only, so the loop vectorizes: a
+			// conditional float operation may trap, which keeps GCC from
+			// if-converting it. NaN and infinity go through as 0.
+			const uint32_t bits = toBits(src[ch]);
+			const uint32_t isNaN = mask((bits & 0x7fffffffu) >= 0x7f800000u);
+			float x = fromBits(bits & ~isNaN);
+			// x -= period * floor(x / period); invPeriod is 0 unless the
+			// channel wraps. Adding and subtracting kRoundBias rounds to an
+			// integer, which is then corrected downwards where it rounded up.
+			float y = x * invPeriod[ch];
+			float wraps = (y + kRoundBias) - kRoundBias;
+			wraps -= fromBits(toBits(1.0f) & mask(wraps > y));
+			x -= period[ch] * wraps;
+			float q = (x - offset[ch]) * invScale[ch];
+			q += std::copysign(0.5f, q); // Round half away from zero.
+			q = q < -kMaxCode ? -kMaxCode : (q > kMaxCode ? kMaxCode : q);
+			const uint32_t code = (uint32_t)(int32_t)q;
+			dst[ch] = (int16_t)((code & ~isNaN) | ((uint32_t)(int32_t)kQuantizedNaN & isNaN));
+		}
+	}
+}
+
+void Quantizer::decode(const int16_t *in, float *out, size_t samples) const {
+	const int n = channels();
+	for (size_t smp = 0; smp < samples; smp++, in += n, out += n) {
+		for (int ch = 0; ch < n; ch++) {
+			const ChannelEncoding &enc = m_encodings[ch];
+			out[ch] = in[ch] == kQuantizedNaN ? std::numeric_limits<float>::quiet_NaN()
+											  : in[ch] * enc.scale + enc.offset;
+		}
+	}
+}
+
+void Quantizer::describe(lsl::xml_element channel, const ChannelEncoding &encoding) {
+	channel.append_child_value("scale", QString::number(encoding.scale, 'g', 9).toStdString())
+		.append_child_value("offset", QString::number(encoding.offset, 'g', 9).toStdString());
+	if (encoding.period > 0.0f)
+		channel.append_child_value("period", QString::number(encoding.period, 'g', 9).toStdString());
+}
@@ -0,0 +1,52 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <QStringList>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "lsl_cpp.h"
+
+// Compact int16 encoding of the float channels. Each channel has a fixed
+// scale and offset, value = code * scale + offset, chosen from its label so
+// the sensors' native resolution is kept where it fits: raw ADC counts as-is,
+// quaternions at 1/32767, positions at 0.02 cm. Device timestamps are reduced
+// modulo their period first (the full value is in PSMoveDeviceTime). Values
+// beyond the range saturate; NaN and infinity are encoded as kQuantizedNaN.
+
+const int16_t kQuantizedNaN = -32768;
+
+struct ChannelEncoding {
+	float scale = 1.0f;
+	float offset = 0.0f;
+	float period = 0.0f; // > 0: the value is reduced modulo period before encoding.
+};
+
+// The encoding for a channel label such as "raw_Gyro.x" or "3_Pos.orient_w".
+ChannelEncoding channelEncoding(const QString &label);
+
+class Quantizer {
+public:
+	Quantizer() {}
+	explicit Quantizer(const QStringList &labels);
+
+	int channels() const { return (int)m_encodings.size(); }
+	const ChannelEncoding &encoding(int channel) const { return m_encodings[channel]; }
+
+	// Encodes samples * channels() values. Plain loops over precomputed
+	// per-channel factors, so the compiler can vectorize them.
+	void encode(const float *in, int16_t *out, size_t samples) const;
+	void decode(const int16_t *in, float *out, size_t samples) const;
+
+	// Adds scale, offset and, for wrapped channels, period to a <channel> element.
+	static void describe(lsl::xml_element channel, const ChannelEncoding &encoding);
+
+private:
+	std::vector<ChannelEncoding> m_encodings;
+	std::vector<float> m_invScale;
+	std::vector<float> m_offset;
+	std::vector<float> m_period;
+	std::vector<float> m_invPeriod; // 0 for channels that do not wrap.
+};
+
+#endif // QUANTIZE_H
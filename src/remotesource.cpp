@@ -0,0 +1,550 @@
+#include "remotesource.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QProcess>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <lsl_cpp.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Frames in both directions are a FrameHeader followed by size bytes of
+// payload, in native layout; both ends are built from the same tree.
+enum class EndpointMessage : uint32_t {
+	Hello,		   // Worker: int32 connected.
+	List,		   // Bridge: int32 kind. Answered with ListReply.
+	ListReply,	   // int32 kind, int32 ok, int32 count, then count times int32 id, int32 type and state.
+	Start,		   // Bridge: int32 kind, uint32 flags, int32 count, count int32 ids.
+	Stop,		   // Bridge: int32 kind, int32 count, count int32 ids.
+	Trackers,	   // Bridge. Answered with TrackersReply.
+	TrackersReply, // int32 ok, PSMTrackerList.
+	Packet,		   // Worker: int32 kind, int32 id, double receive time, state.
+	Status,		   // Worker: int32 streams active, int32 list changed; sent on change.
+};
+
+namespace {
+const char *const kWorkerProgram = "PSMoveLSLEndpoint"; // Next to the bridge's executable.
+const int kStartTimeoutMs = 5000;
+const int kReplyTimeoutMs = 3000; // The worker's own calls time out after PSM_DEFAULT_TIMEOUT.
+const int kExitTimeoutMs = 1000;
+const unsigned long kServePollUs = 500; // Worker process poll period.
+const int32_t kControllerKind = 0;
+const int32_t kHmdKind = 1;
+
+struct FrameHeader {
+	EndpointMessage type;
+	uint32_t size;
+};
+
+template <class T> void put(QByteArray &payload, const T &value) {
+	payload.append(reinterpret_cast<const char *>(&value), (int)sizeof(T));
+}
+
+// Reads values off a payload in order; false once it runs short.
+class PayloadReader {
+public:
+	explicit PayloadReader(const QByteArray &payload)
+		: m_pos(payload.constData()), m_end(payload.constData() + payload.size()) {}
+	template <class T> bool get(T &value) {
+		if (m_end - m_pos < (std::ptrdiff_t)sizeof(T)) return false;
+		std::memcpy(&value, m_pos, sizeof(T));
+		m_pos += sizeof(T);
+		return true;
+	}
+
+private:
+	const char *m_pos;
+	const char *m_end;
+};
+
+QByteArray frame(EndpointMessage type, const QByteArray &payload) {
+	QByteArray bytes;
+	put(bytes, FrameHeader{type, (uint32_t)payload.size()});
+	bytes.append(payload);
+	return bytes;
+}
+
+// Splits the next whole frame off buffer. False if there is none yet.
+bool takeFrame(QByteArray &buffer, EndpointMessage &type, QByteArray &payload) {
+	FrameHeader header;
+	if (buffer.size() < (int)sizeof(header)) return false;
+	std::memcpy(&header, buffer.constData(), sizeof(header));
+	if (buffer.size() < (int)(sizeof(header) + header.size)) return false;
+	type = header.type;
+	payload = buffer.mid(sizeof(header), header.size);
+	buffer.remove(0, sizeof(header) + header.size);
+	return true;
+}
+
+template <class T> const T *deviceState(ControllerSource &source, int id);
+template <> const PSMController *deviceState(ControllerSource &source, int id) {
+	return source.getController(id);
+}
+template <> const PSMHeadMountedDisplay *deviceState(ControllerSource &source, int id) {
+	return source.getHmd(id);
+}
+} // namespace
+
+RemoteSource::RemoteSource(const QString &name, const QStringList &arguments)
+	: m_name(name), m_arguments(arguments) {}
+
+RemoteSource::~RemoteSource() { disconnect(); }
+
+bool RemoteSource::connect() {
+	disconnect();
+	m_process.reset(new QProcess());
+	// The worker's log lines end up in the bridge's.
+	m_process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	QString program = QCoreApplication::applicationDirPath() + "/" + kWorkerProgram;
+	m_process->start(program, m_arguments);
+	if (!m_process->waitForStarted(kStartTimeoutMs)) {
+		qDebug() << "Could not start" << program << ":" << m_process->errorString();
+		return false;
+	}
+	m_bConnected = true;
+	QByteArray reply;
+	int32_t ok = 0;
+	if (!awaitReply(EndpointMessage::Hello, reply) || !PayloadReader(reply).get(ok) || !ok) {
+		m_bConnected = false;
+		return false;
+	}
+	m_bListChanged = true;
+	return true;
+}
+
+void RemoteSource::disconnect() {
+	if (m_process) {
+		// The worker leaves once its stdin closes.
+		m_process->closeWriteChannel();
+		if (!m_process->waitForFinished(kExitTimeoutMs)) {
+			m_process->kill();
+			m_process->waitForFinished(kExitTimeoutMs);
+		}
+		m_process.reset();
+	}
+	m_bConnected = false;
+	m_bStreamsActive = false;
+	m_bListChanged = false;
+	m_bReply = false;
+	m_buffer.clear();
+	m_packets.clear();
+	m_controllers.clear();
+	m_hmds.clear();
+}
+
+void RemoteSource::update() {
+	if (!receive(0)) return;
+	m_drained.clear();
+	while (!m_packets.empty()) {
+		const QByteArray &payload = m_packets.front();
+		PayloadReader reader(payload);
+		int32_t kind, id;
+		if (!reader.get(kind) || !reader.get(id)) {
+			m_packets.pop_front();
+			continue;
+		}
+		// A second packet of a device waits, with those behind it, for the next call.
+		int drained = kind == kHmdKind ? ~id : id;
+		if (std::find(m_drained.begin(), m_drained.end(), drained) != m_drained.end()) break;
+		m_drained.push_back(drained);
+		if (kind == kHmdKind)
+			applyPacket(m_hmds, payload);
+		else
+			applyPacket(m_controllers, payload);
+		m_packets.pop_front();
+	}
+}
+
+bool RemoteSource::isConnected() const {
+	return m_bConnected && m_process && m_process->state() == QProcess::Running;
+}
+
+bool RemoteSource::controllerListChanged() {
+	bool changed = m_bListChanged;
+	m_bListChanged = false;
+	return changed;
+}
+
+template <class T> RemoteSource::View<T> &RemoteSource::view(ViewMap<T> &views, int id) {
+	std::unique_ptr<View<T>> &v = views[id];
+	if (!v) v.reset(new View<T>());
+	return *v;
+}
+
+template <class T, class Type>
+bool RemoteSource::listDevices(int kind, ViewMap<T> &views, std::vector<int> &ids, std::vector<Type> &types) {
+	QByteArray request, reply;
+	put(request, (int32_t)kind);
+	if (!send(EndpointMessage::List, request) || !awaitReply(EndpointMessage::ListReply, reply))
+		return false;
+	PayloadReader reader(reply);
+	int32_t replyKind, ok, count;
+	if (!reader.get(replyKind) || !reader.get(ok) || !reader.get(count) || replyKind != kind || !ok)
+		return false;
+	ids.clear();
+	types.clear();
+	for (int32_t ix = 0; ix < count; ix++) {
+		int32_t id, type;
+		T state;
+		if (!reader.get(id) || !reader.get(type) || !reader.get(state)) return false;
+		View<T> &v = view(views, id);
+		// A streamed view follows the packets; the listing may be ahead of those still queued.
+		if (!v.streamed) v.state = state;
+		ids.push_back(id);
+		types.push_back((Type)type);
+	}
+	return true;
+}
+
+template <class T> void RemoteSource::applyPacket(ViewMap<T> &views, const QByteArray &payload) {
+	PayloadReader reader(payload);
+	int32_t kind, id;
+	double time;
+	T state;
+	if (!reader.get(kind) || !reader.get(id) || !reader.get(time) || !reader.get(state)) return;
+	View<T> &v = view(views, id);
+	v.state = state;
+	v.streamed = true;
+	v.time = time;
+}
+
+void RemoteSource::sendStreams(
+	EndpointMessage type, int kind, const std::vector<int> &ids, unsigned int flags) {
+	QByteArray payload;
+	put(payload, (int32_t)kind);
+	if (type == EndpointMessage::Start) put(payload, (uint32_t)flags);
+	put(payload, (int32_t)ids.size());
+	for (int id : ids) put(payload, (int32_t)id);
+	send(type, payload);
+}
+
+bool RemoteSource::send(EndpointMessage type, const QByteArray &payload) {
+	if (!isConnected()) return false;
+	m_process->write(frame(type, payload));
+	// Without an event loop, QProcess only moves data in its waitFor calls.
+	if (!m_process->waitForBytesWritten(kReplyTimeoutMs)) {
+		qDebug() << "Endpoint worker" << m_name << "stopped reading.";
+		m_bConnected = false;
+		return false;
+	}
+	return true;
+}
+
+bool RemoteSource::receive(int timeoutMs) {
+	if (!isConnected()) return false;
+	if (m_process->bytesAvailable() == 0) m_process->waitForReadyRead(timeoutMs);
+	m_buffer.append(m_process->readAllStandardOutput());
+	EndpointMessage type;
+	QByteArray payload;
+	while (takeFrame(m_buffer, type, payload)) {
+		if (type == EndpointMessage::Packet) {
+			m_packets.push_back(payload);
+		} else if (type == EndpointMessage::Status) {
+			PayloadReader reader(payload);
+			int32_t active, changed;
+			if (!reader.get(active) || !reader.get(changed)) continue;
+			m_bStreamsActive = active != 0;
+			if (changed) m_bListChanged = true;
+		} else {
+			m_bReply = true;
+			m_replyType = type;
+			m_reply = payload;
+		}
+	}
+	return true;
+}
+
+bool RemoteSource::awaitReply(EndpointMessage type, QByteArray &payload) {
+	double deadline = lsl::local_clock() + kReplyTimeoutMs / 1000.0;
+	while (!m_bReply) {
+		int left = (int)((deadline - lsl::local_clock()) * 1000.0);
+		if (left <= 0 || !receive(left)) {
+			qDebug() << "No answer from endpoint worker" << m_name << "; dropping it.";
+			m_bConnected = false;
+			return false;
+		}
+	}
+	m_bReply = false;
+	if (m_replyType != type) {
+		qDebug() << "Unexpected answer from endpoint worker" << m_name << "; dropping it.";
+		m_bConnected = false;
+		return false;
+	}
+	payload = m_reply;
+	return true;
+}
+
+bool RemoteSource::getControllerList(std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) {
+	return listDevices(kControllerKind, m_controllers, ids, types);
+}
+
+PSMController *RemoteSource::getController(PSMControllerID id) {
+	auto it = m_controllers.find(id);
+	return it != m_controllers.end() ? &it->second->state : nullptr;
+}
+
+void RemoteSource::startControllerStreams(
+	const std::vector<PSMControllerID> &ids, unsigned int flags) {
+	m_bStreamsActive = false;
+	sendStreams(EndpointMessage::Start, kControllerKind, ids, flags);
+}
+
+void RemoteSource::stopControllerStreams(const std::vector<PSMControllerID> &ids) {
+	sendStreams(EndpointMessage::Stop, kControllerKind, ids, 0);
+	for (int id : ids) view(m_controllers, id).streamed = false;
+}
+
+bool RemoteSource::getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) {
+	return listDevices(kHmdKind, m_hmds, ids, types);
+}
+
+PSMHeadMountedDisplay *RemoteSource::getHmd(PSMHmdID id) {
+	auto it = m_hmds.find(id);
+	return it != m_hmds.end() ? &it->second->state : nullptr;
+}
+
+void RemoteSource::startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) {
+	m_bStreamsActive = false;
+	sendStreams(EndpointMessage::Start, kHmdKind, ids, flags);
+}
+
+void RemoteSource::stopHmdStreams(const std::vector<PSMHmdID> &ids) {
+	sendStreams(EndpointMessage::Stop, kHmdKind, ids, 0);
+	for (int id : ids) view(m_hmds, id).streamed = false;
+}
+
+double RemoteSource::controllerPacketTime(PSMControllerID id) {
+	auto it = m_controllers.find(id);
+	return it != m_controllers.end() && it->second->streamed ? it->second->time : 0.0;
+}
+
+double RemoteSource::hmdPacketTime(PSMHmdID id) {
+	auto it = m_hmds.find(id);
+	return it != m_hmds.end() && it->second->streamed ? it->second->time : 0.0;
+}
+
+bool RemoteSource::getTrackerList(PSMTrackerList &list) {
+	QByteArray reply;
+	if (!send(EndpointMessage::Trackers) || !awaitReply(EndpointMessage::TrackersReply, reply))
+		return false;
+	PayloadReader reader(reply);
+	int32_t ok;
+	return reader.get(ok) && ok && reader.get(list);
+}
+
+namespace {
+// The bridge's frames, read off stdin by their own thread so the poll loop
+// never blocks on it.
+struct CommandQueue {
+	QMutex lock;
+	std::deque<std::pair<EndpointMessage, QByteArray>> commands;
+	std::atomic<bool> closed{false};
+};
+
+void readCommands(std::shared_ptr<CommandQueue> queue) {
+	FrameHeader header;
+	while (std::fread(&header, sizeof(header), 1, stdin) == 1) {
+		QByteArray payload((int)header.size, '\0');
+		if (header.size > 0 && std::fread(payload.data(), header.size, 1, stdin) != 1) break;
+		QMutexLocker locker(&queue->lock);
+		queue->commands.emplace_back(header.type, payload);
+	}
+	queue->closed = true;
+}
+
+void writeFrame(EndpointMessage type, const QByteArray &payload) {
+	QByteArray bytes = frame(type, payload);
+	std::fwrite(bytes.constData(), 1, bytes.size(), stdout);
+}
+
+// What the worker streams of its source, and the sequence number last sent of each.
+class EndpointServer {
+public:
+	explicit EndpointServer(ControllerSource &source) : m_source(source) {}
+
+	void handle(EndpointMessage type, const QByteArray &payload) {
+		PayloadReader reader(payload);
+		int32_t kind = kControllerKind;
+		if (type != EndpointMessage::Trackers && !reader.get(kind)) return;
+		if (kind != kHmdKind) kind = kControllerKind;
+		if (type == EndpointMessage::List) {
+			QByteArray reply;
+			if (kind == kHmdKind)
+				listStates<PSMHeadMountedDisplay>(kind, reply);
+			else
+				listStates<PSMController>(kind, reply);
+			writeFrame(EndpointMessage::ListReply, reply);
+		} else if (type == EndpointMessage::Start || type == EndpointMessage::Stop) {
+			uint32_t flags = 0;
+			int32_t count;
+			if (type == EndpointMessage::Start && !reader.get(flags)) return;
+			if (!reader.get(count)) return;
+			std::vector<int> ids;
+			for (int32_t id; count-- > 0 && reader.get(id);) ids.push_back(id);
+			if (type == EndpointMessage::Start)
+				start(kind, ids, flags);
+			else
+				stop(kind, ids);
+		} else if (type == EndpointMessage::Trackers) {
+			QByteArray reply;
+			PSMTrackerList list;
+			int32_t ok = m_source.getTrackerList(list);
+			put(reply, ok);
+			if (ok) put(reply, list);
+			writeFrame(EndpointMessage::TrackersReply, reply);
+		}
+	}
+
+	// False once the source lost its connection.
+	bool poll() {
+		m_source.update();
+		double now = lsl::local_clock();
+		if (!m_source.isConnected()) return false;
+		bool changed = m_source.controllerListChanged();
+		bool active = m_source.controllerStreamsActive();
+		if (changed || active != m_bStreamsActive) {
+			m_bStreamsActive = active;
+			QByteArray status;
+			put(status, (int32_t)active);
+			put(status, (int32_t)changed);
+			writeFrame(EndpointMessage::Status, status);
+		}
+		forward<PSMController>(kControllerKind, now);
+		forward<PSMHeadMountedDisplay>(kHmdKind, now);
+		return true;
+	}
+
+private:
+	struct Streams {
+		std::vector<int> ids;
+		std::vector<int> lastSeq;
+	};
+
+	template <class T> void listStates(int32_t kind, QByteArray &reply) {
+		std::vector<int> ids;
+		std::vector<PSMControllerType> controllerTypes;
+		std::vector<PSMHmdType> hmdTypes;
+		int32_t ok = kind == kHmdKind ? m_source.getHmdList(ids, hmdTypes)
+									  : m_source.getControllerList(ids, controllerTypes);
+		struct Listed {
+			int32_t id;
+			int32_t type;
+			const T *state;
+		};
+		std::vector<Listed> listed;
+		for (size_t ix = 0; ix < ids.size(); ix++) {
+			const T *state = deviceState<T>(m_source, ids[ix]);
+			if (!state) continue;
+			int32_t type = kind == kHmdKind ? (int32_t)hmdTypes[ix] : (int32_t)controllerTypes[ix];
+			listed.push_back({ids[ix], type, state});
+		}
+		put(reply, kind);
+		put(reply, ok);
+		put(reply, (int32_t)listed.size());
+		for (const Listed &device : listed) {
+			put(reply, device.id);
+			put(reply, device.type);
+			put(reply, *device.state);
+		}
+	}
+
+	void start(int32_t kind, const std::vector<int> &ids, unsigned int flags) {
+		Streams &streams = m_streams[kind];
+		for (int id : ids) {
+			if (std::find(streams.ids.begin(), streams.ids.end(), id) != streams.ids.end()) continue;
+			streams.ids.push_back(id);
+			streams.lastSeq.push_back(-1);
+		}
+		if (kind == kHmdKind)
+			m_source.startHmdStreams(ids, flags);
+		else
+			m_source.startControllerStreams(ids, flags);
+	}
+
+	void stop(int32_t kind, const std::vector<int> &ids) {
+		Streams &streams = m_streams[kind];
+		for (int id : ids) {
+			auto it = std::find(streams.ids.begin(), streams.ids.end(), id);
+			if (it == streams.ids.end()) continue;
+			streams.lastSeq.erase(streams.lastSeq.begin() + (it - streams.ids.begin()));
+			streams.ids.erase(it);
+		}
+		if (kind == kHmdKind)
+			m_source.stopHmdStreams(ids);
+		else
+			m_source.stopControllerStreams(ids);
+	}
+
+	template <class T> void forward(int32_t kind, double now) {
+		Streams &streams = m_streams[kind];
+		for (size_t ix = 0; ix < streams.ids.size(); ix++) {
+			int id = streams.ids[ix];
+			const T *state = deviceState<T>(m_source, id);
+			if (!state || state->OutputSequenceNum == streams.lastSeq[ix]) continue;
+			double received =
+				kind == kHmdKind ? m_source.hmdPacketTime(id) : m_source.controllerPacketTime(id);
+			QByteArray packet;
+			put(packet, kind);
+			put(packet, (int32_t)id);
+			put(packet, received > 0.0 ? received : now);
+			put(packet, *state);
+			writeFrame(EndpointMessage::Packet, packet);
+			streams.lastSeq[ix] = state->OutputSequenceNum;
+		}
+	}
+
+	ControllerSource &m_source;
+	Streams m_streams[2]; // By kind.
+	bool m_bStreamsActive = false;
+};
+} // namespace
+
+int serveEndpoint(ControllerSource &source) {
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	int32_t ok = source.connect();
+	QByteArray hello;
+	put(hello, ok);
+	writeFrame(EndpointMessage::Hello, hello);
+	std::fflush(stdout);
+	if (!ok) {
+		source.disconnect();
+		return 1;
+	}
+
+	// Detached: it may still be blocked in fread() when the process exits.
+	std::shared_ptr<CommandQueue> queue = std::make_shared<CommandQueue>();
+	std::thread(readCommands, queue).detach();
+
+	EndpointServer server(source);
+	int exitCode = 0;
+	std::deque<std::pair<EndpointMessage, QByteArray>> commands;
+	while (!queue->closed) {
+		{
+			QMutexLocker locker(&queue->lock);
+			commands.swap(queue->commands);
+		}
+		for (auto &command : commands) server.handle(command.first, command.second);
+		commands.clear();
+		if (!server.poll()) {
+			qDebug() << "Lost the connection to PSMoveService.";
+			exitCode = 1;
+			break;
+		}
+		std::fflush(stdout);
+		std::this_thread::sleep_for(std::chrono::microseconds(kServePollUs));
+	}
+	source.disconnect();
+	return exitCode;
+}
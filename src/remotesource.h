@@ -0,0 +1,99 @@
+#ifndef REMOTESOURCE_H
+#define REMOTESOURCE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include "controllersource.h"
+
+class QProcess;
+enum class EndpointMessage : uint32_t;
+
+// ControllerSource in a PSMoveLSLEndpoint worker process with a PSMoveService
+// connection of its own. PSMoveClient_CAPI keeps one global connection per
+// process, so this is how AggregateSource reaches a second service; a
+// simulator can be served the same way, to exercise the whole path. The
+// worker stamps each packet with local_clock() as it reads it (both
+// processes share that clock) and sends it over its stdout; commands and
+// list queries go the other way over its stdin. The process belongs to the
+// thread that called connect(), so every call must come from that thread;
+// AggregateSource makes all of them on the endpoint's worker. Losing the
+// service ends the process, which isConnected() then reports.
+class RemoteSource : public ControllerSource {
+public:
+	// arguments is the worker's command line: address and port, or
+	// "simulator" and its optional seed, controllers and rate. name is for
+	// log messages.
+	RemoteSource(const QString &name, const QStringList &arguments);
+	~RemoteSource() override;
+
+	bool connect() override;	// Starts the worker and waits for its connection.
+	void disconnect() override; // Stops the worker.
+	// Reads what the worker sent. Like AggregateSource::update(), takes at most
+	// one queued packet per device and leaves packetsPending() for the rest.
+	void update() override;
+	bool isConnected() const override;
+	bool getControllerList(std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) override;
+	PSMController *getController(PSMControllerID id) override;
+	void startControllerStreams(const std::vector<PSMControllerID> &ids, unsigned int flags) override;
+	bool controllerStreamsActive() const override { return m_bStreamsActive; }
+	void stopControllerStreams(const std::vector<PSMControllerID> &ids) override;
+	bool controllerListChanged() override;
+	bool getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) override;
+	PSMHeadMountedDisplay *getHmd(PSMHmdID id) override;
+	void startHmdStreams(const std::vector<PSMHmdID> &ids, unsigned int flags) override;
+	void stopHmdStreams(const std::vector<PSMHmdID> &ids) override;
+	double controllerPacketTime(PSMControllerID id) override;
+	double hmdPacketTime(PSMHmdID id) override;
+	bool packetsPending() const override { return !m_packets.empty(); }
+	bool getTrackerList(PSMTrackerList &list) override;
+
+private:
+	template <class T> struct View {
+		T state{};
+		bool streamed = false; // Updated by packets rather than by listing.
+		double time = 0.0;	   // local_clock() when the worker read the packet.
+	};
+	template <class T> using ViewMap = std::map<int, std::unique_ptr<View<T>>>;
+
+	template <class T> static View<T> &view(ViewMap<T> &views, int id);
+	template <class T, class Type>
+	bool listDevices(int kind, ViewMap<T> &views, std::vector<int> &ids, std::vector<Type> &types);
+	template <class T> static void applyPacket(ViewMap<T> &views, const QByteArray &payload);
+	void sendStreams(EndpointMessage type, int kind, const std::vector<int> &ids, unsigned int flags);
+	bool send(EndpointMessage type, const QByteArray &payload = QByteArray());
+	// Reads what has arrived, waiting up to timeoutMs for it. False once the
+	// worker is gone.
+	bool receive(int timeoutMs);
+	// Receives until the worker's answer of the given type. False if it did
+	// not come in time; the worker then counts as lost.
+	bool awaitReply(EndpointMessage type, QByteArray &payload);
+
+	QString m_name;
+	QStringList m_arguments;
+	std::unique_ptr<QProcess> m_process;
+	bool m_bConnected = false;
+	bool m_bStreamsActive = false;
+	bool m_bListChanged = false;
+	QByteArray m_buffer;			   // Received, not yet a whole frame.
+	std::deque<QByteArray> m_packets;  // Packet payloads not yet applied.
+	std::vector<int> m_drained;		   // Devices update() applied a packet of, HMDs as ~id.
+	bool m_bReply = false;			   // m_reply holds an answer.
+	EndpointMessage m_replyType;
+	QByteArray m_reply;
+	// Stable until disconnect().
+	ViewMap<PSMController> m_controllers;
+	ViewMap<PSMHeadMountedDisplay> m_hmds;
+};
+
+// The worker process side: connects source, then serves it over stdin and
+// stdout until stdin closes or the source loses its connection. Returns the
+// process exit code.
+int serveEndpoint(ControllerSource &source);
+
+#endif // REMOTESOURCE_H
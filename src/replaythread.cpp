@@ -0,0 +1,129 @@
+#include "replaythread.h"
+#include <QDebug>
+#include <algorithm>
+
+// Longest single sleep, so stopReplay() is not held up.
+const double kMaxReplaySleep = 0.05;
+
+ReplayThread::ReplayThread(QObject *parent) : QThread(parent), m_stop(false) {}
+
+ReplayThread::~ReplayThread() { stopReplay(); }
+
+void ReplayThread::startReplay(const QString &path, double speed, bool loop) {
+	stopReplay();
+	m_path = path;
+	m_speed = std::max(speed, 0.0);
+	m_bLoop = loop;
+	m_stop = false;
+	start(HighPriority);
+}
+
+void ReplayThread::stopReplay() {
+	if (isRunning()) {
+		m_stop = true;
+		wait();
+	}
+}
+
+bool ReplayThread::waitUntil(double time) {
+	for (;;) {
+		if (m_stop.load()) return false;
+		double wait = time - lsl::local_clock();
+		if (wait <= 0.0) return true;
+		this->usleep((unsigned long)(1e6 * std::min(wait, kMaxReplaySleep)));
+	}
+}
+
+void ReplayThread::push(int stream, std::vector<double> &stamps, const std::vector<char> &data) {
+	lsl::stream_outlet &outlet = *m_outlets[stream];
+	size_t count = stamps.size();
+	switch (m_formats[stream]) {
+	case lsl::cf_float32:
+		outlet.push_chunk_multiplexed((const float *)data.data(), data.size() / sizeof(float),
+			stamps.data());
+		break;
+	case lsl::cf_double64:
+		outlet.push_chunk_multiplexed((const double *)data.data(), data.size() / sizeof(double),
+			stamps.data());
+		break;
+	case lsl::cf_int32:
+		outlet.push_chunk_multiplexed((const int32_t *)data.data(), data.size() / sizeof(int32_t),
+			stamps.data());
+		break;
+	case lsl::cf_int16:
+		outlet.push_chunk_multiplexed((const int16_t *)data.data(), data.size() / sizeof(int16_t),
+			stamps.data());
+		break;
+	case lsl::cf_int8:
+		outlet.push_chunk_multiplexed(data.data(), data.size(), stamps.data());
+		break;
+	case lsl::cf_int64:
+		outlet.push_chunk_multiplexed((const int64_t *)data.data(), data.size() / sizeof(int64_t),
+			stamps.data());
+		break;
+	default:
+		qDebug() << "Cannot replay stream" << stream << "; skipped" << count << "samples.";
+		break;
+	}
+}
+
+void ReplayThread::run() {
+	SessionLogReader reader(m_path.toStdString());
+	if (!reader.isOpen()) {
+		qDebug() << "Could not open backup log" << m_path;
+		emit replayStarted(false);
+		emit replayFinished();
+		return;
+	}
+
+	// The outlets stamp their own creation time and uid; the rest is as recorded.
+	const std::vector<SessionLogReader::Stream> &streams = reader.streams();
+	m_outlets.clear();
+	m_formats.clear();
+	for (const SessionLogReader::Stream &s : streams) {
+		m_formats.push_back(s.format);
+		if (s.valueSize == 0)
+			m_outlets.emplace_back();
+		else
+			m_outlets.emplace_back(
+				new lsl::stream_outlet(lsl::stream_info(lsl_streaminfo_from_xml(s.xml.c_str()))));
+	}
+	qDebug() << "Replaying" << m_path << "at" << m_speed << "x with" << streams.size() << "streams.";
+	emit replayStarted(true);
+
+	const double rate = m_speed > 0.0 ? m_speed : 1.0;
+	double lastStamp = 0.0;
+	bool running = true;
+	while (running) {
+		// Each pass starts now, after whatever the previous pass pushed.
+		double start = std::max(lsl::local_clock(), lastStamp);
+		double origin = 0.0;
+		bool first = true;
+		int stream;
+		std::vector<double> stamps;
+		std::vector<char> data;
+		while (reader.next(stream, stamps, data)) {
+			if (!m_outlets[stream]) continue;
+			if (first) {
+				origin = stamps.front();
+				first = false;
+			}
+			for (double &stamp : stamps) stamp = start + (stamp - origin) / rate;
+			// Originally the chunk was pushed once its last sample was in.
+			if (m_speed > 0.0 && !waitUntil(stamps.back())) {
+				running = false;
+				break;
+			}
+			if (m_stop.load()) {
+				running = false;
+				break;
+			}
+			push(stream, stamps, data);
+			lastStamp = std::max(lastStamp, stamps.back());
+		}
+		running = running && m_bLoop && !first;
+		reader.rewind();
+	}
+	m_outlets.clear();
+	emit replayFinished();
+}
@@ -0,0 +1,52 @@
+#ifndef REPLAYTHREAD_H
+#define REPLAYTHREAD_H
+
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "lsl_cpp.h"
+#include "sessionlog.h"
+
+// Republishes a backup log (see sessionlog.h) for load-testing recorders and
+// analysis pipelines without hardware. Every stream of the log gets an outlet
+// with the recorded stream_info, so names, source ids and channel metadata
+// match the original session. Each recorded chunk is pushed when it is due:
+// speed 1 keeps the original timing, N plays N times faster and 0 pushes as
+// fast as possible. Timestamps keep their recorded spacing (divided by the
+// speed), shifted to start at the replay. The log is read record by record,
+// so sessions of any length replay in constant memory.
+class ReplayThread : public QThread
+{
+    Q_OBJECT
+
+public:
+	ReplayThread(QObject *parent = 0);
+	~ReplayThread();
+
+	// Starts replaying path; with loop, from the start again at its end.
+	void startReplay(const QString &path, double speed = 1.0, bool loop = false);
+	// Stops pushing and closes the outlets.
+	void stopReplay();
+
+signals:
+	void replayStarted(bool result); // Emitted once the outlets exist, or false if path is no log.
+	void replayFinished();           // Emitted when the replay ends or is stopped.
+
+protected:
+    void run() override;
+
+private:
+	bool waitUntil(double time);     // Sleeps until local_clock() reaches time. False if stopped.
+	void push(int stream, std::vector<double> &stamps, const std::vector<char> &data);
+
+	QString m_path;
+	double m_speed = 1.0;
+	bool m_bLoop = false;
+	std::atomic<bool> m_stop;
+	std::vector<std::unique_ptr<lsl::stream_outlet>> m_outlets; // Per stream of the log.
+	std::vector<lsl::channel_format_t> m_formats;
+};
+
+#endif // REPLAYTHREAD_H
@@ -0,0 +1,161 @@
+#include "resampler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const double kPi = 3.14159265358979323846;
+const double kCutoff = 0.4;			// Anti-alias cutoff, relative to the output rate.
+const double kFilterAbove = 1.1;	// Filter once the input is this much faster than the output.
+const double kRedesign = 0.05;		// Redesign when the input rate moved by this fraction.
+const double kPeriodAlpha = 0.05;	// EWMA weight of the input period estimate.
+const double kGapPeriods = 5.0;		// Do not interpolate across more input periods than this,
+const double kMaxUnknownGap = 0.25; // or, before the input period is known, seconds.
+
+// Spherical interpolation of unit quaternions in the same hemisphere.
+void slerp(const double *a, const double *b, double frac, float *out) {
+	double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+	double wa = 1.0 - frac, wb = frac;
+	if (dot < 0.9995) {
+		double theta = std::acos(std::min(dot, 1.0));
+		double sinTheta = std::sin(theta);
+		wa = std::sin(wa * theta) / sinTheta;
+		wb = std::sin(wb * theta) / sinTheta;
+	}
+	double q[4], norm = 0.0;
+	for (int i = 0; i < 4; i++) {
+		q[i] = wa * a[i] + wb * b[i];
+		norm += q[i] * q[i];
+	}
+	norm = norm > 0.0 ? 1.0 / std::sqrt(norm) : 0.0;
+	for (int i = 0; i < 4; i++) out[i] = (float)(q[i] * norm);
+}
+
+void normalizeQuat(double *q) {
+	double norm = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	if (norm > 0.0)
+		for (int i = 0; i < 4; i++) q[i] /= norm;
+}
+} // namespace
+
+Resampler::Resampler(int channels, int quatOffset, double rate)
+	: m_channels(channels), m_quat(quatOffset), m_rate(rate), m_inPeriod(0.0),
+	  m_haveInput(false), m_havePrev(false), m_lastInput(0.0), m_lastQuat{1.0, 0.0, 0.0, 0.0},
+	  m_filtering(false), m_designRate(0.0), m_b0(1.0), m_b1(0.0), m_b2(0.0), m_a1(0.0),
+	  m_a2(0.0), m_delay(0.0), m_z1(channels + 1), m_z2(channels + 1), m_x(channels + 1),
+	  m_prev(channels + 1), m_cur(channels + 1), m_tPrev(0.0), m_tCur(0.0), m_nextIndex(0),
+	  m_out(channels) {}
+
+void Resampler::design(double inputRate) {
+	// RBJ biquad low-pass with Q = 1/sqrt(2), normalized to a0 = 1.
+	double w0 = 2.0 * kPi * kCutoff * m_rate / inputRate;
+	double alpha = std::sin(w0) / std::sqrt(2.0);
+	double cosw = std::cos(w0);
+	double a0 = 1.0 + alpha;
+	m_b0 = (1.0 - cosw) / 2.0 / a0;
+	m_b1 = (1.0 - cosw) / a0;
+	m_b2 = m_b0;
+	m_a1 = -2.0 * cosw / a0;
+	m_a2 = (1.0 - alpha) / a0;
+	// Group delay at DC in samples: N'(1)/N(1) - D'(1)/D(1) for polynomials in z^-1.
+	double delaySamples = 1.0 - (m_a1 + 2.0 * m_a2) / (1.0 + m_a1 + m_a2);
+	m_delay = delaySamples / inputRate;
+	m_designRate = inputRate;
+}
+
+void Resampler::resetFilter(const std::vector<double> &x) {
+	// Steady state for a constant input x.
+	for (int ch = 0; ch <= m_channels; ch++) {
+		m_z2[ch] = (m_b2 - m_a2) * x[ch];
+		m_z1[ch] = (m_b1 - m_a1) * x[ch] + m_z2[ch];
+	}
+}
+
+void Resampler::push(const float *sample, double deviceTime, double timestamp) {
+	bool restart = !m_haveInput;
+	if (m_haveInput) {
+		double dt = timestamp - m_lastInput;
+		if (dt <= 0.0) return; // Duplicate or out of order.
+		double maxGap = m_inPeriod > 0.0 ? std::max(kGapPeriods * m_inPeriod, 2.0 / m_rate)
+										 : kMaxUnknownGap;
+		if (dt > maxGap) {
+			restart = true;
+		} else if (m_inPeriod == 0.0) {
+			m_inPeriod = dt;
+		} else if (dt < 1.5 * m_inPeriod) {
+			// Lost packets would bias the estimate; only learn from neighbours.
+			m_inPeriod += kPeriodAlpha * (dt - m_inPeriod);
+		}
+	}
+	m_lastInput = timestamp;
+
+	for (int ch = 0; ch < m_channels; ch++) m_x[ch] = sample[ch];
+	m_x[m_channels] = deviceTime;
+	if (m_quat >= 0) {
+		// q and -q are the same rotation; keep consecutive samples in one
+		// hemisphere so filtering and interpolation take the short way.
+		double *q = &m_x[m_quat];
+		double dot = q[0] * m_lastQuat[0] + q[1] * m_lastQuat[1] + q[2] * m_lastQuat[2] +
+					 q[3] * m_lastQuat[3];
+		if (dot < 0.0 && !restart)
+			for (int i = 0; i < 4; i++) q[i] = -q[i];
+		std::copy(q, q + 4, m_lastQuat);
+	}
+
+	bool redesigned = false;
+	if (m_inPeriod > 0.0) {
+		double inputRate = 1.0 / m_inPeriod;
+		if (inputRate > kFilterAbove * m_rate) {
+			if (!m_filtering || std::fabs(inputRate - m_designRate) > kRedesign * m_designRate) {
+				// Restart from steady state; the old state does not fit the new coefficients.
+				redesigned = true;
+				design(inputRate);
+				m_filtering = true;
+			}
+		} else {
+			m_filtering = false;
+			m_delay = 0.0;
+		}
+	}
+	if (restart || redesigned) resetFilter(m_x);
+
+	std::swap(m_prev, m_cur);
+	if (m_filtering) {
+		for (int ch = 0; ch <= m_channels; ch++) {
+			double x = m_x[ch];
+			double y = m_b0 * x + m_z1[ch];
+			m_z1[ch] = m_b1 * x - m_a1 * y + m_z2[ch];
+			m_z2[ch] = m_b2 * x - m_a2 * y;
+			m_cur[ch] = y;
+		}
+	} else {
+		m_cur = m_x;
+	}
+	if (m_quat >= 0) normalizeQuat(&m_cur[m_quat]);
+
+	m_tPrev = m_tCur;
+	m_tCur = timestamp - m_delay;
+	m_havePrev = !restart && m_tCur > m_tPrev;
+	m_haveInput = true;
+	if (!m_havePrev) m_nextIndex = (int64_t)std::ceil(m_tCur * m_rate);
+}
+
+const float *Resampler::next(double &deviceTime, double &timestamp) {
+	if (!m_havePrev) return nullptr;
+	double t = m_nextIndex / m_rate;
+	if (t > m_tCur) return nullptr;
+	if (t < m_tPrev) {
+		// The filter delay changed; resume on the grid after m_tPrev.
+		m_nextIndex = (int64_t)std::ceil(m_tPrev * m_rate);
+		t = m_nextIndex / m_rate;
+		if (t > m_tCur) return nullptr;
+	}
+
+	double frac = (t - m_tPrev) / (m_tCur - m_tPrev);
+	for (int ch = 0; ch < m_channels; ch++)
+		m_out[ch] = (float)(m_prev[ch] + frac * (m_cur[ch] - m_prev[ch]));
+	if (m_quat >= 0) slerp(&m_prev[m_quat], &m_cur[m_quat], frac, &m_out[m_quat]);
+	deviceTime = m_prev[m_channels] + frac * (m_cur[m_channels] - m_prev[m_channels]);
+	timestamp = t;
+	m_nextIndex++;
+	return m_out.data();
+}
@@ -0,0 +1,57 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+#include <vector>
+
+// Turns irregularly timed samples into samples on the regular grid of
+// multiples of 1/rate. Channels are interpolated linearly, except the
+// quaternion (w, x, y, z) at quatOffset, which is slerped. When the input
+// arrives faster than the output rate, a second-order Butterworth low-pass at
+// 0.4 * rate filters it first, and its group delay is taken off the output
+// timestamps. The work per sample is fixed and nothing is allocated after
+// construction.
+class Resampler {
+public:
+	// quatOffset < 0 if the samples contain no quaternion.
+	Resampler(int channels, int quatOffset, double rate);
+
+	// Feeds one input sample. deviceTime is resampled along with the channels.
+	void push(const float *sample, double deviceTime, double timestamp);
+	// Returns the next output sample, or nullptr once the output has caught up
+	// with the input. The pointer stays valid until the next call.
+	const float *next(double &deviceTime, double &timestamp);
+
+	double rate() const { return m_rate; }
+
+private:
+	void design(double inputRate);
+	void resetFilter(const std::vector<double> &x);
+
+	int m_channels;
+	int m_quat;
+	double m_rate;
+
+	double m_inPeriod;	 // EWMA of the input period, 0 until known.
+	bool m_haveInput;	 // m_cur holds a sample.
+	bool m_havePrev;	 // m_prev holds the sample before it, with no gap in between.
+	double m_lastInput;	 // Timestamp of the latest input sample.
+	double m_lastQuat[4]; // Latest input quaternion, for hemisphere alignment.
+
+	// Anti-alias filter, transposed direct form II, one state pair per
+	// channel plus one for the device time.
+	bool m_filtering;
+	double m_designRate;
+	double m_b0, m_b1, m_b2, m_a1, m_a2;
+	double m_delay; // Group delay at DC, seconds.
+	std::vector<double> m_z1, m_z2;
+
+	std::vector<double> m_x;	// Input sample being filtered; device time last.
+	std::vector<double> m_prev; // Filtered samples bracketing the output times.
+	std::vector<double> m_cur;
+	double m_tPrev, m_tCur;
+	int64_t m_nextIndex;		// Next output is at m_nextIndex / m_rate.
+	std::vector<float> m_out;
+};
+
+#endif // RESAMPLER_H
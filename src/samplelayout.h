@@ -0,0 +1,355 @@
+#ifndef SAMPLELAYOUT_H
+#define SAMPLELAYOUT_H
+
+#include <QStringList>
+#include <cstdint>
+#include "PSMoveClient_CAPI.h"
+#include "devicekind.h"
+
+// Channel layouts of the IMU and position streams. The offsets of each block
+// are fixed at compile time for every device kind and combination of stream
+// flags, so the push loop copies straight into a preallocated sample without
+// any branching on the flags.
+
+const int kIMUBlockChannels = 10;	 // timestamp, Accel.xyz, Gyro.xyz, Mag.xyz
+const int kIMUBlockChannelsNoMag = 7; // timestamp, Accel.xyz, Gyro.xyz (DualShock 4, Morpheus)
+const int kPoseBlockChannels = 7;	 // orient_wxyz, xyz
+const int kRawPosBlockChannels = 3; // RelativePosition.xyz
+const int kGapChannels = 1;			 // SeqGap, the last channel of every stream.
+
+typedef void (*SampleFiller)(const DeviceState &state, float *sample);
+typedef double (*DeviceTimeReader)(const DeviceState &state);
+
+// Where each kind keeps its sensor and pose data. The Navi has neither.
+struct PSMoveTraits {
+	typedef PSMPSMove State;
+	static const bool hasMag = true;
+	static const State &get(const DeviceState &state) { return state.psmove; }
+};
+struct DualShock4Traits {
+	typedef PSMDualShock4 State;
+	static const bool hasMag = false;
+	static const State &get(const DeviceState &state) { return state.ds4; }
+};
+struct MorpheusTraits {
+	typedef PSMMorpheus State;
+	static const bool hasMag = false;
+	static const State &get(const DeviceState &state) { return state.morpheus; }
+};
+
+inline bool hasIMU(DeviceKind kind) { return kind != DeviceKind::Navi; }
+inline bool hasPose(DeviceKind kind) { return kind != DeviceKind::Navi; }
+inline bool hasMag(DeviceKind kind) { return kind == DeviceKind::PSMove; }
+
+// Which device clock, if any, timestamps a device's samples.
+enum class DeviceTimeSource { None, Calibrated, Raw };
+
+inline DeviceTimeSource deviceTimeSource(DeviceKind kind, bool doIMU, bool doIMU_raw) {
+	if (!hasIMU(kind)) return DeviceTimeSource::None;
+	return doIMU ? DeviceTimeSource::Calibrated
+				 : (doIMU_raw ? DeviceTimeSource::Raw : DeviceTimeSource::None);
+}
+
+template <class Traits, bool calibrated> double readDeviceTime(const DeviceState &state) {
+	return calibrated ? Traits::get(state).CalibratedSensorData.TimeInSeconds
+					  : Traits::get(state).RawSensorData.TimeInSeconds;
+}
+
+template <class Traits> DeviceTimeReader timeReader(DeviceTimeSource source) {
+	if (source == DeviceTimeSource::None) return nullptr;
+	return source == DeviceTimeSource::Calibrated ? &readDeviceTime<Traits, true>
+												  : &readDeviceTime<Traits, false>;
+}
+
+// Reads the device clock of a packet; nullptr if the source is None.
+inline DeviceTimeReader deviceTimeReader(DeviceKind kind, DeviceTimeSource source) {
+	switch (kind) {
+	case DeviceKind::PSMove: return timeReader<PSMoveTraits>(source);
+	case DeviceKind::DualShock4: return timeReader<DualShock4Traits>(source);
+	case DeviceKind::Morpheus: return timeReader<MorpheusTraits>(source);
+	default: return nullptr;
+	}
+}
+
+template <class Traits, bool doIMU, bool doIMU_raw> struct IMULayout {
+	static const int blockChannels = Traits::hasMag ? kIMUBlockChannels : kIMUBlockChannelsNoMag;
+	static const int calibOffset = 0;
+	static const int rawOffset = doIMU ? blockChannels : 0;
+	static const int channelCount = rawOffset + (doIMU_raw ? blockChannels : 0);
+
+	static void fill(const DeviceState &deviceState, float *sample) {
+		const typename Traits::State &state = Traits::get(deviceState);
+		if (doIMU) {
+			const auto &calibSens = state.CalibratedSensorData;
+			float *s = sample + calibOffset;
+			s[0] = (float)calibSens.TimeInSeconds;
+			s[1] = calibSens.Accelerometer.x;
+			s[2] = calibSens.Accelerometer.y;
+			s[3] = calibSens.Accelerometer.z;
+			s[4] = calibSens.Gyroscope.x;
+			s[5] = calibSens.Gyroscope.y;
+			s[6] = calibSens.Gyroscope.z;
+			if constexpr (Traits::hasMag) {
+				s[7] = calibSens.Magnetometer.x;
+				s[8] = calibSens.Magnetometer.y;
+				s[9] = calibSens.Magnetometer.z;
+			}
+		}
+		if (doIMU_raw) {
+			const auto &rawSens = state.RawSensorData;
+			float *s = sample + rawOffset;
+			s[0] = (float)rawSens.TimeInSeconds;
+			s[1] = (float)rawSens.Accelerometer.x;
+			s[2] = (float)rawSens.Accelerometer.y;
+			s[3] = (float)rawSens.Accelerometer.z;
+			s[4] = (float)rawSens.Gyroscope.x;
+			s[5] = (float)rawSens.Gyroscope.y;
+			s[6] = (float)rawSens.Gyroscope.z;
+			if constexpr (Traits::hasMag) {
+				s[7] = (float)rawSens.Magnetometer.x;
+				s[8] = (float)rawSens.Magnetometer.y;
+				s[9] = (float)rawSens.Magnetometer.z;
+			}
+		}
+	}
+};
+
+template <class Traits, bool doPos, bool doPos_raw> struct PosLayout {
+	static const int poseOffset = 0;
+	static const int rawOffset = doPos ? kPoseBlockChannels : 0;
+	static const int channelCount = rawOffset + (doPos_raw ? kRawPosBlockChannels : 0);
+
+	static void fill(const DeviceState &deviceState, float *sample) {
+		const typename Traits::State &state = Traits::get(deviceState);
+		if (doPos) {
+			const PSMPosef &poseData = state.Pose;
+			float *s = sample + poseOffset;
+			s[0] = poseData.Orientation.w;
+			s[1] = poseData.Orientation.x;
+			s[2] = poseData.Orientation.y;
+			s[3] = poseData.Orientation.z;
+			s[4] = poseData.Position.x;
+			s[5] = poseData.Position.y;
+			s[6] = poseData.Position.z;
+		}
+		if (doPos_raw) {
+			const PSMRawTrackerData &rawTrackerData = state.RawTrackerData;
+			float *s = sample + rawOffset;
+			s[0] = rawTrackerData.RelativePositionCm.x;
+			s[1] = rawTrackerData.RelativePositionCm.y;
+			s[2] = rawTrackerData.RelativePositionCm.z;
+		}
+	}
+};
+
+template <class Traits> SampleFiller imuFillerFor(bool doIMU, bool doIMU_raw) {
+	static const SampleFiller fillers[2][2] = {
+		{nullptr, &IMULayout<Traits, false, true>::fill},
+		{&IMULayout<Traits, true, false>::fill, &IMULayout<Traits, true, true>::fill}};
+	return fillers[doIMU][doIMU_raw];
+}
+
+template <class Traits> SampleFiller posFillerFor(bool doPos, bool doPos_raw) {
+	static const SampleFiller fillers[2][2] = {
+		{nullptr, &PosLayout<Traits, false, true>::fill},
+		{&PosLayout<Traits, true, false>::fill, &PosLayout<Traits, true, true>::fill}};
+	return fillers[doPos][doPos_raw];
+}
+
+// Returns the specialized filler for a kind and flag combination, or nullptr
+// if the stream has no data channels. The fillers leave the SeqGap channel alone.
+inline SampleFiller imuFiller(DeviceKind kind, bool doIMU, bool doIMU_raw) {
+	switch (kind) {
+	case DeviceKind::PSMove: return imuFillerFor<PSMoveTraits>(doIMU, doIMU_raw);
+	case DeviceKind::DualShock4: return imuFillerFor<DualShock4Traits>(doIMU, doIMU_raw);
+	case DeviceKind::Morpheus: return imuFillerFor<MorpheusTraits>(doIMU, doIMU_raw);
+	default: return nullptr;
+	}
+}
+
+inline SampleFiller posFiller(DeviceKind kind, bool doPos, bool doPos_raw) {
+	switch (kind) {
+	case DeviceKind::PSMove: return posFillerFor<PSMoveTraits>(doPos, doPos_raw);
+	case DeviceKind::DualShock4: return posFillerFor<DualShock4Traits>(doPos, doPos_raw);
+	case DeviceKind::Morpheus: return posFillerFor<MorpheusTraits>(doPos, doPos_raw);
+	default: return nullptr;
+	}
+}
+
+// The events stream: a packet's button states and analog values packed into
+// two words, so the publisher detects a change with two compares. Each button
+// is one bit (1 while held), each analog value one byte; the channels are the
+// buttons followed by the analog values.
+struct EventState {
+	uint32_t buttons;
+	uint64_t axes;
+};
+
+inline bool operator!=(const EventState &a, const EventState &b) {
+	return a.buttons != b.buttons || a.axes != b.axes;
+}
+
+// Never a packed state (no kind has 32 buttons); forces the first push.
+const EventState kNoEventState = {0xffffffffu, 0};
+
+typedef EventState (*EventPacker)(const DeviceState &state);
+
+inline uint32_t held(PSMButtonState button, int bit) {
+	return (uint32_t)(button == PSMButtonState_PRESSED || button == PSMButtonState_DOWN) << bit;
+}
+
+inline uint64_t axisByte(unsigned int value, int axis) { return (uint64_t)(value & 0xff) << (8 * axis); }
+
+// Sticks from -1..1 and triggers from 0..1 to a byte.
+inline unsigned int stickByte(float value) { return (unsigned int)(127.5f * (value + 1.0f) + 0.5f); }
+inline unsigned int triggerByte(float value) { return (unsigned int)(255.0f * value + 0.5f); }
+
+inline EventState packPSMoveEvents(const DeviceState &deviceState) {
+	const PSMPSMove &s = deviceState.psmove;
+	EventState e;
+	e.buttons = held(s.TriangleButton, 0) | held(s.CircleButton, 1) | held(s.CrossButton, 2) |
+		held(s.SquareButton, 3) | held(s.SelectButton, 4) | held(s.StartButton, 5) |
+		held(s.PSButton, 6) | held(s.MoveButton, 7) | held(s.TriggerButton, 8);
+	e.axes = axisByte(s.TriggerValue, 0) | axisByte(s.BatteryValue, 1);
+	return e;
+}
+
+inline EventState packNaviEvents(const DeviceState &deviceState) {
+	const PSMPSNavi &s = deviceState.navi;
+	EventState e;
+	e.buttons = held(s.L1Button, 0) | held(s.L2Button, 1) | held(s.L3Button, 2) |
+		held(s.CircleButton, 3) | held(s.CrossButton, 4) | held(s.PSButton, 5) |
+		held(s.TriggerButton, 6) | held(s.DPadUpButton, 7) | held(s.DPadRightButton, 8) |
+		held(s.DPadDownButton, 9) | held(s.DPadLeftButton, 10);
+	e.axes = axisByte(s.TriggerValue, 0) | axisByte(s.Stick_XAxis, 1) | axisByte(s.Stick_YAxis, 2);
+	return e;
+}
+
+inline EventState packDualShock4Events(const DeviceState &deviceState) {
+	const PSMDualShock4 &s = deviceState.ds4;
+	EventState e;
+	e.buttons = held(s.DPadUpButton, 0) | held(s.DPadDownButton, 1) | held(s.DPadLeftButton, 2) |
+		held(s.DPadRightButton, 3) | held(s.SquareButton, 4) | held(s.CrossButton, 5) |
+		held(s.CircleButton, 6) | held(s.TriangleButton, 7) | held(s.L1Button, 8) |
+		held(s.R1Button, 9) | held(s.L2Button, 10) | held(s.R2Button, 11) | held(s.L3Button, 12) |
+		held(s.R3Button, 13) | held(s.ShareButton, 14) | held(s.OptionsButton, 15) |
+		held(s.PSButton, 16) | held(s.TrackPadButton, 17);
+	e.axes = axisByte(stickByte(s.LeftAnalogX), 0) | axisByte(stickByte(s.LeftAnalogY), 1) |
+		axisByte(stickByte(s.RightAnalogX), 2) | axisByte(stickByte(s.RightAnalogY), 3) |
+		axisByte(triggerByte(s.LeftTriggerValue), 4) | axisByte(triggerByte(s.RightTriggerValue), 5);
+	return e;
+}
+
+// The packer of a kind, or nullptr if it has no buttons.
+inline EventPacker eventPacker(DeviceKind kind) {
+	switch (kind) {
+	case DeviceKind::PSMove: return &packPSMoveEvents;
+	case DeviceKind::Navi: return &packNaviEvents;
+	case DeviceKind::DualShock4: return &packDualShock4Events;
+	default: return nullptr;
+	}
+}
+
+inline void unpackEventState(const EventState &packed, int buttons, int axes, int16_t *sample) {
+	for (int b = 0; b < buttons; b++) sample[b] = (packed.buttons >> b) & 1;
+	for (int a = 0; a < axes; a++) sample[buttons + a] = (packed.axes >> (8 * a)) & 0xff;
+}
+
+// Button labels in bit order.
+inline QStringList eventButtonLabels(DeviceKind kind) {
+	QStringList labels;
+	switch (kind) {
+	case DeviceKind::PSMove:
+		labels << "Triangle" << "Circle" << "Cross" << "Square" << "Select" << "Start" << "PS"
+			   << "Move" << "Trigger";
+		break;
+	case DeviceKind::Navi:
+		labels << "L1" << "L2" << "L3" << "Circle" << "Cross" << "PS" << "Trigger" << "DPadUp"
+			   << "DPadRight" << "DPadDown" << "DPadLeft";
+		break;
+	case DeviceKind::DualShock4:
+		labels << "DPadUp" << "DPadDown" << "DPadLeft" << "DPadRight" << "Square" << "Cross"
+			   << "Circle" << "Triangle" << "L1" << "R1" << "L2" << "R2" << "L3" << "R3" << "Share"
+			   << "Options" << "PS" << "TrackPad";
+		break;
+	default:
+		break;
+	}
+	return labels;
+}
+
+// Analog labels in byte order.
+inline QStringList eventAxisLabels(DeviceKind kind) {
+	QStringList labels;
+	switch (kind) {
+	case DeviceKind::PSMove:
+		labels << "TriggerValue" << "Battery";
+		break;
+	case DeviceKind::Navi:
+		labels << "TriggerValue" << "StickX" << "StickY";
+		break;
+	case DeviceKind::DualShock4:
+		labels << "LeftStickX" << "LeftStickY" << "RightStickX" << "RightStickY" << "L2Value"
+			   << "R2Value";
+		break;
+	default:
+		break;
+	}
+	return labels;
+}
+
+// Channel labels matching the fillers, SeqGap included.
+inline QStringList imuChannelLabels(bool doIMU, bool doIMU_raw, bool withMag = true) {
+	QStringList imuChanLabels;
+	if (doIMU) {
+		imuChanLabels << "timestamp"
+					  << "Accel.x"
+					  << "Accel.y"
+					  << "Accel.z"
+					  << "Gyro.x"
+					  << "Gyro.y"
+					  << "Gyro.z";
+		if (withMag)
+			imuChanLabels << "Mag.x"
+						  << "Mag.y"
+						  << "Mag.z";
+	}
+	if (doIMU_raw) {
+		imuChanLabels << "raw_timestamp"
+					  << "raw_Accel.x"
+					  << "raw_Accel.y"
+					  << "raw_Accel.z"
+					  << "raw_Gyro.x"
+					  << "raw_Gyro.y"
+					  << "raw_Gyro.z";
+		if (withMag)
+			imuChanLabels << "raw_Mag.x"
+						  << "raw_Mag.y"
+						  << "raw_Mag.z";
+	}
+	// Number of packets lost immediately before each sample.
+	imuChanLabels << "SeqGap";
+	return imuChanLabels;
+}
+
+inline QStringList posChannelLabels(bool doPos, bool doPos_raw) {
+	QStringList posChanLabels;
+	if (doPos) {
+		posChanLabels << "Pos.orient_w"
+					  << "Pos.orient_x"
+					  << "Pos.orient_y"
+					  << "Pos.orient_z"
+					  << "Pos.x"
+					  << "Pos.y"
+					  << "Pos.z";
+	}
+	if (doPos_raw) {
+		posChanLabels << "RelativePosition.x"
+					  << "RelativePosition.y"
+					  << "RelativePosition.z";
+	}
+	posChanLabels << "SeqGap";
+	return posChanLabels;
+}
+
+#endif // SAMPLELAYOUT_H
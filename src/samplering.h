@@ -0,0 +1,54 @@
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Fixed-capacity ring of preallocated slots, safe for one producer thread and
+// one consumer thread without locks. The producer fills a slot in place via
+// beginWrite()/commitWrite(); the consumer reads it in place via
+// front()/pop(). Nothing is allocated after construction.
+template <typename T> class SampleRing {
+public:
+	// capacity is rounded up to a power of two.
+	explicit SampleRing(size_t capacity) : m_head(0), m_tail(0) {
+		size_t n = 1;
+		while (n < capacity) n <<= 1;
+		m_slots.resize(n);
+		m_mask = n - 1;
+	}
+
+	size_t capacity() const { return m_slots.size(); }
+
+	// Producer: returns the next free slot, or nullptr if the ring is full.
+	T *beginWrite() {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) == m_slots.size()) return nullptr;
+		return &m_slots[head & m_mask];
+	}
+	// Producer: publishes the slot returned by beginWrite().
+	void commitWrite() { m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	// Consumer: returns the oldest unread slot, or nullptr if the ring is empty.
+	const T *front() const {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == m_head.load(std::memory_order_acquire)) return nullptr;
+		return &m_slots[tail & m_mask];
+	}
+	// Consumer: releases the slot returned by front().
+	void pop() { m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	// Number of unread slots. Exact only when called from producer or consumer.
+	size_t size() const {
+		return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<T> m_slots;
+	size_t m_mask;
+	alignas(64) std::atomic<size_t> m_head; // Written by the producer only.
+	alignas(64) std::atomic<size_t> m_tail; // Written by the consumer only.
+};
+
+#endif // SAMPLERING_H
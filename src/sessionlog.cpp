@@ -0,0 +1,269 @@
+#include "sessionlog.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+uint64_t alignRecord(uint64_t bytes) { return (bytes + 7) & ~(uint64_t)7; }
+
+// What must match for two outlets to share a stream id: identity, format,
+// rate and channel labels.
+std::string streamKey(const lsl::stream_info &info) {
+	lsl::stream_info copy(info); // desc() is not const.
+	std::string key = info.source_id() + '\n' + info.name() + '\n' + info.type() + '\n' +
+		std::to_string(info.channel_count()) + '\n' + std::to_string((int)info.channel_format()) +
+		'\n' + std::to_string(info.nominal_srate());
+	for (lsl::xml_element ch = copy.desc().child("channels").first_child(); !ch.empty();
+		 ch = ch.next_sibling())
+		key += '\n' + ch.child_value("label");
+	return key;
+}
+} // namespace
+
+size_t channelFormatSize(lsl::channel_format_t format) {
+	switch (format) {
+	case lsl::cf_float32: return 4;
+	case lsl::cf_double64: return 8;
+	case lsl::cf_int32: return 4;
+	case lsl::cf_int16: return 2;
+	case lsl::cf_int8: return 1;
+	case lsl::cf_int64: return 8;
+	default: return 0;
+	}
+}
+
+SessionLog::SessionLog(const std::string &path, uint64_t capacity)
+	: m_path(path),
+	  m_capacity(alignRecord(std::max<uint64_t>(capacity, sizeof(SessionLogHeader)))),
+	  m_base(nullptr),
+	  m_header(nullptr),
+	  m_tail(alignRecord(sizeof(SessionLogHeader))),
+	  m_streamCount(0),
+	  m_dropped(0),
+	  m_bFullReported(false) {
+	std::memset(m_channels, 0, sizeof(m_channels));
+	std::memset(m_valueSize, 0, sizeof(m_valueSize));
+#ifdef _WIN32
+	m_mapping = nullptr;
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		m_file = nullptr;
+		qDebug() << "Could not create backup log" << path.c_str();
+		return;
+	}
+	// Mapping a file extends it to the mapping's size.
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, (DWORD)(m_capacity >> 32),
+		(DWORD)(m_capacity & 0xffffffff), nullptr);
+	if (m_mapping)
+		m_base = (char *)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)m_capacity);
+#else
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0) {
+		qDebug() << "Could not create backup log" << path.c_str();
+		return;
+	}
+	// Reserve the blocks now, so a full disk shows here and not as SIGBUS
+	// in the push loop.
+#ifdef __linux__
+	bool allocated = posix_fallocate(m_fd, 0, (off_t)m_capacity) == 0;
+#else
+	bool allocated = ftruncate(m_fd, (off_t)m_capacity) == 0;
+#endif
+	if (allocated) {
+		void *base = mmap(nullptr, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (base != MAP_FAILED) m_base = (char *)base;
+	}
+#endif
+	if (!m_base) {
+		qDebug() << "Could not map" << m_capacity << "bytes of backup log" << path.c_str();
+		return;
+	}
+
+	m_header = (SessionLogHeader *)m_base;
+	std::memset(m_header, 0, sizeof(SessionLogHeader));
+	std::memcpy(m_header->magic, kSessionLogMagic, sizeof(kSessionLogMagic));
+	m_header->version = kSessionLogVersion;
+	m_header->headerSize = (uint32_t)m_tail.load();
+	m_header->capacity = m_capacity;
+	m_header->startTime = lsl::local_clock();
+}
+
+SessionLog::~SessionLog() {
+	uint64_t used = std::min(m_tail.load(), m_capacity);
+	if (m_header) {
+		m_header->capacity = used;
+		m_header->streamCount = (uint32_t)std::min(m_streamCount.load(), kSessionLogMaxStreams);
+	}
+#ifdef _WIN32
+	if (m_base) UnmapViewOfFile(m_base);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file) {
+		if (m_base) {
+			LARGE_INTEGER size;
+			size.QuadPart = (LONGLONG)used;
+			SetFilePointerEx(m_file, size, nullptr, FILE_BEGIN);
+			SetEndOfFile(m_file);
+		}
+		CloseHandle(m_file);
+	}
+#else
+	if (m_base) {
+		munmap(m_base, m_capacity);
+		if (ftruncate(m_fd, (off_t)used) != 0) qDebug() << "Could not trim backup log" << m_path.c_str();
+	}
+	if (m_fd >= 0) close(m_fd);
+#endif
+	if (m_dropped.load() > 0)
+		qDebug() << "Backup log" << m_path.c_str() << "was full; dropped" << m_dropped.load()
+				 << "samples.";
+}
+
+char *SessionLog::reserve(uint64_t bytes) {
+	uint64_t tail = m_tail.load(std::memory_order_relaxed);
+	do {
+		if (tail + bytes > m_capacity) return nullptr;
+	} while (!m_tail.compare_exchange_weak(tail, tail + bytes, std::memory_order_relaxed));
+	return m_base + tail;
+}
+
+void SessionLog::commit(char *record, uint32_t size) {
+	// Everything before the size must be in the mapping once a reader sees it.
+	std::atomic_thread_fence(std::memory_order_release);
+	*(volatile uint32_t *)record = size;
+}
+
+int SessionLog::addStream(const lsl::stream_info &info) {
+	if (!m_base) return -1;
+	QMutexLocker locker(&m_streamLock);
+	std::string key = streamKey(info);
+	auto known = std::find(m_streamKeys.begin(), m_streamKeys.end(), key);
+	if (known != m_streamKeys.end()) return (int)(known - m_streamKeys.begin());
+	int stream = (int)m_streamKeys.size();
+	if (stream >= kSessionLogMaxStreams) {
+		qDebug() << "Backup log" << m_path.c_str() << "has" << kSessionLogMaxStreams
+				 << "streams; not backing up" << info.source_id().c_str();
+		return -1;
+	}
+	std::string xml = info.as_xml();
+	uint64_t bytes = alignRecord(sizeof(LogRecordHeader) + sizeof(uint64_t) + xml.size());
+	char *record = reserve(bytes);
+	if (!record) return -1;
+
+	LogRecordHeader *rec = (LogRecordHeader *)record;
+	rec->type = (uint16_t)LogRecordType::StreamInfo;
+	rec->stream = (uint16_t)stream;
+	rec->count = (uint32_t)xml.size();
+	rec->channels = (uint32_t)info.channel_count();
+	uint64_t format = (uint64_t)info.channel_format();
+	std::memcpy(record + sizeof(LogRecordHeader), &format, sizeof(format));
+	std::memcpy(record + sizeof(LogRecordHeader) + sizeof(format), xml.data(), xml.size());
+	commit(record, (uint32_t)bytes);
+
+	m_channels[stream] = rec->channels;
+	m_valueSize[stream] = (uint32_t)channelFormatSize(info.channel_format());
+	m_header->streamInfoOffset[stream] = (uint64_t)(record - m_base);
+	m_streamKeys.push_back(key);
+	m_streamCount.store(stream + 1);
+	return stream;
+}
+
+void SessionLog::write(int stream, const double *stamps, const void *data, size_t count) {
+	if (stream < 0 || count == 0) return;
+	size_t valueBytes = count * m_channels[stream] * m_valueSize[stream];
+	uint64_t bytes = alignRecord(sizeof(LogRecordHeader) + count * sizeof(double) + valueBytes);
+	char *record = reserve(bytes);
+	if (!record) {
+		if (!m_bFullReported.exchange(true)) qDebug() << "Backup log" << m_path.c_str() << "is full.";
+		m_dropped.fetch_add(count, std::memory_order_relaxed);
+		return;
+	}
+
+	LogRecordHeader *rec = (LogRecordHeader *)record;
+	rec->type = (uint16_t)LogRecordType::Samples;
+	rec->stream = (uint16_t)stream;
+	rec->count = (uint32_t)count;
+	rec->channels = m_channels[stream];
+	char *payload = record + sizeof(LogRecordHeader);
+	std::memcpy(payload, stamps, count * sizeof(double));
+	std::memcpy(payload + count * sizeof(double), data, valueBytes);
+	commit(record, (uint32_t)bytes);
+}
+
+SessionLogReader::SessionLogReader(const std::string &path)
+	: m_file(path, std::ios::binary), m_bOpen(false), m_fileSize(0), m_offset(0) {
+	std::memset(&m_header, 0, sizeof(m_header));
+	if (!m_file) return;
+	m_file.seekg(0, std::ios::end);
+	m_fileSize = (uint64_t)m_file.tellg();
+	m_file.seekg(0);
+	if (m_fileSize < sizeof(SessionLogHeader)) return;
+	m_file.read((char *)&m_header, sizeof(m_header));
+	if (!m_file || std::memcmp(m_header.magic, kSessionLogMagic, sizeof(kSessionLogMagic)) != 0 ||
+		m_header.version != kSessionLogVersion || m_header.headerSize < sizeof(SessionLogHeader))
+		return;
+
+	// streamCount is only written on close; the offsets are there as soon
+	// as a stream is added.
+	int count = 0;
+	for (int ix = 0; ix < kSessionLogMaxStreams; ix++)
+		if (m_header.streamInfoOffset[ix] != 0) count = ix + 1;
+	m_streams.resize(count);
+	for (int ix = 0; ix < count; ix++) {
+		LogRecordHeader rec;
+		uint64_t offset = m_header.streamInfoOffset[ix];
+		if (offset == 0 || !readRecord(offset, rec) ||
+			rec.type != (uint16_t)LogRecordType::StreamInfo)
+			continue;
+		Stream &s = m_streams[ix];
+		uint64_t format = 0;
+		m_file.read((char *)&format, sizeof(format));
+		s.xml.resize(rec.count);
+		m_file.read(&s.xml[0], rec.count);
+		s.format = (lsl::channel_format_t)format;
+		s.channels = (int)rec.channels;
+		s.valueSize = channelFormatSize(s.format);
+	}
+	m_bOpen = (bool)m_file;
+	rewind();
+}
+
+void SessionLogReader::rewind() {
+	m_file.clear();
+	m_offset = m_header.headerSize;
+}
+
+bool SessionLogReader::readRecord(uint64_t offset, LogRecordHeader &record) {
+	if (offset + sizeof(LogRecordHeader) > m_fileSize) return false;
+	m_file.seekg((std::streamoff)offset);
+	m_file.read((char *)&record, sizeof(record));
+	return m_file && record.size >= sizeof(LogRecordHeader) && offset + record.size <= m_fileSize;
+}
+
+bool SessionLogReader::next(int &stream, std::vector<double> &stamps, std::vector<char> &data) {
+	LogRecordHeader rec;
+	while (m_bOpen && readRecord(m_offset, rec)) {
+		m_offset += rec.size;
+		if (rec.type != (uint16_t)LogRecordType::Samples || rec.stream >= m_streams.size()) continue;
+		const Stream &s = m_streams[rec.stream];
+		size_t valueBytes = (size_t)rec.count * s.channels * s.valueSize;
+		if (s.valueSize == 0 || (int)rec.channels != s.channels ||
+			sizeof(LogRecordHeader) + rec.count * sizeof(double) + valueBytes > rec.size)
+			continue;
+		stream = rec.stream;
+		stamps.resize(rec.count);
+		data.resize(valueBytes);
+		m_file.read((char *)stamps.data(), rec.count * sizeof(double));
+		m_file.read(data.data(), valueBytes);
+		return (bool)m_file;
+	}
+	return false;
+}
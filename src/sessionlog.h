@@ -0,0 +1,134 @@
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <QMutex>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "lsl_cpp.h"
+
+// Local backup of everything pushed to the outlets, for when the network or
+// the recorder loses data. One preallocated, memory-mapped file per streaming
+// session. A writer reserves its record with a compare-and-swap on the tail
+// and copies into the mapping, so pushing never waits on a lock or a write()
+// call. The file starts with a SessionLogHeader that indexes the StreamInfo
+// records; the records follow, 8-byte aligned. A record's size is stored
+// last, so a reader stops at the first record a crash left unfinished. Once
+// the file is full, further samples are counted and dropped.
+
+const char kSessionLogMagic[8] = {'P', 'S', 'M', 'L', 'O', 'G', '1', '\0'};
+const uint32_t kSessionLogVersion = 1;
+const int kSessionLogMaxStreams = 256;
+
+enum class LogRecordType : uint16_t { StreamInfo = 1, Samples = 2 };
+
+struct SessionLogHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;	// Offset of the first record.
+	uint64_t capacity;		// File size while recording; trimmed to the records on close.
+	double startTime;		// local_clock() when the log was opened.
+	uint32_t streamCount;	// Set on close.
+	uint32_t reserved;
+	uint64_t streamInfoOffset[kSessionLogMaxStreams]; // Per stream id.
+};
+
+struct LogRecordHeader {
+	uint32_t size;		// Whole record, header included; 0 while unfinished.
+	uint16_t type;		// LogRecordType.
+	uint16_t stream;
+	uint32_t count;		// StreamInfo: bytes of XML. Samples: samples.
+	uint32_t channels;
+};
+// A StreamInfo record holds the lsl::channel_format_t as a uint64, then the
+// outlet's stream_info XML. A Samples record holds count double timestamps,
+// then count * channels values in the stream's channel format.
+
+// Bytes per value of a numeric channel format; 0 for strings.
+size_t channelFormatSize(lsl::channel_format_t format);
+
+class SessionLog {
+public:
+	// Creates path, preallocated to capacity bytes. Check isOpen().
+	SessionLog(const std::string &path, uint64_t capacity);
+	~SessionLog(); // Trims the file to the records written.
+
+	bool isOpen() const { return m_base != nullptr; }
+	const std::string &path() const { return m_path; }
+
+	// Records the stream of an outlet. Returns its id for write(), or -1 if
+	// the log is closed, full or has kSessionLogMaxStreams streams. A stream
+	// with the source_id and layout of one recorded before, as an outlet
+	// recreated for a reconnected controller, gets that stream's id back.
+	// Any thread.
+	int addStream(const lsl::stream_info &info);
+	// Appends count samples of a stream, multiplexed as for
+	// push_chunk_multiplexed(). Never blocks; any thread.
+	void write(int stream, const double *stamps, const void *data, size_t count);
+	void write(int stream, double stamp, const void *data) { write(stream, &stamp, data, 1); }
+
+	uint64_t droppedSamples() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+	char *reserve(uint64_t bytes); // nullptr if it does not fit.
+	static void commit(char *record, uint32_t size);
+
+	std::string m_path;
+	uint64_t m_capacity;
+	char *m_base;
+	SessionLogHeader *m_header;
+	std::atomic<uint64_t> m_tail;
+	std::atomic<int> m_streamCount;
+	QMutex m_streamLock;					 // Serializes addStream().
+	std::vector<std::string> m_streamKeys;	 // Per stream id; see streamKey().
+	uint32_t m_channels[kSessionLogMaxStreams];
+	uint32_t m_valueSize[kSessionLogMaxStreams];
+	std::atomic<uint64_t> m_dropped;
+	std::atomic<bool> m_bFullReported;
+#ifdef _WIN32
+	void *m_file;
+	void *m_mapping;
+#else
+	int m_fd;
+#endif
+};
+
+// Reads a session log record by record, so files of any length stream
+// through a fixed amount of memory.
+class SessionLogReader {
+public:
+	struct Stream {
+		std::string xml; // The outlet's stream_info.
+		lsl::channel_format_t format = lsl::cf_undefined;
+		int channels = 0;
+		size_t valueSize = 0;
+	};
+
+	// Opens path and reads the stream index. Check isOpen().
+	explicit SessionLogReader(const std::string &path);
+
+	bool isOpen() const { return m_bOpen; }
+	double startTime() const { return m_header.startTime; }
+	// Indexed by stream id.
+	const std::vector<Stream> &streams() const { return m_streams; }
+
+	// The next Samples record, multiplexed. Returns false at the end of the
+	// records or at the first unfinished one.
+	bool next(int &stream, std::vector<double> &stamps, std::vector<char> &data);
+	// Back to the first record.
+	void rewind();
+
+private:
+	bool readRecord(uint64_t offset, LogRecordHeader &record);
+
+	std::ifstream m_file;
+	bool m_bOpen;
+	SessionLogHeader m_header;
+	uint64_t m_fileSize;
+	uint64_t m_offset; // Of the next record.
+	std::vector<Stream> m_streams;
+};
+
+#endif // SESSIONLOG_H
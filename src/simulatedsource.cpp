@@ -0,0 +1,266 @@
+#include "simulatedsource.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+const double kAccelCountsPerG = 4096.0;
+const double kGyroCountsPerRadPerSec = 1.0 / 0.00106;
+const double kMagCounts = 2048.0;
+const double kAccelNoiseG = 0.01;
+const double kGyroNoise = 0.005; // rad/s
+const double kPosNoiseCm = 0.2;
+const double kTwoPi = 6.283185307179586;
+
+struct Quat {
+	double w, x, y, z;
+};
+
+Quat mul(const Quat &a, const Quat &b) {
+	return {a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z, a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x, a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w};
+}
+
+Quat conj(const Quat &q) { return {q.w, -q.x, -q.y, -q.z}; }
+
+// Rotates the world vector v into the frame of orientation q.
+void toSensorFrame(const Quat &q, const double v[3], double out[3]) {
+	Quat r = mul(mul(conj(q), Quat{0.0, v[0], v[1], v[2]}), q);
+	out[0] = r.x;
+	out[1] = r.y;
+	out[2] = r.z;
+}
+
+// Yaw/pitch/roll swinging back and forth.
+Quat orientationAt(double t, double phase) {
+	double yaw = 0.8 * std::sin(0.5 * t + phase);
+	double pitch = 0.4 * std::sin(0.7 * t + 2.0 * phase);
+	double roll = 0.3 * std::sin(0.9 * t + 3.0 * phase);
+	Quat qy{std::cos(yaw / 2), 0.0, std::sin(yaw / 2), 0.0};
+	Quat qp{std::cos(pitch / 2), std::sin(pitch / 2), 0.0, 0.0};
+	Quat qr{std::cos(roll / 2), 0.0, 0.0, std::sin(roll / 2)};
+	return mul(mul(qy, qp), qr);
+}
+
+// Position in cm on a tilted loop in front of the camera.
+void positionAt(double t, double phase, double out[3]) {
+	out[0] = 20.0 * std::cos(0.6 * t + phase);
+	out[1] = 120.0 + 10.0 * std::sin(1.1 * t + phase);
+	out[2] = -50.0 + 20.0 * std::sin(0.6 * t + phase);
+}
+} // namespace
+
+SimulatedSource::SimulatedSource(const SimulatorSettings &settings)
+	: m_settings(settings), m_startTime(0.0), m_nextHotplug(0.0), m_bListChanged(false),
+	  m_bConnected(false), m_bStreamActive(false) {}
+
+SimulatedSource::~SimulatedSource() {}
+
+double SimulatedSource::now() const {
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count() - m_startTime;
+}
+
+bool SimulatedSource::inOutage() const {
+	if (m_settings.outagePeriod <= 0.0) return false;
+	double t = now();
+	return t >= m_settings.outagePeriod &&
+		std::fmod(t, m_settings.outagePeriod) < m_settings.outageLength;
+}
+
+bool SimulatedSource::isConnected() const { return m_bConnected && !inOutage(); }
+
+bool SimulatedSource::connect() {
+	if (m_startTime == 0.0) m_startTime = now();
+	if (inOutage()) return false;
+	// As after a service restart: same controllers, new views, sequence numbers from 0.
+	m_controllers.clear();
+	for (int i = 0; i < m_settings.controllers; i++) {
+		std::unique_ptr<SimController> ctrl(new SimController);
+		ctrl->rng.seed(m_settings.seed + i);
+		std::memset(&ctrl->view, 0, sizeof(ctrl->view));
+		ctrl->view.ControllerID = i;
+		ctrl->view.ControllerType = PSMController_Move;
+		ctrl->view.bValid = true;
+		ctrl->view.IsConnected = true;
+		ctrl->view.OutputSequenceNum = -1;
+		PSMPSMove &state = ctrl->view.ControllerState.PSMoveState;
+		// The seed is part of the serial so concurrent simulators can be told apart on the network.
+		std::snprintf(state.DeviceSerial, sizeof(state.DeviceSerial), "00:06:f7:%02x:%02x:%02x",
+			(m_settings.seed >> 8) & 0xff, m_settings.seed & 0xff, i);
+		std::snprintf(state.DevicePath, sizeof(state.DevicePath), "sim://psmove/%d", i);
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		ctrl->phase = kTwoPi * uniform(ctrl->rng);
+		ctrl->clockOffset = 100.0 + 3600.0 * uniform(ctrl->rng);
+		ctrl->clockDrift = 50e-6 * (2.0 * uniform(ctrl->rng) - 1.0);
+		m_controllers.push_back(std::move(ctrl));
+	}
+	m_nextHotplug = now() + m_settings.hotplugPeriod;
+	m_bListChanged = true;
+	m_bConnected = true;
+	return true;
+}
+
+void SimulatedSource::disconnect() {
+	m_controllers.clear();
+	m_bConnected = false;
+	m_bStreamActive = false;
+}
+
+void SimulatedSource::update() {
+	double t = now();
+	if (!isConnected()) return;
+	if (m_settings.hotplugPeriod > 0.0 && t >= m_nextHotplug && !m_controllers.empty()) {
+		SimController &ctrl = *m_controllers.back();
+		ctrl.plugged = !ctrl.plugged;
+		ctrl.view.IsConnected = ctrl.plugged;
+		ctrl.streaming = false;
+		m_nextHotplug = t + m_settings.hotplugPeriod;
+		m_bListChanged = true;
+	}
+	double period = 1.0 / m_settings.rate;
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	for (auto &ctrlPtr : m_controllers) {
+		SimController &ctrl = *ctrlPtr;
+		if (!ctrl.streaming || t < ctrl.heldUntil) continue;
+		// Generate every packet that is due; only the newest one survives, as in PSM_Update().
+		double newest = -1.0;
+		int newestSeq = ctrl.seq;
+		while (ctrl.nextPacket <= t) {
+			double packetTime = ctrl.nextPacket;
+			ctrl.nextPacket += period;
+			ctrl.seq++;
+			if (uniform(ctrl.rng) < m_settings.dropRate) continue;
+			newest = packetTime;
+			newestSeq = ctrl.seq;
+			if (uniform(ctrl.rng) < m_settings.burstRate * period) {
+				// Hold everything back for a while, then deliver it at once.
+				ctrl.heldUntil = packetTime + m_settings.burstLength;
+				break;
+			}
+		}
+		if (newest >= 0.0 && t >= ctrl.heldUntil) synthesize(ctrl, newest, newestSeq);
+	}
+}
+
+void SimulatedSource::synthesize(SimController &ctrl, double t, int seq) {
+	std::normal_distribution<double> noise(0.0, 1.0);
+	PSMPSMove &state = ctrl.view.ControllerState.PSMoveState;
+	const double h = 1e-3;
+
+	Quat q = orientationAt(t, ctrl.phase);
+	double pos[3], posPrev[3], posNext[3];
+	positionAt(t, ctrl.phase, pos);
+	positionAt(t - h, ctrl.phase, posPrev);
+	positionAt(t + h, ctrl.phase, posNext);
+
+	// Angular velocity in the sensor frame from the orientation change.
+	Quat dq = mul(conj(orientationAt(t - h, ctrl.phase)), orientationAt(t + h, ctrl.phase));
+	double gyro[3] = {dq.x / h, dq.y / h, dq.z / h};
+
+	// Specific force in g: linear acceleration plus the reaction to gravity (y up).
+	double accelWorld[3];
+	for (int i = 0; i < 3; i++) accelWorld[i] = (posNext[i] - 2.0 * pos[i] + posPrev[i]) / (h * h) / 981.0;
+	accelWorld[1] += 1.0;
+	double accel[3];
+	toSensorFrame(q, accelWorld, accel);
+
+	const double field[3] = {0.3, -0.4, 0.5};
+	double mag[3];
+	toSensorFrame(q, field, mag);
+
+	for (int i = 0; i < 3; i++) {
+		accel[i] += kAccelNoiseG * noise(ctrl.rng);
+		gyro[i] += kGyroNoise * noise(ctrl.rng);
+	}
+
+	double deviceTime = ctrl.clockOffset + t * (1.0 + ctrl.clockDrift);
+
+	PSMPSMoveCalibratedSensorData &calib = state.CalibratedSensorData;
+	calib.Accelerometer = {(float)accel[0], (float)accel[1], (float)accel[2]};
+	calib.Gyroscope = {(float)gyro[0], (float)gyro[1], (float)gyro[2]};
+	calib.Magnetometer = {(float)mag[0], (float)mag[1], (float)mag[2]};
+	calib.TimeInSeconds = deviceTime;
+
+	PSMPSMoveRawSensorData &raw = state.RawSensorData;
+	raw.Accelerometer = {(int)std::lround(accel[0] * kAccelCountsPerG),
+		(int)std::lround(accel[1] * kAccelCountsPerG), (int)std::lround(accel[2] * kAccelCountsPerG)};
+	raw.Gyroscope = {(int)std::lround(gyro[0] * kGyroCountsPerRadPerSec),
+		(int)std::lround(gyro[1] * kGyroCountsPerRadPerSec),
+		(int)std::lround(gyro[2] * kGyroCountsPerRadPerSec)};
+	raw.Magnetometer = {(int)std::lround(mag[0] * kMagCounts), (int)std::lround(mag[1] * kMagCounts),
+		(int)std::lround(mag[2] * kMagCounts)};
+	raw.TimeInSeconds = deviceTime;
+
+	state.Pose.Orientation = {(float)q.w, (float)q.x, (float)q.y, (float)q.z};
+	state.Pose.Position = {(float)pos[0], (float)pos[1], (float)pos[2]};
+	state.RawTrackerData.RelativePositionCm = {(float)(pos[0] + kPosNoiseCm * noise(ctrl.rng)),
+		(float)(pos[1] + kPosNoiseCm * noise(ctrl.rng)), (float)(pos[2] + kPosNoiseCm * noise(ctrl.rng))};
+	state.bIsOrientationValid = true;
+	state.bIsPositionValid = true;
+	state.bIsCurrentlyTracking = true;
+	state.BatteryValue = PSMBattery_100;
+
+	// A trigger squeeze every 4 s and a Move button press every 5 s, for the event stream.
+	double squeeze = std::fmod(t + ctrl.phase, 4.0);
+	state.TriggerValue = squeeze < 1.0 ? (unsigned char)std::lround(255.0 * std::sin(0.5 * kTwoPi * squeeze)) : 0;
+	state.TriggerButton = state.TriggerValue > 0 ? PSMButtonState_DOWN : PSMButtonState_UP;
+	state.MoveButton = std::fmod(t + ctrl.phase, 5.0) < 0.3 ? PSMButtonState_DOWN : PSMButtonState_UP;
+
+	ctrl.view.OutputSequenceNum = seq;
+}
+
+bool SimulatedSource::getControllerList(
+	std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) {
+	if (!isConnected()) return false;
+	ids.clear();
+	types.clear();
+	for (auto &ctrl : m_controllers) {
+		if (!ctrl->plugged) continue;
+		ids.push_back(ctrl->view.ControllerID);
+		types.push_back(ctrl->view.ControllerType);
+	}
+	return true;
+}
+
+bool SimulatedSource::getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) {
+	ids.clear();
+	types.clear();
+	return isConnected();
+}
+
+bool SimulatedSource::getTrackerList(PSMTrackerList &list) {
+	std::memset(&list, 0, sizeof(list));
+	return isConnected();
+}
+
+bool SimulatedSource::controllerListChanged() {
+	bool changed = m_bListChanged;
+	m_bListChanged = false;
+	return changed;
+}
+
+PSMController *SimulatedSource::getController(PSMControllerID id) {
+	if (id < 0 || id >= (int)m_controllers.size()) return nullptr;
+	return &m_controllers[id]->view;
+}
+
+void SimulatedSource::startControllerStreams(
+	const std::vector<PSMControllerID> &ids, unsigned int flags) {
+	double t = now();
+	for (auto it = ids.begin(); it < ids.end(); it++) {
+		if (*it < 0 || *it >= (int)m_controllers.size()) continue;
+		SimController &ctrl = *m_controllers[*it];
+		if (!ctrl.plugged) continue;
+		ctrl.streaming = true;
+		ctrl.nextPacket = t;
+		ctrl.heldUntil = 0.0;
+	}
+	m_bStreamActive = true;
+}
+
+void SimulatedSource::stopControllerStreams(const std::vector<PSMControllerID> &ids) {
+	for (auto it = ids.begin(); it < ids.end(); it++)
+		if (*it >= 0 && *it < (int)m_controllers.size()) m_controllers[*it]->streaming = false;
+}
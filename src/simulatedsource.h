@@ -0,0 +1,76 @@
+#ifndef SIMULATEDSOURCE_H
+#define SIMULATEDSOURCE_H
+
+#include <memory>
+#include <random>
+#include <vector>
+#include "controllersource.h"
+
+struct SimulatorSettings {
+	int controllers = 2;		// Number of synthetic PSMove controllers.
+	double rate = 120.0;		// Packets per second per controller.
+	double dropRate = 0.0;		// Probability that a packet is lost.
+	double burstRate = 0.0;		// Bursts per second per controller.
+	double burstLength = 0.02;	// Seconds a burst holds packets back.
+	double hotplugPeriod = 0.0;	// If > 0, the last controller disconnects and reconnects this often (s).
+	double outagePeriod = 0.0;	// If > 0, the simulated service goes away this often (s)...
+	double outageLength = 2.0;	// ...for this long (s).
+	unsigned int seed = 1;
+};
+
+// In-process stand-in for PSMoveService. Generates PSMove controllers moving
+// along smooth trajectories with consistent pose, IMU and raw sensor data,
+// a drifting device clock and sensor noise. Packets are produced on a fixed
+// schedule and, as with the real client, update() only exposes the newest
+// packet of each controller, so slow polling, dropped packets and bursts all
+// show up as gaps in OutputSequenceNum.
+class SimulatedSource : public ControllerSource {
+public:
+	explicit SimulatedSource(const SimulatorSettings &settings = SimulatorSettings());
+	~SimulatedSource() override;
+
+	bool connect() override;
+	void disconnect() override;
+	void update() override;
+	bool isConnected() const override;
+	bool getControllerList(std::vector<PSMControllerID> &ids, std::vector<PSMControllerType> &types) override;
+	PSMController *getController(PSMControllerID id) override;
+	void startControllerStreams(const std::vector<PSMControllerID> &ids, unsigned int flags) override;
+	bool controllerStreamsActive() const override { return m_bStreamActive; }
+	void stopControllerStreams(const std::vector<PSMControllerID> &ids) override;
+	bool controllerListChanged() override;
+	// Only controllers are simulated: no HMDs and no trackers.
+	bool getHmdList(std::vector<PSMHmdID> &ids, std::vector<PSMHmdType> &types) override;
+	PSMHeadMountedDisplay *getHmd(PSMHmdID) override { return nullptr; }
+	void startHmdStreams(const std::vector<PSMHmdID> &, unsigned int) override {}
+	void stopHmdStreams(const std::vector<PSMHmdID> &) override {}
+	bool getTrackerList(PSMTrackerList &list) override;
+
+private:
+	struct SimController {
+		PSMController view;
+		bool streaming = false;
+		bool plugged = true;
+		double nextPacket = 0.0; // Simulation time the next packet is generated.
+		double heldUntil = 0.0;	 // End of the current burst.
+		int seq = 0;			 // Sequence number of the last generated packet.
+		double phase = 0.0;		 // Per-controller offset of the trajectories.
+		double clockOffset = 0.0; // Device uptime at simulation start.
+		double clockDrift = 0.0;  // Device clock rate error.
+		std::mt19937 rng;
+	};
+
+	double now() const;
+	bool inOutage() const;
+	void synthesize(SimController &ctrl, double t, int seq);
+
+	SimulatorSettings m_settings;
+	std::vector<std::unique_ptr<SimController>> m_controllers;
+	double m_startTime;		 // Kept across reconnects, so the device clocks run on.
+	double m_nextHotplug;
+	bool m_bListChanged;
+	bool m_bConnected;
+	bool m_bStreamActive;
+};
+
+#endif // SIMULATEDSOURCE_H
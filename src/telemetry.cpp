@@ -0,0 +1,174 @@
+#include "telemetry.h"
+#include <QSysInfo>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+struct ChannelSpec {
+	const char *label;
+	const char *unit;
+};
+
+const ChannelSpec kPollSpecs[StatsOutlet::kPollChannels] = {{"poll_rate", "Hz"},
+	{"poll_cpu", "percent"}, {"poll_latency_mean", "ms"}, {"poll_latency_max", "ms"}};
+
+const ChannelSpec kDeviceSpecs[StatsOutlet::kDeviceChannels] = {{"packets_seen", "count"},
+	{"packets_pushed", "count"}, {"seq_skipped", "count"}, {"ring_overflows", "count"},
+	{"ring_high_water", "count"}, {"latency_mean", "ms"}, {"latency_max", "ms"},
+	{"push_time_mean", "us"}, {"push_time_max", "us"}};
+
+void appendChannel(lsl::xml_element &channels, const QString &label, const char *unit) {
+	channels.append_child("channel")
+		.append_child_value("label", label.toStdString())
+		.append_child_value("type", "Stats")
+		.append_child_value("unit", unit);
+}
+} // namespace
+
+void LatencyHistogram::record(double seconds) {
+	double us = seconds * 1e6;
+	int bucket = 0;
+	if (us >= 1.0)
+		bucket = std::min(kBuckets - 1, 1 + (int)(kBucketsPerOctave * std::log2(us)));
+	addCounter(m_counts[bucket], (uint64_t)1);
+	if (seconds > m_max.load(std::memory_order_relaxed))
+		m_max.store(seconds, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+	for (auto &count : m_counts) count.store(0, std::memory_order_relaxed);
+	m_max.store(0.0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::addTo(std::vector<uint64_t> &counts, double &max) const {
+	counts.resize(kBuckets, 0);
+	for (int b = 0; b < kBuckets; b++) counts[b] += m_counts[b].load(std::memory_order_relaxed);
+	max = std::max(max, m_max.load(std::memory_order_relaxed));
+}
+
+void LatencyHistogram::assign(const std::vector<uint64_t> &counts, double max) {
+	for (int b = 0; b < kBuckets; b++) m_counts[b].store(counts[b], std::memory_order_relaxed);
+	m_max.store(max, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::bucketLimit(int bucket) {
+	return 1e-6 * std::exp2((double)bucket / kBucketsPerOctave);
+}
+
+double LatencyHistogram::quantile(const std::vector<uint64_t> &counts, double q) {
+	uint64_t total = 0;
+	for (uint64_t n : counts) total += n;
+	if (total == 0) return 0.0;
+	uint64_t rank = (uint64_t)std::ceil(q * total), seen = 0;
+	for (size_t b = 0; b < counts.size(); b++) {
+		seen += counts[b];
+		if (seen >= rank && seen > 0) return bucketLimit((int)b);
+	}
+	return bucketLimit(kBuckets - 1);
+}
+
+QString LatencyHistogram::summary(const std::vector<uint64_t> &counts, double max) {
+	uint64_t total = 0;
+	for (uint64_t n : counts) total += n;
+	return QString("p50 <= %1 us, p99 <= %2 us, p99.9 <= %3 us, max %4 us (n = %5)")
+		.arg(1e6 * quantile(counts, 0.5), 0, 'f', 0)
+		.arg(1e6 * quantile(counts, 0.99), 0, 'f', 0)
+		.arg(1e6 * quantile(counts, 0.999), 0, 'f', 0)
+		.arg(1e6 * max, 0, 'f', 0)
+		.arg((qulonglong)total);
+}
+
+QStringList LatencyHistogram::table(const std::vector<uint64_t> &counts) {
+	uint64_t total = 0;
+	for (uint64_t n : counts) total += n;
+	QStringList lines;
+	uint64_t cumulative = 0;
+	for (size_t b = 0; b < counts.size(); b++) {
+		if (counts[b] == 0) continue;
+		cumulative += counts[b];
+		lines << QString("  <= %1 us: %2 (%3 %, cumulative %4 %)")
+					 .arg(1e6 * bucketLimit((int)b), 0, 'f', 0)
+					 .arg((qulonglong)counts[b])
+					 .arg(100.0 * counts[b] / total, 0, 'f', 3)
+					 .arg(100.0 * cumulative / total, 0, 'f', 3);
+	}
+	return lines;
+}
+
+StatsOutlet::StatsOutlet(const QStringList &deviceNames, double interval, SessionLog *log)
+	: m_deviceNames(deviceNames), m_log(log), m_logStream(-1), m_sample(kPollChannels + kDeviceChannels * deviceNames.size()),
+	  m_previous(deviceNames.size()) {
+	// Unique per host and device set, so bridges on one network do not collide.
+	QString sourceId = "PSMoveStats_" + QSysInfo::machineHostName() + "_" + deviceNames.join(",");
+	lsl::stream_info info("PSMoveStats", "Stats", (int)m_sample.size(), 1.0 / interval,
+		lsl::cf_double64, sourceId.toStdString());
+	info.desc()
+		.append_child("acquisition")
+		.append_child_value("manufacturer", "Sony")
+		.append_child_value("model", "PlayStation Move");
+	lsl::xml_element channels = info.desc().append_child("channels");
+	for (const ChannelSpec &spec : kPollSpecs) appendChannel(channels, spec.label, spec.unit);
+	for (const QString &name : deviceNames) {
+		// Label devices by controller id, as the data streams do.
+		QString prefix = name.section(':', 0, 0) + "_";
+		for (const ChannelSpec &spec : kDeviceSpecs)
+			appendChannel(channels, prefix + spec.label, spec.unit);
+	}
+	m_outlet.reset(new lsl::stream_outlet(info));
+	if (m_log) m_logStream = m_log->addStream(info);
+}
+
+QStringList StatsOutlet::publish(
+	const PollWaiter::Report &report, const std::vector<std::shared_ptr<DeviceCounters>> &counters) {
+	const auto relaxed = std::memory_order_relaxed;
+	double *s = m_sample.data();
+	s[0] = report.wallSeconds > 0 ? report.polls / report.wallSeconds : 0.0;
+	s[1] = 100.0 * report.cpuFraction;
+	s[2] = 1000.0 * report.meanLatencySeconds;
+	s[3] = 1000.0 * report.maxLatencySeconds;
+
+	QStringList lines;
+	for (size_t dev_ix = 0; dev_ix < counters.size() && dev_ix < m_previous.size(); dev_ix++) {
+		DeviceCounters &c = *counters[dev_ix];
+		Previous &prev = m_previous[dev_ix];
+		uint64_t pushed = c.packetsPushed.load(relaxed);
+		uint64_t pushes = c.pushes.load(relaxed);
+		double latencySum = c.latencySum.load(relaxed);
+		double pushTimeSum = c.pushTimeSum.load(relaxed);
+		// The max counters are per interval; reset them for the next one.
+		double latencyMax = c.latencyMax.exchange(0.0, relaxed);
+		double pushTimeMax = c.pushTimeMax.exchange(0.0, relaxed);
+
+		double *d = s + kPollChannels + dev_ix * kDeviceChannels;
+		d[0] = (double)c.packetsSeen.load(relaxed);
+		d[1] = (double)pushed;
+		d[2] = (double)c.seqSkipped.load(relaxed);
+		d[3] = (double)c.ringOverflows.load(relaxed);
+		d[4] = (double)c.ringHighWater.load(relaxed);
+		d[5] = pushed > prev.packetsPushed
+				   ? 1000.0 * (latencySum - prev.latencySum) / (pushed - prev.packetsPushed)
+				   : 0.0;
+		d[6] = 1000.0 * latencyMax;
+		d[7] = pushes > prev.pushes ? 1e6 * (pushTimeSum - prev.pushTimeSum) / (pushes - prev.pushes)
+									: 0.0;
+		d[8] = 1e6 * pushTimeMax;
+
+		lines << QString("%1: %2 pushed, %3 lost, latency %4/%5 ms, push %6/%7 us")
+					 .arg(m_deviceNames[dev_ix])
+					 .arg(pushed)
+					 .arg((qulonglong)d[2])
+					 .arg(d[5], 0, 'f', 2)
+					 .arg(d[6], 0, 'f', 2)
+					 .arg(d[7], 0, 'f', 0)
+					 .arg(d[8], 0, 'f', 0);
+		prev.packetsPushed = pushed;
+		prev.pushes = pushes;
+		prev.latencySum = latencySum;
+		prev.pushTimeSum = pushTimeSum;
+	}
+	lines << QString("Poll loop: %1 Hz, %2% CPU").arg(s[0], 0, 'f', 0).arg(s[1], 0, 'f', 1);
+	double now = lsl::local_clock();
+	m_outlet->push_sample(m_sample, now);
+	if (m_log) m_log->write(m_logStream, now, m_sample.data());
+	return lines;
+}
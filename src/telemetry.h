@@ -0,0 +1,104 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <QStringList>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "lsl_cpp.h"
+#include "pollwaiter.h"
+#include "sessionlog.h"
+
+// Counts of latencies in log-spaced buckets, four per octave from 1 us to
+// about 16 s, so quantiles are within 19 %. One writer thread; the reader
+// sums snapshots with addTo(). Nothing is allocated when recording.
+class LatencyHistogram {
+public:
+	static const int kBucketsPerOctave = 4;
+	static const int kBuckets = 1 + 24 * kBucketsPerOctave;
+
+	void record(double seconds);
+	void reset(); // By the writer thread.
+	// Adds the counts to counts (resized to kBuckets) and raises max.
+	void addTo(std::vector<uint64_t> &counts, double &max) const;
+	// Replaces the counts with counts (kBuckets long) and the max with max,
+	// so other threads can read a merged snapshot. By the writer thread.
+	void assign(const std::vector<uint64_t> &counts, double max);
+
+	static double bucketLimit(int bucket); // Upper edge in seconds.
+	// Upper edge of the bucket holding quantile q; 0 if counts is empty.
+	static double quantile(const std::vector<uint64_t> &counts, double q);
+	// "p50 <= 120 us, p99 <= 480 us, p99.9 <= 960 us, max 1210 us (n = 5000)".
+	static QString summary(const std::vector<uint64_t> &counts, double max);
+	// One line per non-empty bucket, with its share and cumulative share.
+	static QStringList table(const std::vector<uint64_t> &counts);
+
+private:
+	std::atomic<uint64_t> m_counts[kBuckets] = {};
+	std::atomic<double> m_max{0.0};
+};
+
+// Running totals for one streamed controller. Every counter has a single
+// writer thread, so the hot paths update them with relaxed load/store pairs;
+// the acquisition thread reads them once per stats interval.
+struct DeviceCounters {
+	// Written by the acquisition thread.
+	std::atomic<uint64_t> packetsSeen{0};	// New sequence numbers observed.
+	std::atomic<uint64_t> seqSkipped{0};	// Sequence numbers lost, ring overflows included.
+	std::atomic<uint64_t> ringOverflows{0}; // Packets dropped because the ring was full.
+	std::atomic<uint64_t> ringHighWater{0}; // Most packets waiting in the ring.
+	// Written by the publisher thread.
+	std::atomic<uint64_t> packetsPushed{0};
+	std::atomic<uint64_t> pushes{0};		// Flushes of the device's outlets.
+	std::atomic<double> latencySum{0.0};	// Capture-to-push seconds, summed over packets.
+	std::atomic<double> latencyMax{0.0};	// Reset by the reader every interval.
+	std::atomic<double> pushTimeSum{0.0};	// Seconds spent inside the outlet pushes.
+	std::atomic<double> pushTimeMax{0.0};	// Reset by the reader every interval.
+	LatencyHistogram pushLatency;			// Capture-to-push of each push's oldest sample.
+};
+
+// Single-writer increment; cheaper than fetch_add.
+template <typename T> inline void addCounter(std::atomic<T> &counter, T value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// CAS so a concurrent reset by the reader is never overwritten by a stale max.
+template <typename T> inline void raiseMax(std::atomic<T> &counter, T value) {
+	T current = counter.load(std::memory_order_relaxed);
+	while (value > current &&
+		   !counter.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+	}
+}
+
+// The PSMoveStats stream: once per interval, the poll-loop cost followed by a
+// block of counters for every streamed controller.
+class StatsOutlet {
+public:
+	static const int kPollChannels = 4;
+	static const int kDeviceChannels = 9;
+
+	// With a log, every sample is also written there.
+	StatsOutlet(const QStringList &deviceNames, double interval, SessionLog *log = nullptr);
+
+	// Pushes one sample and returns a summary line per device for display.
+	QStringList publish(
+		const PollWaiter::Report &report, const std::vector<std::shared_ptr<DeviceCounters>> &counters);
+
+private:
+	struct Previous {
+		uint64_t packetsPushed = 0;
+		uint64_t pushes = 0;
+		double latencySum = 0.0;
+		double pushTimeSum = 0.0;
+	};
+
+	QStringList m_deviceNames;
+	std::unique_ptr<lsl::stream_outlet> m_outlet;
+	SessionLog *m_log;
+	int m_logStream;
+	std::vector<double> m_sample;
+	std::vector<Previous> m_previous; // Totals at the last publish, for interval means.
+};
+
+#endif // TELEMETRY_H
@@ -0,0 +1,75 @@
+#include "threadutil.h"
+#include <QStringList>
+#include <algorithm>
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <alloca.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <cstring>
+#endif
+
+bool pinCurrentThread(int cpu) {
+	if (cpu < 0) return false;
+#ifdef _WIN32
+	if (cpu >= (int)(8 * sizeof(DWORD_PTR))) return false;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	// macOS has no hard affinity.
+	return false;
+#endif
+}
+
+bool setRealtimePriority(int priority) {
+#ifdef _WIN32
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#elif defined(__linux__)
+	sched_param param;
+	std::memset(&param, 0, sizeof(param));
+	param.sched_priority = std::min(std::max(priority, sched_get_priority_min(SCHED_FIFO)),
+		sched_get_priority_max(SCHED_FIFO));
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+	return false;
+#endif
+}
+
+bool lockProcessMemory() {
+#if defined(__linux__) && defined(MCL_ONFAULT)
+	// Pages mapped later (e.g. a large backup log) are locked as they are
+	// touched instead of being read in whole.
+	return mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == 0;
+#elif defined(__linux__)
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+	return false;
+#endif
+}
+
+void prefaultStack(size_t bytes) {
+	volatile char *stack = (volatile char *)alloca(bytes);
+	for (size_t i = 0; i < bytes; i += 4096) stack[i] = 0;
+}
+
+std::vector<int> parseCpuList(const QString &list) {
+	std::vector<int> cpus;
+	for (const QString &item : list.split(",")) {
+		QStringList range = item.trimmed().split("-");
+		bool okFirst = false, okLast = false;
+		int first = range.value(0).toInt(&okFirst);
+		int last = range.size() > 1 ? range.value(1).toInt(&okLast) : first;
+		if (!okFirst || (range.size() > 1 && !okLast)) continue;
+		for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+	}
+	return cpus;
+}
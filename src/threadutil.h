@@ -0,0 +1,28 @@
+#ifndef THREADUTIL_H
+#define THREADUTIL_H
+
+#include <vector>
+#include <QString>
+
+// Pins the calling thread to one CPU. Returns false if that is not supported
+// or failed.
+bool pinCurrentThread(int cpu);
+
+// Real-time scheduling for the calling thread: SCHED_FIFO at priority (1-99)
+// on Linux, THREAD_PRIORITY_TIME_CRITICAL on Windows. Linux needs
+// CAP_SYS_NICE or an rtprio limit. Returns false if not supported or refused.
+bool setRealtimePriority(int priority);
+
+// Locks the process's pages in RAM, present and future, so the real-time
+// threads never wait for a page fault. Linux only; needs CAP_IPC_LOCK or a
+// large enough memlock limit.
+bool lockProcessMemory();
+
+// Touches bytes of the calling thread's stack so it is faulted in (and, after
+// lockProcessMemory(), locked) before the first deadline.
+void prefaultStack(size_t bytes);
+
+// Parses a CPU list such as "2,3,6-7".
+std::vector<int> parseCpuList(const QString &list);
+
+#endif // THREADUTIL_H